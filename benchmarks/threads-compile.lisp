@@ -35,6 +35,16 @@ The statistics:
  [ 1589254  1589235  1589236  1589246  1589200  1589244  1589293  1589249  1589258  1589260  1589195  1589517  1589541  1589267  1589454  1589577  1589311  1589311  1589420  1589658  1589638  1589322  1589302  1589262  1426929  1589448  1589644  1589307  1589492  1589577]
  [  131124   133234   134216   132862   134032   133074   131811   133394   134221   133830   133337   135129   133034   131109   133957   130416   128010   133089   128650   131075   134138   133200   130342   132036   126419   133778   132877   135274   132027   132272]
  [ 6463084  5699894  6391162  5323400  5510025  5425688  6288613  4886611  5456971  5394043  5564274  5639621  5054329  5722550  5208487  5986264  6858847  5267559  7030543  5811645  5656792  5012832  6000738  5682139  7220169  6433044  5468151  5295718  5333045  5908446]
+The last lines summarize the most recent collections, up to 128 of them,
+from SB-EXT:GC-EVENTS: the worst and average pause, and the average time
+spent scavenging roots. GC helper threads only speed up the filtering of
+root pages, which skips the pages of older generations that have no
+pointers to younger ones; newspace is still scavenged and objects copied
+by one thread, so at best the pause shrinks by part of the roots time.
+To measure the effect of the helpers, run the same pair of parameters in
+processes started with --gc-threads 1 and with --gc-threads 4, e.g.
+  ./run-sbcl.sh --dynamic-space-size 4GB --gc-threads 4
+and compare the summaries.
 |#
 
 (defparameter *gcmetrics-condvar*
@@ -128,4 +138,18 @@ diff to apply:
       (pthread-mutex-unlock *gcmetrics-mutex*)
       (let ((end (get-internal-real-time)))
         (format t "~&all done: ~fs~%"
-                (/ (- end start) internal-time-units-per-second))))))
+                (/ (- end start) internal-time-units-per-second))))
+    (report-gc-pauses)))
+
+(defun report-gc-pauses ()
+  (let ((events (sb-ext:gc-events)))
+    (unless (zerop (length events))
+      (flet ((usec (ns) (round ns 1000))
+             (avg (key) (/ (reduce #'+ events :key key) (length events))))
+        (format t "~&~D GCs with ~D GC thread~:P: pause worst=~D avg=~D, ~
+                   roots avg=~D microsec~%"
+                (length events)
+                (extern-alien "gc_n_threads" int)
+                (usec (reduce #'max events :key #'sb-ext:gc-event-pause))
+                (usec (avg #'sb-ext:gc-event-pause))
+                (usec (avg #'sb-ext:gc-event-roots-time)))))))
@@ -369,6 +369,11 @@ not supported."
       (error "Cannot fork with multiple threads running."))
     (let ((pid (posix-fork)))
       #+darwin (when (= pid 0) (darwin-reinit))
+      ;; The child has no GC helper threads. Recreate them while it is
+      ;; still the only thread, before the finalizer thread starts.
+      #+sb-thread
+      (when (= pid 0)
+        (alien-funcall (extern-alien "gc_thread_pool_after_fork" (function void))))
       #+sb-thread (sb-impl::finalizer-thread-start)
       pid))
   (export 'fork :sb-posix)
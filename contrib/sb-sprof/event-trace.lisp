@@ -0,0 +1,37 @@
+;;;; Timeline of runtime events, for viewing in Perfetto or chrome://tracing
+
+(in-package #:sb-sprof)
+
+;;; The runtime has tracepoints in garbage collection and its phases,
+;;; stopping and restarting the world, the allocator's slow path, futex
+;;; waits, the finalizer thread and signal handlers. While tracing is on,
+;;; each thread records its events into a ring buffer of its own, so that
+;;; the trace holds the most recent events of each thread.
+
+(defun start-event-trace (&key (events-per-thread 65536))
+  "Start recording runtime events, discarding any recorded before. Each
+thread keeps its most recent EVENTS-PER-THREAD events (rounded up to a power
+of 2), including threads which exit while tracing. Threads which were
+already recording keep the size they had."
+  (declare (type (integer 1) events-per-thread))
+  (alien-funcall (extern-alien "tracelog_start" (function int int))
+                 (min events-per-thread (ash 1 24)))
+  (values))
+
+(defun stop-event-trace ()
+  "Stop recording runtime events. The events recorded are kept for
+WRITE-EVENT-TRACE."
+  (alien-funcall (extern-alien "tracelog_stop" (function void)))
+  (values))
+
+(defun write-event-trace (pathname)
+  "Write the runtime events recorded since START-EVENT-TRACE to PATHNAME,
+in the JSON trace event format that Perfetto and chrome://tracing load.
+Events may be written while tracing continues."
+  (let ((namestring (native-namestring (translate-logical-pathname pathname)
+                                       :as-file t)))
+    (when (minusp (alien-funcall (extern-alien "tracelog_write_json"
+                                               (function int c-string))
+                                 namestring))
+      (simple-perror (format nil "Couldn't write event trace to ~s" pathname))))
+  pathname)
@@ -0,0 +1,73 @@
+;;;; Sampling profiler of the live heap
+
+(in-package #:sb-sprof)
+
+;;; The runtime takes a backtrace each time a thread has claimed another
+;;; sample interval's worth of memory from the allocator, and remembers the
+;;; object being allocated along with the bytes that the sample stands for.
+;;; Every garbage collection drops the samples whose object died, so what
+;;; remains estimates the live heap by allocating stack. Allocations are
+;;; sampled on the allocator's slow path, which is taken once per allocation
+;;; region, so the interval is only met on average.
+
+(defun start-heap-profiling (&key (sample-interval (* 512 1024)))
+  "Start sampling allocations for HEAP-PROFILE, once per SAMPLE-INTERVAL
+bytes allocated by each thread, on average. Samples taken earlier are
+discarded. Smaller intervals give a finer picture of the heap at the cost
+of more backtraces. Only supported with the generational garbage collector
+on x86 and x86-64."
+  (declare (type (integer 1) sample-interval))
+  (stop-heap-profiling)
+  (setf (extern-alien "heap_profile_interval" (unsigned #.sb-vm:n-word-bits))
+        sample-interval)
+  (values))
+
+(defun stop-heap-profiling ()
+  "Stop sampling allocations, and discard the samples taken."
+  (setf (extern-alien "heap_profile_interval" (unsigned #.sb-vm:n-word-bits)) 0)
+  (alien-funcall (extern-alien "heap_profile_reset" (function void)))
+  (values))
+
+(defun heap-profile ()
+  "Return an estimate of the heap that was live as of the last garbage
+collection, by the stack which allocated it, from the samples taken since
+START-HEAP-PROFILING. Each element is a list (BYTES SAMPLES STACK), where
+STACK is a list of frame names as strings, innermost first, and SAMPLES is
+the number of sampled objects allocated there that are still alive. The
+result is sorted by decreasing BYTES."
+  (let ((sap (alien-funcall (extern-alien "heap_profile_snapshot"
+                                          (function system-area-pointer))))
+        (names (make-hash-table :test 'eq))
+        (stacks (make-hash-table :test 'equal)))
+    (unless (zerop (sap-int sap))
+      (unwind-protect
+           (loop for (trace . bytes) in (extract-traces sap (build-serialno-to-code-map))
+                 do (let* ((stack (loop for i below (length trace) by 2
+                                        collect (collapsed-frame-name
+                                                 (aref trace i) (aref trace (1+ i)) names)))
+                           (entry (or (gethash stack stacks)
+                                      (setf (gethash stack stacks) (list 0 0 stack)))))
+                      (incf (first entry) bytes)
+                      (incf (second entry))))
+        (deallocate-system-memory
+         sap (* (nth-value 2 (sprof-data-header sap)) element-size))))
+    (sort (loop for entry being each hash-value of stacks collect entry)
+          #'> :key #'first)))
+
+(defun report-heap-profile (&key (stream *standard-output*) (max 20) (depth 10))
+  "Print the MAX stacks of HEAP-PROFILE with the most live bytes, showing at
+most DEPTH frames of each."
+  (let* ((profile (heap-profile))
+         (total (max 1 (reduce #'+ profile :key #'first))))
+    (format stream "~&~:D bytes live in ~:D sampled stack~:P~%"
+            (reduce #'+ profile :key #'first) (length profile))
+    (loop for (bytes samples stack) in profile
+          repeat max
+          do (format stream "~%~14:D ~5,1F% ~D sample~:P~%"
+                     bytes (* 100 (/ bytes total)) samples)
+             (loop for name in stack
+                   repeat depth
+                   do (format stream "~8T~A~%" name))
+             (when (> (length stack) depth)
+               (format stream "~8T...~%"))))
+  (values))
@@ -126,6 +126,11 @@ The following keyword args are recognized:
      the profiler in allocation profiling mode. If :TIME, run the profiler
      in wallclock profiling mode.
 
+     On Linux with threads, :CPU mode samples each thread after every <n>
+     seconds of CPU time used by that thread.  Elsewhere, a sample is taken
+     after every <n> seconds of CPU time used by the process, in whichever
+     thread the operating system signals.
+
    :MAX-SAMPLES <max>
      Maximum number of stack traces to collect.  Default is *MAX-SAMPLES*.
 
@@ -187,7 +192,12 @@ The following keyword args are recognized:
      (multiple-value-bind (secs usecs)
          (multiple-value-bind (secs rest) (truncate sample-interval)
            (values secs (truncate (* rest 1000000))))
-       (unix-setitimer :profile secs usecs secs usecs)))
+       ;; Give each thread a timer on its own CPU clock if the runtime can,
+       ;; so that every thread is sampled at the requested rate.
+       (when (zerop (alien-funcall (extern-alien "sb_sprof_start_thread_timers"
+                                                 (function int long))
+                                   (+ (* secs 1000000) usecs)))
+         (unix-setitimer :profile secs usecs secs usecs))))
     (:time
      #+sb-thread
      (flet ((map-threads (function &aux (threads sb-thread::*profiled-threads*))
@@ -228,6 +238,7 @@ The following keyword args are recognized:
         (:alloc
          (setq enable-alloc-profiler 0))
         (:cpu
+         (alien-funcall (extern-alien "sb_sprof_stop_thread_timers" (function void)))
          (unix-setitimer :profile 0 0 0 0))
         (:time
          (let ((timer *timer*))
@@ -236,6 +247,7 @@ The following keyword args are recognized:
            (setf *timer* nil)
            #-sb-thread (unschedule-timer timer)
            #+sb-thread (sb-thread:join-thread timer))))
+     (stop-streaming)
      (disable-call-counting)
      ;; New threads should not mask SIGPROF by default
      #+sb-thread (setf sb-thread::*profiled-threads* :all)
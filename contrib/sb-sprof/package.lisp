@@ -21,6 +21,16 @@
    ;; Interface
    #:*sample-interval* #:*max-samples*
    #:start-profiling #:stop-profiling #:with-profiling
-   #:reset))
+   #:reset
+
+   ;; Streaming
+   #:start-streaming #:stop-streaming #:write-collapsed-samples
+
+   ;; Heap profiling
+   #:start-heap-profiling #:stop-heap-profiling
+   #:heap-profile #:report-heap-profile
+
+   ;; Runtime event tracing
+   #:start-event-trace #:stop-event-trace #:write-event-trace))
 (eval-when (:compile-toplevel :load-toplevel :execute)
   (setf (sb-int:system-package-p (find-package "SB-SPROF")) t))
@@ -0,0 +1,97 @@
+;;;; Continuous export of samples while the statistical profiler runs
+
+(in-package #:sb-sprof)
+
+;;; Samples are normally converted only after profiling stops, and sampling
+;;; stops for good in a thread whose buffer fills up. When streaming, a
+;;; background thread periodically takes each thread's buffer (which the
+;;; thread replaces with a fresh one at its next sample), symbolizes the
+;;; traces and writes them out, so that a process can be profiled
+;;; indefinitely in bounded memory.
+
+;;; (THREAD . SEMAPHORE) while streaming. The semaphore stops the thread.
+(defglobal *streamer* nil)
+
+(defun collapsed-frame-name (info pc-or-offset names)
+  (or (gethash info names)
+      (setf (gethash info names)
+            (let ((name (if info
+                            (node-name (make-node info))
+                            (format nil "foreign function #x~x" pc-or-offset))))
+              ;; Semicolons separate frames, and a line is one stack
+              (substitute-if #\_ (lambda (c) (member c '(#\; #\Newline)))
+                             (if (stringp name)
+                                 name
+                                 (let ((*package* (find-package "KEYWORD"))
+                                       (*print-pretty* nil))
+                                   (prin1-to-string name))))))))
+
+(defun write-collapsed-samples (stream)
+  "Write the samples not yet written or reported, and release their memory.
+Each line of output is one stack, outermost frame first and frames separated
+by semicolons, followed by a space and the number of times it was sampled.
+Return the number of samples written."
+  (let ((serialno-to-code (build-serialno-to-code-map))
+        (names (make-hash-table :test 'eq))
+        (stacks (make-hash-table :test 'equal))
+        (n-samples 0))
+    (let ((saved-sigprof-mask (sb-toggle-sigprof (int-sap 0) 1)))
+      (call-with-each-profile-buffer
+       (lambda (sap thread memusage &aux (n-buffer-samples 0))
+         (declare (ignore thread memusage))
+         (loop for (trace . multiplicity) in (extract-traces sap serialno-to-code)
+               do (let ((stack
+                          (with-output-to-string (s)
+                            (loop for i downfrom (- (length trace) 2) to 0 by 2
+                                  do (write-string (collapsed-frame-name
+                                                    (aref trace i) (aref trace (1+ i)) names)
+                                                   s)
+                                     (when (> i 0) (write-char #\; s))))))
+                    (incf (gethash stack stacks 0) multiplicity)
+                    (incf n-buffer-samples multiplicity)))
+         ;; They no longer count toward :MAX-SAMPLES
+         (alien-funcall (extern-alien "sb_sprof_release_samples" (function void int))
+                        n-buffer-samples)
+         (incf n-samples n-buffer-samples)))
+      (sb-toggle-sigprof (int-sap 0) saved-sigprof-mask))
+    (maphash (lambda (stack count) (format stream "~a ~d~%" stack count)) stacks)
+    (finish-output stream)
+    n-samples))
+
+(defun start-streaming (stream &key (interval 10))
+  "Write samples to STREAM every INTERVAL seconds, in the format of
+WRITE-COLLAPSED-SAMPLES, until STOP-STREAMING or STOP-PROFILING is called.
+Samples no longer count toward :MAX-SAMPLES once written, so that it
+limits the samples held in memory between writes rather than the total.
+The samples are symbolized and written by a background thread, which is
+not itself sampled. To write to a file descriptor, make a stream for it
+with SB-SYS:MAKE-FD-STREAM."
+  (declare (type (real (0)) interval))
+  #-sb-thread (declare (ignore stream interval))
+  #-sb-thread (error "Streaming samples requires thread support.")
+  #+sb-thread
+  (progn
+    (stop-streaming)
+    (setf (extern-alien "sb_sprof_streaming" int) 1)
+    (let ((semaphore (sb-thread:make-semaphore)))
+      (setf *streamer*
+            (cons (sb-thread:make-thread
+                   (lambda ()
+                     (stop-sampling)
+                     (loop until (sb-thread:wait-on-semaphore semaphore :timeout interval)
+                           do (write-collapsed-samples stream))
+                     ;; Whatever is left
+                     (write-collapsed-samples stream))
+                   :name "SPROF streamer")
+                  semaphore))))
+  (values))
+
+(defun stop-streaming ()
+  "Stop writing samples periodically, after writing those remaining."
+  (let ((streamer *streamer*))
+    (when streamer
+      (setf *streamer* nil)
+      (sb-thread:signal-semaphore (cdr streamer))
+      (sb-thread:join-thread (car streamer))
+      (setf (extern-alien "sb_sprof_streaming" int) 0)))
+  (values))
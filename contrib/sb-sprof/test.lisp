@@ -43,6 +43,108 @@
           while (< (get-universal-time) target)
           do (consalot))))
 
+;;; Each thread is sampled on its own CPU clock, so in proportion to the
+;;; CPU time it used, whichever thread the kernel would rather signal:
+;;; about equally for the busy threads, and hardly at all for the main
+;;; thread, which sleeps.
+#+(and linux sb-thread)
+(defun per-thread-cpu-test ()
+  (let* ((stop (list nil))
+         (threads (loop repeat 4
+                        collect (sb-thread:make-thread
+                                 (lambda ()
+                                   (loop until (car stop) do (test-0 4)))))))
+    (unwind-protect
+         (with-profiling (:reset t :sample-interval 0.001 :max-samples 100000
+                          :report :flat)
+           (sleep 1))
+      (setf (car stop) t)
+      (mapc #'sb-thread:join-thread threads))
+    (let ((counts (make-hash-table)))
+      (map-traces (lambda (thread trace)
+                    (declare (ignore trace))
+                    (incf (gethash thread counts 0)))
+                  sb-sprof::*samples*)
+      (let* ((busy (mapcar (lambda (thread) (gethash thread counts 0)) threads))
+             (mean (/ (reduce #'+ busy) (length busy))))
+        (dolist (count busy)
+          (assert (< (/ mean 2) count (* mean 2))))
+        (assert (< (gethash sb-thread:*current-thread* counts 0) (/ mean 10)))))))
+
+;;; Samples written while profiling are no longer held, and don't count
+;;; toward the limit.
+#+sb-thread
+(defun streaming-test ()
+  (let ((output (make-string-output-stream)))
+    (start-profiling :max-samples 100 :sample-interval 0.001)
+    (start-streaming output :interval 0.05)
+    (loop with end = (+ (get-internal-real-time) internal-time-units-per-second)
+          while (< (get-internal-real-time) end)
+          do (test-0 4))
+    (stop-profiling)
+    (let ((lines (with-input-from-string (s (get-output-stream-string output))
+                   (loop for line = (read-line s nil) while line collect line))))
+      (assert (> (loop for line in lines
+                       sum (parse-integer line :start (1+ (position #\Space line :from-end t))))
+                 100))
+      (assert (find-if (lambda (line) (search "TEST-0" line)) lines)))))
+
+;;; The same goes for the samples of threads which exited: each thread in
+;;; turn takes about as many samples as the limit allows. The streamer only
+;;; writes when stopped, so that the test can write after each thread.
+#+sb-thread
+(defun streaming-thread-exit-test ()
+  (start-profiling :max-samples 100 :sample-interval 0.001)
+  (start-streaming (make-broadcast-stream) :interval 1000)
+  (unwind-protect
+       (let ((total 0))
+         (dotimes (i 10)
+           (sb-thread:join-thread
+            (sb-thread:make-thread
+             (lambda ()
+               (loop with end = (+ (get-internal-real-time)
+                                   (floor internal-time-units-per-second 10))
+                     while (< (get-internal-real-time) end)
+                     do (test-0 4)))))
+           (let ((n (write-collapsed-samples (make-broadcast-stream))))
+             (assert (plusp n))
+             (incf total n)))
+         (assert (> total 100)))
+    (stop-profiling)))
+
+;;; Samples of objects that are still reachable remain in the heap profile,
+;;; and those of garbage are dropped.
+#+(and gencgc (or x86 x86-64))
+(defun heap-profile-test ()
+  (start-heap-profiling :sample-interval 4096)
+  (unwind-protect
+       (let ((kept (consalot)))
+         (loop repeat 10 do (consalot))
+         (sb-ext:gc :full t)
+         (let ((bytes (loop for (n nil stack) in (heap-profile)
+                            when (find "CONSALOT" stack :test #'search)
+                            sum n)))
+           ;; About 1MB is kept and 10 times as much became garbage
+           (assert (< 0 bytes (* 8 1024 1024))))
+         (length kept))
+    (stop-heap-profiling)))
+
+;;; A GC shows up in the runtime event trace.
+#+gencgc
+(defun event-trace-test ()
+  (let ((pathname "./event-trace.json"))
+    (start-event-trace)
+    (gc)
+    (stop-event-trace)
+    (write-event-trace pathname)
+    (let ((json (with-open-file (stream pathname)
+                  (let ((string (make-string (file-length stream))))
+                    (subseq string 0 (read-sequence string stream))))))
+      (delete-file pathname)
+      (assert (search "\"traceEvents\"" json))
+      (assert (search "{\"name\":\"GC\",\"ph\":\"B\"" json))
+      (assert (search "{\"name\":\"GC\",\"ph\":\"E\"" json)))))
+
 ;; This has been failing on Sparc/SunOS for a while,
 ;; having nothing to do with the rewrite of sprof's
 ;; data collector into C. Maybe it works on Linux
@@ -75,6 +177,11 @@
   (let ((*standard-output* (make-broadcast-stream)))
     (test)
     (consing-test)
+    #+(and linux sb-thread) (per-thread-cpu-test)
+    #+sb-thread (streaming-test)
+    #+sb-thread (streaming-thread-exit-test)
+    #+(and gencgc (or x86 x86-64)) (heap-profile-test)
+    #+gencgc (event-trace-test)
     ;; This test shows that STOP-SAMPLING and START-SAMPLING on a thread do something.
     ;; Based on rev b6bf65d9 it would seem that the API got broken a little.
     ;; The thread doesn't do a whole lot, which is fine for what it is.
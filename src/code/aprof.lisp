@@ -17,9 +17,10 @@
 ;;; a counter (or two). If the allocation is a compile-time fixed size,
 ;;; only one counter is needed. If the size is variable, then two counters
 ;;; are used: hits and total bytes.
-;;; The array of counters is prepared by the profiler when first started.
-;;; The index into the array for any particular counter is determined
-;;; the first time that counter is hit.  Subsequent hits are cheap.
+;;; Each thread has its own array of counters, so that threads don't
+;;; contend for counters of the same allocation point. They are summed
+;;; when collecting. The index into the arrays for any particular counter
+;;; is determined the first time that counter is hit. Subsequent hits are cheap.
 
 ;;; On x86-64, instrumented code initially looks like this:
 
@@ -85,13 +86,8 @@
 (defvar *allocation-fixups-installed*
   (make-hash-table :test 'eq :weakness :key :synchronized t))
 
-(define-alien-variable alloc-profile-buffer system-area-pointer)
 (defun aprof-reset ()
-  (alien-funcall (extern-alien "memset" (function void system-area-pointer int size-t))
-                 alloc-profile-buffer
-                 0
-                 (* (/ (length *allocation-profile-metadata*) 2)
-                    sb-vm:n-word-bytes)))
+  (alien-funcall (extern-alien "allocation_profiler_reset" (function void))))
 
 (defun patch-fixups ()
   (let ((n-fixups 0)
@@ -485,6 +481,8 @@
 
 (defun aprof-collect (stream)
   (sb-disassem:get-inst-space) ; for effect
+  ;; Sum the counters of all threads into alloc_profile_buffer
+  (alien-funcall (extern-alien "allocation_profiler_collect" (function void)))
   (let* ((metadata *allocation-profile-metadata*)
          (n-hit (extern-alien "alloc_profile_n_counters" int))
          (metadata-len (/ (length metadata) 2))
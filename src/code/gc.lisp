@@ -120,7 +120,89 @@ designated file is opened before and after each collection, and generation
 statistics are appended to it."
     (let ((val (cast %gc-logfile c-string)))
       (when val
-        (native-pathname val)))))
+        (native-pathname val))))
+  (define-alien-variable ("gc_logfile_format" %gc-logfile-format) int)
+  (defun gc-logfile-format ()
+    "Return :TEXT or :JSON, the format of records written to GC-LOGFILE.
+Can be SETF. :TEXT logs the generation statistics before and after each
+collection, while :JSON appends one line per collection, a JSON object
+with the slots of a GC-EVENT and the size of each generation."
+    (if (zerop %gc-logfile-format) :text :json))
+  (defun (setf gc-logfile-format) (format)
+    (setf %gc-logfile-format (ecase format (:text 0) (:json 1)))
+    format)
+  (define-alien-variable ("gc_max_pause_ns" %gc-max-pause-ns) (unsigned 64))
+  (defun gc-max-pause ()
+    "Return the goal for the longest pause of a garbage collection, in seconds,
+or NIL if there is none, the default. Can be SETF.
+
+With a goal, the amount of memory allocated between collections is no longer
+fixed at BYTES-CONSED-BETWEEN-GCS, which becomes its upper limit. Instead it
+is chosen based on the copying speed and the survival rate measured in
+previous collections. Collection of older generations is put off, for a few
+collections at most, when it is not expected to finish within the goal, and
+objects which survive repeated collections of the nursery are promoted early.
+The goal is not a guarantee: full collections in particular can exceed it.
+
+Experimental: interface subject to change."
+    (let ((ns %gc-max-pause-ns))
+      (unless (zerop ns)
+        (/ ns 1d9))))
+  (defun (setf gc-max-pause) (seconds)
+    (declare (type (or null (real (0))) seconds))
+    (setf %gc-max-pause-ns (if seconds (max 1 (round (* seconds 1000000000))) 0))
+    seconds))
+
+;;; The C runtime keeps a record of the last GC-EVENT-LOG-SIZE collections.
+(defconstant gc-event-log-size 128) ; GC_EVENT_LOG_SIZE in gencgc.c
+
+(macrolet ((def (&rest slots)
+             `(progn
+                (defstruct (gc-event (:copier nil) (:predicate nil)
+                                     (:constructor make-gc-event ,slots))
+                  "A record of one garbage collection, as returned by GC-EVENTS."
+                  ,@(mapcar (lambda (slot)
+                              `(,slot 0 :type (unsigned-byte 64) :read-only t))
+                            slots))
+                ;; This duplicates the struct definition in gencgc.c
+                #+gencgc
+                (define-alien-variable gc-event-log
+                    (array (struct gc-event
+                                   ,@(mapcar (lambda (slot) `(,slot (unsigned 64)))
+                                             slots))
+                           128)) ; GC-EVENT-LOG-SIZE
+                (defun gc-events ()
+                  "Return a vector of GC-EVENTs describing the most recent garbage
+collections, oldest first. The slots of a GC-EVENT are:
+  SERIAL         - 1 for the first collection since startup
+  GENERATION     - the highest generation collected, 7 for (GC :GEN 7)
+  TIME-TO-STOP   - time taken to stop other threads, 0 if not measured
+  THREADS-STOPPED - the number of other threads, if TIME-TO-STOP was measured
+  PAUSE          - time spent collecting, not including TIME-TO-STOP
+  PIN-TIME, ROOTS-TIME, NEWSPACE-TIME, WEAK-TIME, FREE-TIME
+                 - the parts of PAUSE spent in each phase of collection
+  ROOT-PAGES     - pages of older generations scavenged as roots
+  BYTES-COPIED   - bytes of objects copied to a new location
+  OBJECTS-PINNED - objects which could not move due to ambiguous roots
+Times are in nanoseconds. Available on GENCGC platforms only.
+
+Experimental: interface subject to change."
+                  #-gencgc (vector)
+                  #+gencgc
+                  (without-gcing
+                    (let* ((count (extern-alien "gc_event_count" (unsigned 64)))
+                           (n (min count gc-event-log-size))
+                           (result (make-array n)))
+                      (dotimes (i n result)
+                        (let ((event (deref gc-event-log
+                                            (mod (+ (- count n) i) gc-event-log-size))))
+                          (setf (svref result i)
+                                (make-gc-event
+                                 ,@(mapcar (lambda (slot) `(slot event ',slot))
+                                           slots))))))))))
+  (def serial generation time-to-stop threads-stopped pause
+       pin-time roots-time newspace-time weak-time free-time
+       root-pages bytes-copied objects-pinned))
 
 (declaim (inline dynamic-space-size))
 (defun dynamic-space-size ()
@@ -405,7 +487,8 @@ Note: currently changes to this value are lost when saving core."
             (number-of-gcs int)
             (number-of-gcs-before-promotion int)
             (cum-sum-bytes-allocated os-vm-size-t)
-            (minimum-age-before-gc double)))
+            (minimum-age-before-gc double)
+            (swept-bytes os-vm-size-t)))
 
 #+gencgc
 (define-alien-variable generations
@@ -507,6 +507,9 @@ We could try a few things to mitigate this:
        ;; prove to be an issue with concurrent systems, or with
        ;; spectacularly poor timing for closing an allocation region
        ;; in a single-threaded system.
+  ;; Garbage not yet swept after a lazy mark-only GC may point to
+  ;; objects that were, so it must not be seen.
+  (alien-funcall (extern-alien "finish_lazy_sweep" (function void)))
   (close-current-gc-region)
   (do ((initial-next-free-page next-free-page)
        (base (int-sap (current-dynamic-space-start)))
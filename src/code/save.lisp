@@ -23,7 +23,7 @@
   (initial-fun (unsigned #.sb-vm:n-word-bits))
   (prepend-runtime int)
   (save-runtime-options int)
-  (compressed int)
+  (compression int)
   (compression-level int)
   (application-type int))
 
@@ -32,7 +32,7 @@
   (file c-string)
   (prepend-runtime int)
   (save-runtime-options int)
-  (compressed int)
+  (compression int)
   (compression-level int)
   (application-type int))
 
@@ -80,6 +80,21 @@
        sb-thread::*session*
        sb-kernel::*gc-epoch*))
 
+#+gencgc
+(defun write-access-profile (pathname)
+  "Write to PATHNAME the pages of dynamic space loaded from the core which
+this process has touched, for the :ACCESS-PROFILE argument of
+SAVE-LISP-AND-DIE. Call it after running a representative workload, and
+before any full GC, which touches every page and moves what is on them.
+The core must have been loaded uncompressed at the address it was saved
+for. Currently supported only on Linux."
+  (let ((name (native-namestring (physicalize-pathname pathname) :as-file t)))
+    (unless (zerop (alien-funcall (extern-alien "gc_write_access_profile"
+                                                (function int c-string))
+                                  name))
+      (error "Unable to write access profile ~S" name))
+    pathname))
+
 (defun start-lisp (toplevel)
   (named-lambda start-lisp ()
     (handling-end-of-the-world
@@ -94,6 +109,12 @@
                                          (root-structures ())
                                          (environment-name "auxiliary")
                                          (compression nil)
+                                         #+gencgc
+                                         (read-only-constants nil)
+                                         #+gencgc
+                                         (base-core nil)
+                                         #+gencgc
+                                         (access-profile nil)
                                          #+win32
                                          (application-type :console))
   "Save a \"core image\", i.e. enough information to restart a Lisp
@@ -154,7 +175,41 @@ The following &KEY arguments are defined:
      feature enabled. If NIL (the default), saves to uncompressed core files. If
      :SB-CORE-COMPRESSION was enabled at build-time, the argument may also be
      an integer from -1 to 9, corresponding to zlib compression levels, or T
-     (which is equivalent to the default compression level, -1).
+     (which is equivalent to the default compression level, -1). It may also
+     name a codec, :ZLIB or (if the runtime was built with the :SB-ZSTD
+     feature) :ZSTD, either alone to use the codec's default level or as a
+     list such as (:ZSTD 19). The heap is compressed in independent chunks
+     using all available processors, and decompressed likewise at startup.
+
+  :READ-ONLY-CONSTANTS
+     Present only on platforms using the generational garbage collector.
+     If true, strings and other specialized vectors which are literal
+     constants, such as symbol names, and boxed numbers are moved onto
+     pages of their own, which are mapped read-only when the core is
+     loaded. As nothing ever writes them, processes started from the same
+     uncompressed core file share the memory of those pages. Modifying
+     such a constant signals a memory fault error.
+
+  :BASE-CORE
+     Present only on platforms using the generational garbage collector.
+     If supplied, it names an uncompressed core file, normally the one
+     this Lisp was started from, and a delta core is saved: only the pages which differ
+     from those of the base core are written, and at startup the runtime
+     maps the base core and then the changed pages over it. Objects loaded
+     from the base core are neither collected nor moved when saving, so
+     the delta grows with what was added or modified since startup rather
+     than with the heap. The base core must not change or move afterwards,
+     unless the runtime option --base-core names its new location. Can
+     not be combined with :COMPRESSION.
+
+  :ACCESS-PROFILE
+     Present only on platforms using the generational garbage collector.
+     If supplied, it names a file written by WRITE-ACCESS-PROFILE in a
+     process started from the core this Lisp was started from. The objects
+     on the pages listed in it are placed together at the start of
+     dynamic space, so that the saved core touches fewer pages when
+     running the same workload. A profile from a different core is ignored
+     with a warning.
 
   :APPLICATION-TYPE
      Present only on Windows and is meaningful only with :EXECUTABLE T.
@@ -197,12 +252,28 @@ sufficiently motivated to do lengthy fixes."
   ;; If the toplevel function is not defined, this will signal an
   ;; error before saving, not at startup time.
   (let ((toplevel (%coerce-callable-to-fun toplevel))
+        (compression-level 0)
         *streams-closed-by-slad*)
     #+sb-core-compression
-    (check-type compression (or boolean (integer -1 9)))
+    (check-type compression (or boolean (integer -1 9)
+                                (member :zlib #+sb-zstd :zstd)
+                                (cons (eql :zlib) (cons (integer -1 9) null))
+                                #+sb-zstd
+                                (cons (eql :zstd) (cons (integer -7 22) null))))
     #-sb-core-compression
     (when compression
       (error "Unable to save compressed core: this runtime was not built with zlib support"))
+    #+gencgc
+    (when base-core
+      (when compression
+        (error "Unable to save a compressed core against a base core"))
+      (let ((truename (truename base-core)))
+        (when (equal (probe-file core-file-name) truename)
+          (error "Unable to save a core over its own base core ~S" truename))
+        (setq base-core (native-namestring truename :as-file t))))
+    #+gencgc
+    (when access-profile
+      (setq access-profile (native-namestring (truename access-profile) :as-file t)))
     (when *dribble-stream*
       (restart-case (error "Dribbling to ~s is enabled." (pathname *dribble-stream*))
         (continue ()
@@ -211,8 +282,17 @@ sufficiently motivated to do lengthy fixes."
         (abort ()
           :report "Abort saving the core."
           (return-from save-lisp-and-die))))
-    (when (eql t compression)
-      (setf compression -1))
+    ;; Translate COMPRESSION into the runtime's codec number and level.
+    ;; A zstd level of 0 selects the library's default.
+    (multiple-value-bind (codec level)
+        (typecase compression
+          (null (values 0 0))
+          ((eql :zstd) (values 2 0))
+          (symbol (values 1 -1))
+          (integer (values 1 compression))
+          (t (values (if (eq (car compression) :zstd) 2 1) (second compression))))
+      (setq compression codec
+            compression-level level))
     (flet ((foreign-bool (value)
              (if value 1 0)))
       (let ((name (native-namestring (physicalize-pathname core-file-name)
@@ -228,7 +308,9 @@ sufficiently motivated to do lengthy fixes."
           ;; Scan roots as close as possible to GC-AND-SAVE, in case anything
           ;; prior causes compilation to occur into immobile space.
           ;; Failing to see all immobile code would miss some relocs.
-          #+immobile-code (sb-vm::choose-code-component-order root-structures)
+          ;; Code in the base core of a delta must stay where it is.
+          #+immobile-code (unless base-core
+                            (sb-vm::choose-code-component-order root-structures))
           ;; Must clear this cache if asm routines are movable.
           (setq sb-disassem::*assembler-routines-by-addr* nil
                 ;; and save some space by deleting the instruction decoding table
@@ -239,6 +321,17 @@ sufficiently motivated to do lengthy fixes."
           ;; as it would require pinning around the whole save operation.
           (with-pinned-objects (startfun)
             (setf lisp-init-function (get-lisp-obj-address startfun)))
+          (setf (extern-alien "gc_readonly_constants" char)
+                (foreign-bool read-only-constants))
+          ;; The name must not move, so it's copied out of the heap.
+          (setf (extern-alien "delta_base_core" system-area-pointer)
+                (if base-core
+                    (alien-sap (make-alien-string base-core))
+                    (int-sap 0)))
+          (setf (extern-alien "gc_access_profile" system-area-pointer)
+                (if access-profile
+                    (alien-sap (make-alien-string access-profile))
+                    (int-sap 0)))
           ;; Do a destructive non-conservative GC, and then save a core.
           ;; A normal GC will leave huge amounts of storage unreclaimed
           ;; (over 50% on x86). This needs to be done by a single function
@@ -246,8 +339,8 @@ sufficiently motivated to do lengthy fixes."
           (gc-and-save name
                        (foreign-bool executable)
                        (foreign-bool save-runtime-options)
-                       (foreign-bool compression)
-                       (or compression 0)
+                       compression
+                       compression-level
                        #+win32 (ecase application-type (:console 0) (:gui 1))
                        #-win32 0)
           (setf lisp-init-function 0)) ; only reach here on save error
@@ -263,8 +356,8 @@ sufficiently motivated to do lengthy fixes."
                   (get-lisp-obj-address startfun)
                   (foreign-bool executable)
                   (foreign-bool save-runtime-options)
-                  (foreign-bool compression)
-                  (or compression 0)
+                  compression
+                  compression-level
                   #+win32 (ecase application-type (:console 0) (:gui 1))
                   #-win32 0)))))
 
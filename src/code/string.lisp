@@ -620,10 +620,15 @@ new string COUNT long filled with the fill character."
   ;; "Always" means that regardless of whether the user want
   ;; coalescing of strings used as literals in code compiled to memory,
   ;; the string is shareable.
-  (logior-header-bits (the (simple-array * 1) vector)
-                   (if always-shareable
-                       sb-vm:+vector-shareable+
-                       sb-vm:+vector-shareable-nonstd+)))
+  (let ((bits (if always-shareable
+                  sb-vm:+vector-shareable+
+                  sb-vm:+vector-shareable-nonstd+)))
+    ;; Don't store into the header of a vector that is already so marked:
+    ;; it may be on a page of constants that the core mapped read-only.
+    (if (logtest (get-header-data (the (simple-array * 1) vector))
+                 (logior sb-vm:+vector-shareable+ bits))
+        vector
+        (logior-header-bits vector bits))))
 
 (clear-info :function :inlining-data 'nstring-upcase)
 (clear-info :function :inlinep 'nstring-upcase)
@@ -2170,6 +2170,27 @@ subject to change."
                       (+ (ash sb-vm::thread-os-kernel-tid-slot sb-vm:word-shift)
                          #+(and 64-bit big-endian) 4))))))
 
+#+gencgc
+(defun thread-allocation-statistics (thread)
+  "Return two values: the number of times THREAD allocated memory without
+finding room in its current allocation region, and the size in bytes that
+it aims for when it claims a new region. The size is revised at each garbage
+collection according to how much THREAD allocated since the previous one,
+so that threads which allocate heavily take the slow path less often.
+Return NIL if THREAD is not alive.
+
+Experimental: interface subject to change."
+  (flet ((stats (sap)
+           (values (sap-ref-word sap (ash sb-vm::thread-slow-path-allocs-slot
+                                          sb-vm:word-shift))
+                   (sap-ref-word sap (ash sb-vm::thread-alloc-region-goal-slot
+                                          sb-vm:word-shift)))))
+    (if (eq *current-thread* thread)
+        (stats (current-thread-sap))
+        (with-deathlok (thread c-thread)
+          (unless (= c-thread 0)
+            (stats (int-sap c-thread)))))))
+
 (defun interrupt-thread (thread function)
   (declare (ignorable thread))
   "Interrupt THREAD and make it run FUNCTION.
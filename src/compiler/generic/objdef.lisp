@@ -547,6 +547,12 @@ during backtrace.
   (state-word :c-type "struct thread_state_word")
   ;; Statistical CPU profiler data recording buffer
   (sprof-data)
+  ;; Number of allocations which missed the thread's allocation region, and
+  ;; the region size that the allocator aims for, which GC adjusts according to
+  ;; ALLOC-EPOCH-BYTES, the size of the regions claimed since the previous GC.
+  #+gencgc (slow-path-allocs)
+  #+gencgc (alloc-region-goal)
+  #+gencgc (alloc-epoch-bytes)
 
   #+x86 (tls-cookie)                          ;  LDT index
   #+sb-thread (tls-size)
@@ -37,7 +37,7 @@
 (define-source-transform %make-symbol (kind string)
   (declare (ignore kind))
   ;; Set "logically read-only" bit in pname.
-  `(sb-vm::%%make-symbol (logior-header-bits ,string ,sb-vm:+vector-shareable+)))
+  `(sb-vm::%%make-symbol (logically-readonlyize ,string)))
 
 ;;; We don't want to clutter the bignum code.
 #+(or x86 x86-64)
@@ -18,6 +18,7 @@
 #include "thread.h"
 #include "getallocptr.h"
 #include "genesis/code.h"
+#include "lispregs.h"
 
 lispobj* atomic_bump_static_space_free_ptr(int nbytes)
 {
@@ -37,7 +38,7 @@ lispobj* atomic_bump_static_space_free_ptr(int nbytes)
 // Work space for the deterministic allocation profiler.
 // Only supported on x86-64, but the variables are always referenced
 // to reduce preprocessor conditionalization.
-os_vm_address_t alloc_profile_buffer; // array of counters
+os_vm_address_t alloc_profile_buffer; // array of counters, summed over threads
 static size_t profile_buffer_size;
 lispobj alloc_profile_data;           // SIMPLE-VECTOR of <code-component,PC>
 boolean alloc_profiling;              // enabled flag
@@ -95,6 +96,8 @@ void close_code_region() {
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "genesis/vector.h"
 
 // Counters 0 and 1 are reserve for variable-size allocations
@@ -105,6 +108,73 @@ void close_code_region() {
 unsigned int alloc_profile_n_counters = 3;
 unsigned int max_alloc_point_counters;
 
+/* Each thread counts into a buffer of its own, so that threads allocating
+ * at the same site don't contend for the cache line holding the counter.
+ * The counts of exited threads and of buffers taken away from running
+ * threads are added into 'retired_counts'. alloc_profile_buffer holds the
+ * totals as of the last allocation_profiler_collect().
+ * All of these, and 'profile_data' of every thread, are protected by
+ * alloc_profiler_lock. */
+static uword_t* retired_counts;
+/* A buffer can't be freed as soon as it is taken away from its thread,
+ * which may have loaded the pointer just before. See reclaim_alloc_profile_buffers().
+ * Buffers waiting to be freed are linked through a header just past the
+ * last counter, which no allocation writes to. Reclaiming happens with the
+ * world stopped, so it mustn't call malloc() or free(). */
+struct unclaimed_buffer { struct unclaimed_buffer* next; size_t size; };
+static struct unclaimed_buffer* unclaimed_buffers;
+
+static uword_t* new_profile_buffer()
+{
+    return (uword_t*)os_allocate(profile_buffer_size + sizeof (struct unclaimed_buffer));
+}
+static void free_profile_buffer(uword_t* counts, size_t size)
+{
+    os_deallocate((void*)counts, size + sizeof (struct unclaimed_buffer));
+}
+
+static void add_counts(uword_t* to, uword_t* from)
+{
+    unsigned int i;
+    for (i = 0; i < max_alloc_point_counters; ++i) to[i] += from[i];
+}
+
+/* Take away the buffer of 'th', which is not running Lisp code if 'exiting' */
+static void retire_profile_data(struct thread* th, int exiting)
+{
+    uword_t* counts = th->profile_data;
+    if (!counts) return;
+    th->profile_data = 0;
+    add_counts(retired_counts, counts);
+    if (exiting) {
+        free_profile_buffer(counts, profile_buffer_size);
+    } else {
+        struct unclaimed_buffer* item =
+            (void*)((char*)counts + profile_buffer_size);
+        item->size = profile_buffer_size;
+        item->next = unclaimed_buffers;
+        unclaimed_buffers = item;
+    }
+}
+
+void assign_alloc_profile_buffer(struct thread* th)
+{
+    int __attribute__((unused)) ret = thread_mutex_lock(&alloc_profiler_lock);
+    gc_assert(ret == 0);
+    th->profile_data = alloc_profiling ? new_profile_buffer() : 0;
+    ret = thread_mutex_unlock(&alloc_profiler_lock);
+    gc_assert(ret == 0);
+}
+
+void release_alloc_profile_buffer(struct thread* th)
+{
+    int __attribute__((unused)) ret = thread_mutex_lock(&alloc_profiler_lock);
+    gc_assert(ret == 0);
+    retire_profile_data(th, 1);
+    ret = thread_mutex_unlock(&alloc_profiler_lock);
+    gc_assert(ret == 0);
+}
+
 void allocation_profiler_start()
 {
     int __attribute__((unused)) ret = thread_mutex_lock(&alloc_profiler_lock);
@@ -112,29 +182,26 @@ void allocation_profiler_start()
     if (!alloc_profiling && simple_vector_p(alloc_profile_data)) {
         max_alloc_point_counters = vector_len(VECTOR(alloc_profile_data))/2;
         size_t size = N_WORD_BYTES * max_alloc_point_counters;
-        os_vm_address_t old_buffer = 0;
         if (size != profile_buffer_size) {
+            // No thread has a buffer, so only the totals need to be replaced
+            if (profile_buffer_size) {
+                os_deallocate((void*)retired_counts, profile_buffer_size);
+                os_deallocate(alloc_profile_buffer, profile_buffer_size);
+            }
             profile_buffer_size = size;
-            old_buffer = alloc_profile_buffer;
+            retired_counts = (uword_t*)os_allocate(size);
             alloc_profile_buffer = os_allocate(size);
-            printf("using %d cells (0x%"OBJ_FMTX" bytes) for profile buffer @ %p\n",
-                   max_alloc_point_counters, (lispobj)size, alloc_profile_buffer);
+            printf("using %d cells (0x%"OBJ_FMTX" bytes) per thread for profile buffers\n",
+                   max_alloc_point_counters, (lispobj)size);
         }
         alloc_profiling = 1;
         int n = 0;
         struct thread* th;
         for_each_thread(th) {
-            th->profile_data = (uword_t*)alloc_profile_buffer;
+            th->profile_data = new_profile_buffer();
             ++n;
         }
         printf("allocation profiler: %d thread%s\n", n, n>1?"s":"");
-        if (old_buffer) {
-            // Thread-safely switching buffers would entail lazy reclamation
-            // of the old one. Just don't use the interface functions
-            // when any thread might be looking at the old buffer.
-            printf("WARNING: Unsafely changed alloc profile buffer\n");
-            os_deallocate(alloc_profile_buffer, profile_buffer_size);
-        }
     } else {
         fprintf(stderr, alloc_profiling ?
                 "allocation profiler already started\n" :
@@ -144,7 +211,6 @@ void allocation_profiler_start()
     gc_assert(ret == 0);
 }
 
-// This is not exactly threadsafe. Don't try anything fancy.
 void allocation_profiler_stop()
 {
     int __attribute__((unused)) ret = thread_mutex_lock(&alloc_profiler_lock);
@@ -152,20 +218,82 @@ void allocation_profiler_stop()
     if (alloc_profiling) {
         alloc_profiling = 0;
         struct thread* th;
-        for_each_thread(th) {
-            th->profile_data = 0;
-        }
+        for_each_thread(th) retire_profile_data(th, 0);
     } else {
         fprintf(stderr, "allocation profiler not started\n");
     }
     ret = thread_mutex_unlock(&alloc_profiler_lock);
     gc_assert(ret == 0);
-#if 0
-    if (warning_issued) {
-        fprintf(stderr, "allocation profile needed %d counters\n",
-                alloc_profile_n_counters);
-        warning_issued = 0;
+}
+
+/* Store into alloc_profile_buffer the sum of the counts of all threads.
+ * Counts of running threads are read without stopping them. */
+void allocation_profiler_collect()
+{
+    int __attribute__((unused)) ret = thread_mutex_lock(&alloc_profiler_lock);
+    gc_assert(ret == 0);
+    if (profile_buffer_size) {
+        memcpy(alloc_profile_buffer, retired_counts, profile_buffer_size);
+        struct thread* th;
+        for_each_thread(th)
+            if (th->profile_data) add_counts((uword_t*)alloc_profile_buffer, th->profile_data);
     }
+    ret = thread_mutex_unlock(&alloc_profiler_lock);
+    gc_assert(ret == 0);
+}
+
+void allocation_profiler_reset()
+{
+    int __attribute__((unused)) ret = thread_mutex_lock(&alloc_profiler_lock);
+    gc_assert(ret == 0);
+    if (profile_buffer_size) {
+        memset(retired_counts, 0, profile_buffer_size);
+        memset(alloc_profile_buffer, 0, profile_buffer_size);
+        struct thread* th;
+        for_each_thread(th)
+            if (th->profile_data) memset(th->profile_data, 0, profile_buffer_size);
+    }
+    ret = thread_mutex_unlock(&alloc_profiler_lock);
+    gc_assert(ret == 0);
+}
+
+/* Called with the world stopped. An instrumented allocation loads the buffer
+ * pointer into R11 a few instructions before incrementing a counter, so a
+ * thread might write to a buffer taken away from it if it was interrupted
+ * in between. That can't happen if no interrupt context of any thread has
+ * R11 pointing into the buffer. (The innermost Lisp frame of a thread that
+ * is stopped in C, as opposed to by a signal, is in a call, not between
+ * the two instructions.) */
+void reclaim_alloc_profile_buffers()
+{
+#if defined LISP_FEATURE_X86_64 && !defined LISP_FEATURE_SB_SAFEPOINT \
+    && !defined LISP_FEATURE_WIN32
+    if (!unclaimed_buffers) return;
+#ifdef LISP_FEATURE_SB_THREAD
+    // The thread which took the lock may have been stopped while holding it
+    if (pthread_mutex_trylock(&alloc_profiler_lock)) return;
+#endif
+    struct unclaimed_buffer **prev = &unclaimed_buffers, *item;
+    while ((item = *prev) != 0) {
+        uword_t end = (uword_t)item, start = end - item->size;
+        int in_use = 0;
+        struct thread* th;
+        for_each_thread(th) {
+            int i = fixnum_value(read_TLS(FREE_INTERRUPT_CONTEXT_INDEX,th));
+            while (--i >= 0) {
+                uword_t r11 = *os_context_register_addr(nth_interrupt_context(i, th), reg_R11);
+                if (r11 >= start && r11 < end) in_use = 1;
+            }
+        }
+        if (in_use) {
+            prev = &item->next;
+        } else {
+            *prev = item->next;
+            free_profile_buffer((uword_t*)start, item->size);
+        }
+    }
+    int __attribute__((unused)) ret = thread_mutex_unlock(&alloc_profiler_lock);
+    gc_assert(ret == 0);
 #endif
 }
 
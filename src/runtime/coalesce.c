@@ -14,6 +14,9 @@
  */
 
 #include "sbcl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "gc.h"
 #include "gc-internal.h"
 #include "gc-private.h"
@@ -119,6 +122,9 @@ static void coalesce_obj(lispobj* where, struct hopscotch_table* ht)
         else {
             ptr = make_lispobj((void*)ht->keys[index-1],
                                OTHER_POINTER_LOWTAG);
+#ifdef LISP_FEATURE_GENCGC
+            if (native_pointer(ptr) != obj) drop_hot_object(obj);
+#endif
             // Check for no read-only to dynamic-space pointer
             if ((uintptr_t)where >= READ_ONLY_SPACE_START &&
                 (uintptr_t)where < READ_ONLY_SPACE_END &&
@@ -218,3 +224,162 @@ void coalesce_similar_objects()
 #endif
     hopscotch_destroy(&ht);
 }
+
+#ifdef LISP_FEATURE_GENCGC
+/* SAVE-LISP-AND-DIE :READ-ONLY-CONSTANTS moves the constants which contain
+ * no pointers - strings and other specialized vectors marked shareable,
+ * and numbers - onto pages of their own. The loader leaves those pages
+ * write-protected for good, so that they remain shared by all processes
+ * mapping the same core file, however much the rest of the heap is written.
+ * Objects with pointers (code, layouts, simple-vectors) can not be moved
+ * there, because the GC has to write their slots. */
+
+static boolean readonly_constant_p(lispobj* obj)
+{
+    lispobj header = *obj;
+    if (specialized_vector_widetag_p(header_widetag(header)))
+        return (header & (VECTOR_SHAREABLE << N_WIDETAG_BITS)) != 0;
+    return coalescible_number_p(obj);
+}
+
+struct constant_mover {
+    struct hopscotch_table* table; // old address -> new address
+    boolean collect; // if true, just enter the constants into the table
+};
+
+/* Return 1 if the slot at 'where' was changed */
+static int move_constant_ref(lispobj* where, struct constant_mover* mover)
+{
+    lispobj ptr = *where;
+    if (lowtag_of(ptr) != OTHER_POINTER_LOWTAG || find_page_index((void*)ptr) < 0)
+        return 0;
+    lispobj* obj = native_pointer(ptr);
+    if (mover->collect) {
+        if (!hopscotch_containsp(mover->table, (uword_t)obj) && readonly_constant_p(obj))
+            hopscotch_insert(mover->table, (uword_t)obj, 0);
+        return 0;
+    }
+    uword_t new = hopscotch_get(mover->table, (uword_t)obj, 0);
+    if (!new) return 0;
+    *where = make_lispobj((void*)new, OTHER_POINTER_LOWTAG);
+    return 1;
+}
+
+/* cf. coalesce_range(), plus marking address-sensitive hash-tables
+ * as needing rehash if a key was moved */
+static uword_t move_constants_range(lispobj* where, lispobj* limit, uword_t arg)
+{
+    struct constant_mover* mover = (struct constant_mover*)arg;
+    lispobj layout, *next;
+    sword_t nwords, i;
+
+    for ( ; where < limit ; where = next ) {
+        lispobj word = *where;
+        if (is_header(word)) {
+            int widetag = header_widetag(word);
+            nwords = sizetab[widetag](where);
+            next = where + nwords;
+            switch (widetag) {
+            case INSTANCE_WIDETAG: // mixed boxed/unboxed objects
+            case FUNCALLABLE_INSTANCE_WIDETAG:
+                layout = layout_of(where);
+                struct bitmap bitmap = get_layout_bitmap(LAYOUT(layout));
+                for (i=0; i<(nwords-1); ++i)
+                    if (bitmap_logbitp(i, bitmap)) move_constant_ref(where+1+i, mover);
+                continue;
+            case CODE_HEADER_WIDETAG:
+                nwords = code_header_words((struct code*)where);
+                break;
+            case SIMPLE_VECTOR_WIDETAG:
+                if (vector_flagp(word, VectorAddrHashing)) {
+                    struct vector* v = (struct vector*)where;
+                    lispobj* data = v->data;
+                    boolean needs_rehash = 0;
+                    for (i = 0 ; i < vector_len(v) ; ++i)
+                        // Keys are at even indices from 2
+                        if (move_constant_ref(data+i, mover) && i >= 2 && !(i & 1))
+                            needs_rehash = 1;
+                    if (needs_rehash)
+                        KV_PAIRS_REHASH(data) |= make_fixnum(1);
+                    continue;
+                }
+                break;
+            default:
+                if (leaf_obj_widetag_p(widetag))
+                    continue; // Ignore this object.
+            }
+            for(i=1; i<nwords; ++i)
+                move_constant_ref(where+i, mover);
+        } else {
+            move_constant_ref(where+0, mover);
+            move_constant_ref(where+1, mover);
+            next = where + 2;
+        }
+    }
+    return 0;
+}
+
+static void visit_constant_refs(struct constant_mover* mover)
+{
+    uword_t arg = (uword_t)mover;
+    move_constants_range((lispobj*)STATIC_SPACE_OBJECTS_START, static_space_free_pointer, arg);
+#ifdef LISP_FEATURE_IMMOBILE_SPACE
+    move_constants_range((lispobj*)FIXEDOBJ_SPACE_START, fixedobj_free_pointer, arg);
+    move_constants_range((lispobj*)VARYOBJ_SPACE_START, varyobj_free_pointer, arg);
+#endif
+    walk_generation(move_constants_range, -1, arg);
+}
+
+static int compare_addresses(const void* a, const void* b)
+{
+    uword_t x = *(uword_t*)a, y = *(uword_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Called by gc_and_save() before the final GC, which frees the old copies */
+void move_readonly_constants(boolean verbose)
+{
+    extern char* gc_claim_readonly_pages(sword_t);
+    extern void deposit_filler(uword_t, sword_t);
+    struct hopscotch_table ht;
+    struct constant_mover mover = { &ht, 1 };
+
+    hopscotch_create(&ht, HOPSCOTCH_HASH_FUN_DEFAULT, N_WORD_BYTES, 1<<17, 0);
+    visit_constant_refs(&mover);
+    // Preserve the constants' relative order, for locality
+    uword_t* objects = successful_malloc((1 + ht.count) * sizeof (uword_t));
+    sword_t n_objects = 0, nbytes = 0, i;
+    int index;
+    uword_t key;
+    for_each_hopscotch_key(index, key, ht) {
+        objects[n_objects++] = key;
+        nbytes += sizetab[widetag_of((lispobj*)key)]((lispobj*)key) << WORD_SHIFT;
+    }
+    qsort(objects, n_objects, sizeof (uword_t), compare_addresses);
+
+    char* dest = n_objects ? gc_claim_readonly_pages(nbytes) : 0;
+    if (dest) {
+        char* start = dest;
+        for (i = 0; i < n_objects; ++i) {
+            lispobj* obj = (lispobj*)objects[i];
+            sword_t size = sizetab[widetag_of(obj)](obj) << WORD_SHIFT;
+            memcpy(dest, obj, size);
+            hopscotch_put(&ht, (uword_t)obj, (sword_t)dest);
+            drop_hot_object(obj);
+            dest += size;
+        }
+        // Fill the last page, so that nothing else is allocated on it
+        sword_t tail = ALIGN_UP(nbytes, GENCGC_CARD_BYTES) - nbytes;
+        if (tail) deposit_filler((uword_t)dest, tail);
+        mover.collect = 0;
+        visit_constant_refs(&mover);
+        if (verbose)
+            printf("[moved %ld constants (%ld bytes) to read-only pages at %p]\n",
+                   (long)n_objects, (long)nbytes, start);
+    } else if (n_objects)
+        fprintf(stderr, "WARNING: no room to move %ld bytes of read-only constants\n",
+                (long)nbytes);
+    free(objects);
+    hopscotch_destroy(&ht);
+}
+#endif
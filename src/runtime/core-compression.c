@@ -0,0 +1,398 @@
+/*
+ * Compression of the spaces in a saved core
+ */
+
+/*
+ * This software is part of the SBCL system. See the README file for
+ * more information.
+ *
+ * This software is derived from the CMU CL system, which was
+ * written at Carnegie Mellon University and released into the
+ * public domain. The software is in the public domain and is
+ * provided with absolutely no warranty. See the COPYING and CREDITS
+ * files for more information.
+ */
+
+/* A compressed space is stored as a header of core_entry_elt_t words:
+ * the codec, the chunk size, the number of chunks, then the compressed size
+ * of each chunk; and then the compressed chunks, in order.
+ * Every chunk is compressed independently, so both saving and loading
+ * divide the chunks among as many threads as there are processors.
+ * To bound the memory needed for saving, the compressed chunks are written
+ * out a batch at a time, and the header is filled in at the end. */
+
+#include "sbcl.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "runtime.h"
+#include "interr.h"
+#include "save.h"
+#include "core-compression.h"
+#include "lazy-core.h"
+
+#ifdef LISP_FEATURE_SB_CORE_COMPRESSION
+# include <zlib.h>
+#endif
+#ifdef LISP_FEATURE_SB_ZSTD
+# include <zstd.h>
+#endif
+
+/* Set by the --lazy-core-decompression runtime option */
+int lazy_core_decompression;
+
+#ifdef LISP_FEATURE_SB_CORE_COMPRESSION
+
+#define COMPRESSION_BATCH_CHUNKS 64
+#define N_HEADER_WORDS 3
+
+static inline size_t chunk_size(size_t total, sword_t chunk)
+{
+    size_t start = chunk * (size_t)CORE_COMPRESSION_CHUNK_BYTES;
+    return total - start < CORE_COMPRESSION_CHUNK_BYTES
+        ? total - start : CORE_COMPRESSION_CHUNK_BYTES;
+}
+
+static char *codec_name(int compression)
+{
+    return compression == CORE_COMPRESSION_ZSTD ? "zstd" : "zlib";
+}
+
+struct compression_job {
+    int compression, level;
+    char *addr;
+    size_t bytes;
+    sword_t batch_start;
+    unsigned char *output[COMPRESSION_BATCH_CHUNKS];
+    size_t output_bytes[COMPRESSION_BATCH_CHUNKS];
+};
+
+static void compress_chunk(sword_t chunk, void *arg)
+{
+    struct compression_job *job = arg;
+    char *input = job->addr + chunk * (size_t)CORE_COMPRESSION_CHUNK_BYTES;
+    size_t input_bytes = chunk_size(job->bytes, chunk);
+    int k = chunk - job->batch_start;
+    if (job->compression == CORE_COMPRESSION_ZLIB) {
+        uLongf len = compressBound(input_bytes);
+        job->output[k] = successful_malloc(len);
+        int ret = compress2(job->output[k], &len, (void*)input, input_bytes, job->level);
+        if (ret != Z_OK)
+            lose("zlib compress2 error: %i... exiting", ret);
+        job->output_bytes[k] = len;
+    } else {
+#ifdef LISP_FEATURE_SB_ZSTD
+        size_t len = ZSTD_compressBound(input_bytes);
+        job->output[k] = successful_malloc(len);
+        len = ZSTD_compress(job->output[k], len, input, input_bytes, job->level);
+        if (ZSTD_isError(len))
+            lose("zstd compress error: %s... exiting", ZSTD_getErrorName(len));
+        job->output_bytes[k] = len;
+#endif
+    }
+}
+
+static void write_or_lose(FILE *file, void *data, size_t bytes)
+{
+    if (fwrite(data, 1, bytes, file) != bytes) {
+        perror("error writing to core file");
+        lose("core file is incomplete or corrupt");
+    }
+}
+
+void compress_core_bytes(FILE *file, char *addr, size_t bytes,
+                         int compression, int level)
+{
+#ifndef LISP_FEATURE_SB_ZSTD
+    if (compression == CORE_COMPRESSION_ZSTD)
+        lose("zstd-compressed core support not built in this runtime");
+#endif
+    if (compression == CORE_COMPRESSION_ZLIB && !(level >= -1 && level <= 9))
+        lose("Unknown core compression level %i, exiting", level);
+
+    sword_t n_chunks = (bytes + CORE_COMPRESSION_CHUNK_BYTES - 1)
+                       / CORE_COMPRESSION_CHUNK_BYTES;
+    sword_t n_words = N_HEADER_WORDS + n_chunks, chunk;
+    core_entry_elt_t *header = calloc(n_words, sizeof (core_entry_elt_t));
+    if (!header)
+        lose("can't allocate core compression header");
+    header[0] = compression;
+    header[1] = CORE_COMPRESSION_CHUNK_BYTES;
+    header[2] = n_chunks;
+    ftell_type header_pos = FTELL(file);
+    write_or_lose(file, header, n_words * sizeof (core_entry_elt_t));
+
+    struct compression_job job;
+    job.compression = compression;
+    job.level = level;
+    job.addr = addr;
+    job.bytes = bytes;
+    size_t total_written = n_words * sizeof (core_entry_elt_t);
+    for (job.batch_start = 0; job.batch_start < n_chunks;
+         job.batch_start += COMPRESSION_BATCH_CHUNKS) {
+        sword_t batch_end = job.batch_start + COMPRESSION_BATCH_CHUNKS;
+        if (batch_end > n_chunks) batch_end = n_chunks;
+        for_each_chunk(job.batch_start, batch_end, compress_chunk, &job);
+        for (chunk = job.batch_start; chunk < batch_end; ++chunk) {
+            int k = chunk - job.batch_start;
+            write_or_lose(file, job.output[k], job.output_bytes[k]);
+            header[N_HEADER_WORDS + chunk] = job.output_bytes[k];
+            total_written += job.output_bytes[k];
+            free(job.output[k]);
+        }
+    }
+    ftell_type end_pos = FTELL(file);
+    FSEEK(file, header_pos, SEEK_SET);
+    write_or_lose(file, header, n_words * sizeof (core_entry_elt_t));
+    FSEEK(file, end_pos, SEEK_SET);
+    free(header);
+    printf("compressed %lu bytes into %lu with %s at level %i\n",
+           (unsigned long)bytes, (unsigned long)total_written,
+           codec_name(compression), level);
+}
+
+static void read_or_lose(int fd, void *buf, size_t bytes, os_vm_offset_t offset)
+{
+    char *where = buf;
+    while (bytes) {
+#ifndef LISP_FEATURE_WIN32
+        ssize_t count = pread(fd, where, bytes, offset);
+#else
+        ssize_t count = -1;
+        if (lseek(fd, offset, SEEK_SET) == offset)
+            count = read(fd, where, bytes);
+#endif
+        if (count <= 0)
+            lose("unable to read core file (errno = %i)", errno);
+        where += count;
+        offset += count;
+        bytes -= count;
+    }
+}
+
+/* A compressed space as described by its header in the core file */
+struct compressed_space {
+    int fd, compression;
+    char *addr;
+    size_t len;
+    sword_t n_chunks;
+    core_entry_elt_t *compressed_bytes;
+    os_vm_offset_t *offsets;
+};
+
+static void read_compressed_space(int fd, os_vm_offset_t offset, char *addr, size_t len,
+                                  struct compressed_space *space)
+{
+    core_entry_elt_t header[N_HEADER_WORDS];
+    read_or_lose(fd, header, sizeof header, offset);
+    int compression = header[0];
+    sword_t n_chunks = header[2], chunk;
+    if (compression != CORE_COMPRESSION_ZLIB
+#ifdef LISP_FEATURE_SB_ZSTD
+        && compression != CORE_COMPRESSION_ZSTD
+#endif
+        )
+        lose("This runtime can not decompress a core with codec %d... aborting",
+             compression);
+    if (header[1] != CORE_COMPRESSION_CHUNK_BYTES
+        || n_chunks != (sword_t)((len + CORE_COMPRESSION_CHUNK_BYTES - 1)
+                                 / CORE_COMPRESSION_CHUNK_BYTES))
+        lose("Compressed core space has %ld chunks of %ld bytes, expected %lu bytes",
+             (long)n_chunks, (long)header[1], (unsigned long)len);
+
+    space->fd = fd;
+    space->compression = compression;
+    space->addr = addr;
+    space->len = len;
+    space->n_chunks = n_chunks;
+    space->compressed_bytes = successful_malloc(n_chunks * sizeof (core_entry_elt_t));
+    space->offsets = successful_malloc(n_chunks * sizeof (os_vm_offset_t));
+    read_or_lose(fd, space->compressed_bytes, n_chunks * sizeof (core_entry_elt_t),
+                 offset + sizeof header);
+    os_vm_offset_t where = offset + (N_HEADER_WORDS + n_chunks) * sizeof (core_entry_elt_t);
+    for (chunk = 0; chunk < n_chunks; ++chunk) {
+        space->offsets[chunk] = where;
+        where += space->compressed_bytes[chunk];
+    }
+}
+
+/* Memory set aside for decompressing one chunk at a time without malloc(),
+ * for the fault handler. See fill_from_compressed_space() */
+struct decompressor {
+    unsigned char *input;
+    z_stream zlib;
+    char *arena;              // where 'zlib' allocates its state and window
+    size_t arena_used;
+#ifdef LISP_FEATURE_SB_ZSTD
+    ZSTD_DCtx *zstd;
+#endif
+};
+#define DECOMPRESSOR_ARENA_BYTES (64*1024)
+
+/* Decompress 'chunk' of 'space' into 'output', with the memory of
+ * 'decompressor' if supplied */
+static void inflate_chunk(struct compressed_space *space, sword_t chunk, char *output,
+                          struct decompressor *decompressor)
+{
+    size_t input_bytes = space->compressed_bytes[chunk];
+    unsigned char *input = decompressor ? decompressor->input : successful_malloc(input_bytes);
+    size_t output_bytes = chunk_size(space->len, chunk);
+    read_or_lose(space->fd, input, input_bytes, space->offsets[chunk]);
+    if (space->compression == CORE_COMPRESSION_ZLIB) {
+        if (decompressor) {
+            z_stream *stream = &decompressor->zlib;
+            int ret = inflateReset(stream);
+            stream->next_in = input;
+            stream->avail_in = input_bytes;
+            stream->next_out = (void*)output;
+            stream->avail_out = output_bytes;
+            if (ret == Z_OK) ret = inflate(stream, Z_FINISH);
+            if (ret != Z_STREAM_END || stream->total_out != output_bytes)
+                lose("zlib inflate error: %i", ret);
+        } else {
+            uLongf len = output_bytes;
+            int ret = uncompress((void*)output, &len, input, input_bytes);
+            if (ret != Z_OK || len != output_bytes)
+                lose("zlib uncompress error: %i", ret);
+        }
+    } else {
+#ifdef LISP_FEATURE_SB_ZSTD
+        size_t len = decompressor
+            ? ZSTD_decompressDCtx(decompressor->zstd, output, output_bytes, input, input_bytes)
+            : ZSTD_decompress(output, output_bytes, input, input_bytes);
+        if (ZSTD_isError(len))
+            lose("zstd decompress error: %s", ZSTD_getErrorName(len));
+        if (len != output_bytes)
+            lose("zstd decompressed %lu bytes, expected %lu",
+                 (unsigned long)len, (unsigned long)output_bytes);
+#endif
+    }
+    if (!decompressor) free(input);
+}
+
+static void decompress_chunk(sword_t chunk, void *arg)
+{
+    struct compressed_space *space = arg;
+    inflate_chunk(space, chunk, space->addr + chunk * (size_t)CORE_COMPRESSION_CHUNK_BYTES, 0);
+}
+
+#ifdef LAZY_CORE_PAGES
+/* With --lazy-core-decompression, each chunk of dynamic space is
+ * decompressed on first access (see lazy-core.c). That happens in the fault
+ * handler, which may have interrupted malloc(), so each slot has its own
+ * input buffer and codec state, set up in advance: zlib allocates from an
+ * arena of the slot (which also has room for the window, though inflating
+ * a whole chunk with Z_FINISH doesn't need one), and a zstd context
+ * decompressing a whole frame into a flat buffer uses only memory it
+ * already has. */
+static struct compressed_space lazy_space;
+static struct decompressor *lazy_decompressors;
+
+static voidpf arena_alloc(voidpf opaque, uInt items, uInt size)
+{
+    struct decompressor *decompressor = opaque;
+    size_t bytes = ALIGN_UP((size_t)items * size, 2*N_WORD_BYTES);
+    if (decompressor->arena_used + bytes > DECOMPRESSOR_ARENA_BYTES)
+        return Z_NULL;
+    voidpf result = decompressor->arena + decompressor->arena_used;
+    decompressor->arena_used += bytes;
+    return result;
+}
+
+static void arena_free(voidpf __attribute__((unused)) opaque,
+                       voidpf __attribute__((unused)) address)
+{
+}
+
+static void make_lazy_decompressors(int n_slots)
+{
+    size_t input_bytes = 0;
+    sword_t chunk;
+    int slot;
+    for (chunk = 0; chunk < lazy_space.n_chunks; ++chunk)
+        if (lazy_space.compressed_bytes[chunk] > input_bytes)
+            input_bytes = lazy_space.compressed_bytes[chunk];
+    lazy_decompressors = successful_malloc(n_slots * sizeof (struct decompressor));
+    memset(lazy_decompressors, 0, n_slots * sizeof (struct decompressor));
+    for (slot = 0; slot < n_slots; ++slot) {
+        struct decompressor *decompressor = &lazy_decompressors[slot];
+        decompressor->input = (void*)os_allocate(input_bytes);
+        if (lazy_space.compression == CORE_COMPRESSION_ZLIB) {
+            decompressor->arena = (void*)os_allocate(DECOMPRESSOR_ARENA_BYTES);
+            decompressor->zlib.zalloc = arena_alloc;
+            decompressor->zlib.zfree = arena_free;
+            decompressor->zlib.opaque = decompressor;
+            int ret = inflateInit(&decompressor->zlib);
+            if (ret != Z_OK)
+                lose("zlib inflateInit error: %i", ret);
+        }
+#ifdef LISP_FEATURE_SB_ZSTD
+        else {
+            decompressor->zstd = ZSTD_createDCtx();
+            if (!decompressor->zstd)
+                lose("can't create zstd decompression context");
+        }
+#endif
+    }
+}
+
+static int fill_from_compressed_space(sword_t chunk, char *copy, int slot)
+{
+    inflate_chunk(&lazy_space, chunk, copy, &lazy_decompressors[slot]);
+    return 1;
+}
+#endif
+
+void decompress_core_bytes(int fd, os_vm_offset_t offset, char *addr, size_t len,
+                           int __attribute__((unused)) lazy)
+{
+    struct compressed_space space;
+    read_compressed_space(fd, offset, addr, len, &space);
+
+# ifdef LISP_FEATURE_WIN32
+    /* Ensure the memory is committed so the decompressor doesn't segfault
+       trying to write it. */
+    os_commit_memory((os_vm_address_t)addr, len);
+# endif
+
+#ifdef LAZY_CORE_PAGES
+    if (lazy && lazy_core_decompression && !lazy_core_space_p()
+        && !((uword_t)addr & (os_vm_page_size - 1))) {
+        lazy_space = space;
+        lazy_space.fd = dup(fd); // the loader closes its descriptor
+        if (lazy_space.fd < 0)
+            lose("can't keep core file open (errno = %i)", errno);
+        int n_slots = chunk_thread_count();
+        make_lazy_decompressors(n_slots);
+        make_core_space_lazy(addr, len, CORE_COMPRESSION_CHUNK_BYTES,
+                             fill_from_compressed_space, n_slots, 0);
+        return;
+    }
+#endif
+    for_each_chunk(0, space.n_chunks, decompress_chunk, &space);
+    free(space.compressed_bytes);
+    free(space.offsets);
+}
+
+#else
+
+void compress_core_bytes(FILE __attribute__((unused)) *file,
+                         char __attribute__((unused)) *addr,
+                         size_t __attribute__((unused)) bytes,
+                         int __attribute__((unused)) compression,
+                         int __attribute__((unused)) level)
+{
+    lose("zlib-compressed core support not built in this runtime");
+}
+
+void decompress_core_bytes(int __attribute__((unused)) fd,
+                           os_vm_offset_t __attribute__((unused)) offset,
+                           char __attribute__((unused)) *addr,
+                           size_t __attribute__((unused)) len,
+                           int __attribute__((unused)) lazy)
+{
+    lose("This runtime was not built with zlib-compressed core support... aborting");
+}
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * This software is part of the SBCL system. See the README file for
+ * more information.
+ *
+ * This software is derived from the CMU CL system, which was
+ * written at Carnegie Mellon University and released into the
+ * public domain. The software is in the public domain and is
+ * provided with absolutely no warranty. See the COPYING and CREDITS
+ * files for more information.
+ */
+
+#ifndef _CORE_COMPRESSION_H_
+#define _CORE_COMPRESSION_H_
+
+#include <stdio.h>
+#include "os.h"
+
+/* Codecs for the 'compression' argument of save() and gc_and_save(),
+ * which SAVE-LISP-AND-DIE computes from its :COMPRESSION argument */
+#define CORE_COMPRESSION_NONE 0
+#define CORE_COMPRESSION_ZLIB 1
+#define CORE_COMPRESSION_ZSTD 2
+
+/* Each compressed space is split into chunks of this many bytes (the last
+ * one possibly shorter) which are compressed independently */
+#define CORE_COMPRESSION_CHUNK_BYTES (1024*1024)
+
+extern void compress_core_bytes(FILE *file, char *addr, size_t bytes,
+                                int compression, int level);
+/* If 'lazy' and --lazy-core-decompression was given, the space may be left
+ * to be decompressed a chunk at a time on first access */
+extern void decompress_core_bytes(int fd, os_vm_offset_t offset,
+                                  char *addr, size_t len, int lazy);
+
+#endif /* _CORE_COMPRESSION_H_ */
@@ -40,9 +40,37 @@ struct memsize_options {
 
 extern lispobj load_core_file(char *file, os_vm_offset_t file_offset,
                               int merge_core_pages);
+/* Set by the runtime options which defer work on the core's pages until
+ * they are first touched */
+extern int lazy_core_decompression, lazy_core_relocation;
+/* Set by --show-startup-times */
+extern int show_startup_times;
+/* Return the table of words to fix up in [start,end) if the heap is
+ * relocated when loading the core, and store its size in 'nbytes' */
+extern uword_t *make_relocation_table(lispobj *start, lispobj *end, size_t *nbytes);
 extern os_vm_offset_t search_for_embedded_core(char *filename,
                                                struct memsize_options *memsize_options);
 
+/* The core that a delta core was saved against. Each space of a delta core
+ * holds only the pages which differ from those of the same space of the
+ * base core, and the loader maps the rest from the base core */
+struct base_core {
+    int fd;
+    uword_t size, checksum; // of the whole file, and of its header page
+    struct {
+        os_vm_offset_t offset; // of the space's data in the file
+        uword_t page_count;
+    } spaces[MAX_CORE_SPACE_ID+1];
+};
+/* Fill in 'base' from the core in 'filename', which must be uncompressed and
+ * not itself a delta core. Return 0, or a message saying what's wrong */
+extern char *open_base_core(char *filename, struct base_core *base);
+/* The core to save a delta against, or 0 to save the whole heap */
+extern char *delta_base_core;
+/* Set by --base-core, to load a delta core against a base core other than
+ * the one named in the delta */
+extern char *base_core_filename;
+
 /* arbitrary string identifying this build, embedded in .core files to
  * prevent people mismatching a runtime built e.g. with :SB-SHOW
  * against a .core built without :SB-SHOW (or against various grosser
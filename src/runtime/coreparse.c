@@ -27,6 +27,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "os.h"
@@ -45,9 +46,8 @@
 
 #include <errno.h>
 
-#ifdef LISP_FEATURE_SB_CORE_COMPRESSION
-# include <zlib.h>
-#endif
+#include "core-compression.h"
+#include "lazy-core.h"
 
 /* build_id must match between the C code and .core file because a core
  * is only guaranteed to be compatible with the C runtime that created it.
@@ -73,6 +73,49 @@ unsigned char build_id[] =
 #endif
 ;
 
+/* With --show-startup-times, loading the core reports how long each of its
+ * phases took, unless --noinform */
+int show_startup_times;
+#define MAX_STARTUP_PHASES 6
+static struct { const char* name; uint64_t ns; } startup_phases[MAX_STARTUP_PHASES];
+static int n_startup_phases;
+static uint64_t startup_phase_start;
+
+static uint64_t startup_clock_ns()
+{
+#ifdef LISP_FEATURE_UNIX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+/* End the phase of loading which began where the previous one ended */
+static void end_startup_phase(const char* name)
+{
+    uint64_t now = startup_clock_ns();
+    if (n_startup_phases < MAX_STARTUP_PHASES) {
+        startup_phases[n_startup_phases].name = name;
+        startup_phases[n_startup_phases].ns = now - startup_phase_start;
+        ++n_startup_phases;
+    }
+    startup_phase_start = now;
+}
+
+static void report_startup_phases()
+{
+    if (!show_startup_times || lisp_startup_options.noinform)
+        return;
+    int i, n_threads = chunk_thread_count();
+    fprintf(stderr, "core loaded by %d thread%s:", n_threads, n_threads > 1 ? "s" : "");
+    for (i = 0; i < n_startup_phases; ++i)
+        fprintf(stderr, "%s %s %.3fms", i ? "," : "",
+                startup_phases[i].name, startup_phases[i].ns / 1e6);
+    fprintf(stderr, "\n");
+}
+
 static int
 open_binary(char *filename, int mode)
 {
@@ -168,77 +211,93 @@ lose:
     return core_start;
 }
 
-#ifndef LISP_FEATURE_SB_CORE_COMPRESSION
-# define inflate_core_bytes(fd,offset,addr,len) \
-    lose("This runtime was not built with zlib-compressed core support... aborting")
-#else
-# define ZLIB_BUFFER_SIZE (1u<<16)
-static void inflate_core_bytes(int fd, os_vm_offset_t offset,
-                               os_vm_address_t addr, int len)
+char *base_core_filename;
+
+char *open_base_core(char *filename, struct base_core *base)
 {
-    z_stream stream;
-    unsigned char* buf = successful_malloc(ZLIB_BUFFER_SIZE);
-    int ret;
-
-# ifdef LISP_FEATURE_WIN32
-    /* Ensure the memory is committed so zlib doesn't segfault trying to
-       inflate. */
-    os_commit_memory(addr, len);
-# endif
-
-    if (-1 == lseek(fd, offset, SEEK_SET)) {
-        lose("Unable to lseek() on corefile");
+    memset(base, 0, sizeof *base);
+    os_vm_offset_t file_offset = search_for_embedded_core(filename, 0);
+    if (file_offset < 0)
+        return "not a core file";
+    if ((base->fd = open_binary(filename, O_RDONLY)) < 0)
+        return strerror(errno);
+    char *msg = 0;
+    core_entry_elt_t *header = calloc(os_vm_page_size, 1), *ptr = header, val, len;
+    base->size = lseek(base->fd, 0, SEEK_END);
+    if (lseek(base->fd, file_offset, SEEK_SET) != file_offset
+        || read(base->fd, header, os_vm_page_size) != (ssize_t)os_vm_page_size) {
+        msg = "premature end of core file";
+        goto done;
     }
-
-    stream.zalloc = NULL;
-    stream.zfree = NULL;
-    stream.opaque = NULL;
-    stream.avail_in = 0;
-    stream.next_in = buf;
-
-    ret = inflateInit(&stream);
-    if (ret != Z_OK)
-        lose("zlib error %i", ret);
-
-    stream.next_out  = (void*)addr;
-    stream.avail_out = len;
-    do {
-        ssize_t count = read(fd, buf, ZLIB_BUFFER_SIZE);
-        if (count < 0)
-            lose("unable to read core file (errno = %i)", errno);
-        stream.next_in = buf;
-        stream.avail_in = count;
-        if (count == 0) break;
-        ret = inflate(&stream, Z_NO_FLUSH);
-        switch (ret) {
-        case Z_STREAM_END:
-            break;
-        case Z_OK:
-            if (stream.avail_out == 0)
-                lose("Runaway gzipped core directory... aborting");
-            if (stream.avail_in > 0)
-                lose("zlib inflate returned without fully"
-                     "using up input buffer... aborting");
+    // FNV-1a of the header page, which holds the build ID and the directory
+    unsigned char *byte = (unsigned char*)header;
+    uint32_t hash = 2166136261U;
+    while (byte < (unsigned char*)header + os_vm_page_size)
+        hash = (hash ^ *byte++) * 16777619U;
+    base->checksum = hash;
+    core_entry_elt_t *header_end = header + os_vm_page_size / sizeof *header;
+    for (++ptr ; ; ptr += len - 2) {
+        val = *ptr++;
+        len = *ptr++;
+        if (len < 2 || ptr + len - 2 > header_end) {
+            msg = "has a corrupt header";
+            goto done;
+        }
+        switch (val) {
+        case BUILD_ID_CORE_ENTRY_TYPE_CODE:
+            if (ptr[0]+1 != sizeof build_id || memcmp(ptr+1, build_id, ptr[0])) {
+                msg = "built for a different runtime";
+                goto done;
+            }
             break;
-        default:
-            lose("zlib inflate error: %i", ret);
+        case BASE_CORE_CORE_ENTRY_TYPE_CODE:
+            msg = "is itself a delta core";
+            goto done;
+        case DIRECTORY_CORE_ENTRY_TYPE_CODE: {
+            struct ndir_entry *entry = (struct ndir_entry*)ptr;
+            int count = (len - 2) / NDIR_ENTRY_LENGTH;
+            for ( ; --count >= 0 ; ++entry) {
+                int id = entry->identifier;
+                if (id & DEFLATED_CORE_SPACE_ID_FLAG) {
+                    msg = "is compressed";
+                    goto done;
+                }
+                if (id < 1 || id > MAX_CORE_SPACE_ID) {
+                    msg = "has an unknown space";
+                    goto done;
+                }
+                base->spaces[id].offset =
+                    file_offset + (1 + entry->data_page) * os_vm_page_size;
+                base->spaces[id].page_count = entry->page_count;
+            }
             break;
         }
-    } while (ret != Z_STREAM_END);
-
-    if (stream.avail_out > 0) {
-        if (stream.avail_out >= os_vm_page_size)
-            fprintf(stderr, "Warning: gzipped core directory significantly"
-                    "shorter than expected (%lu bytes)", (unsigned long)stream.avail_out);
-        /* Is this needed? */
-        memset(stream.next_out, 0, stream.avail_out);
+        case END_CORE_ENTRY_TYPE_CODE:
+            goto done;
+        }
     }
-
-    inflateEnd(&stream);
-    free(buf);
+done:
+    free(header);
+    if (msg) {
+        close(base->fd);
+        base->fd = -1;
+    }
+    return msg;
 }
-# undef ZLIB_BUFFER_SIZE
-#endif
+
+/* The words of a space which relocate_space() would fix up, as saved in
+ * the core, so that a relocated heap need not be walked when loading.
+ * 'words' and 'layouts' are bitmaps of the words holding a pointer and of
+ * the words whose upper half holds a compact instance layout. Objects whose
+ * fixups depend on more than the words which change, such as code, are
+ * listed in 'objects' (as word offsets) and relocated one at a time. */
+struct relocation_table {
+    lispobj *start;
+    uword_t n_words, n_objects;
+    uword_t *words, *layouts, *objects;
+};
+#define RELOCATION_TABLE_HEADER_WORDS 2
+#define relocation_bitmap_words(n_words) (((n_words) + N_WORD_BITS - 1) / N_WORD_BITS)
 
 #define DYNAMIC_SPACE_ADJ_INDEX 0
 struct heap_adjust {
@@ -250,6 +309,16 @@ struct heap_adjust {
     int n_ranges;
     int n_relocs_abs; // absolute
     int n_relocs_rel; // relative
+    /* If set, the words to fix up are noted in it rather than changed */
+    struct relocation_table* record;
+    uword_t max_objects;
+    /* The tables saved in the core, by space ID */
+    uword_t* tables[MAX_CORE_SPACE_ID+1];
+    os_vm_offset_t dynamic_space_file_offset; // if not compressed
+    int fd;
+    /* Where the saved page table is, for dividing dynamic space among threads */
+    core_entry_elt_t n_ptes;
+    os_vm_offset_t ptes_offset;
 };
 
 #include "genesis/gc-tables.h"
@@ -289,23 +358,46 @@ static inline lispobj inverse_adjust(struct heap_adjust* adj, lispobj x)
     return x;
 }
 
+static void note_fixup(struct heap_adjust* adj, void* addr)
+{
+    struct relocation_table* table = adj->record;
+    uword_t offset = (char*)addr - (char*)table->start;
+    uword_t index = offset / N_WORD_BYTES;
+    uword_t* bitmap = (offset % N_WORD_BYTES) ? table->layouts : table->words;
+    bitmap[index / N_WORD_BITS] |= (uword_t)1 << (index % N_WORD_BITS);
+}
+
+static void note_object(struct heap_adjust* adj, lispobj* where)
+{
+    struct relocation_table* table = adj->record;
+    if (table->n_objects == adj->max_objects) {
+        adj->max_objects = adj->max_objects ? 2 * adj->max_objects : 1024;
+        table->objects = realloc(table->objects, adj->max_objects * sizeof (uword_t));
+        if (!table->objects)
+            lose("can't allocate relocation table");
+    }
+    table->objects[table->n_objects++] = where - table->start;
+}
+
 #define SHOW_SPACE_RELOCATION 0
 #if SHOW_SPACE_RELOCATION > 1
-# define FIXUP(expr, addr) fprintf(stderr, "%p: (a) %lx", addr, *(long*)(addr)), \
+# define APPLY_FIXUP(expr, addr) fprintf(stderr, "%p: (a) %lx", addr, *(long*)(addr)), \
    expr, fprintf(stderr, " -> %lx\n", *(long*)(addr)), ++adj->n_relocs_abs
 # define FIXUP32(expr, addr) fprintf(stderr, "%p: (a) %x", addr, *(int*)(addr)), \
    expr, fprintf(stderr, " -> %x\n", *(int*)(addr)), ++adj->n_relocs_abs
 # define FIXUP_rel(expr, addr) fprintf(stderr, "%p: (r) %x", addr, *(int*)(addr)), \
    expr, fprintf(stderr, " -> %x\n", *(int*)(addr)), ++adj->n_relocs_rel
 #elif SHOW_SPACE_RELOCATION
-# define FIXUP(expr, addr) expr, ++adj->n_relocs_abs
+# define APPLY_FIXUP(expr, addr) expr, ++adj->n_relocs_abs
 # define FIXUP32(expr, addr) expr, ++adj->n_relocs_abs
 # define FIXUP_rel(expr, addr) expr, ++adj->n_relocs_rel
 #else
-# define FIXUP(expr, addr) expr
+# define APPLY_FIXUP(expr, addr) expr
 # define FIXUP32(expr, addr) expr
 # define FIXUP_rel(expr, addr) expr
 #endif
+#define FIXUP(expr, addr) \
+  (adj->record ? note_fixup(adj, addr) : (void)(APPLY_FIXUP(expr, addr)))
 
 // Fix the word at 'where' without testing whether it looks pointer-like.
 // Avoid writing if there is no adjustment.
@@ -385,13 +477,25 @@ static inline void fix_fun_header_layout(lispobj __attribute__((unused)) *fun,
 #if defined(LISP_FEATURE_COMPACT_INSTANCE_HEADER) && defined(LISP_FEATURE_64_BIT)
     lispobj ptr = funinstance_layout(fun);
     lispobj adjusted = adjust_word(adj, ptr);
-    if (adjusted != ptr) FIXUP(funinstance_layout(fun)=adjusted, fun);
+    if (adjusted != ptr)
+        FIXUP(funinstance_layout(fun)=adjusted, &funinstance_layout(fun));
 #endif
 }
 
-static void relocate_space(uword_t start, lispobj* end, struct heap_adjust* adj)
+// Objects which a relocation table lists rather than their words
+static boolean relocated_individually_p(lispobj* where, int widetag)
+{
+    switch (widetag) {
+    case CODE_HEADER_WIDETAG: return !filler_obj_p(where);
+    case SIMPLE_VECTOR_WIDETAG: return vector_flagp(*where, VectorAddrHashing);
+    case SAP_WIDETAG: return 1;
+    }
+    return 0;
+}
+
+// Adjust the object at 'where', returning its size in words
+static sword_t relocate_object(lispobj* where, struct heap_adjust* adj)
 {
-    lispobj *where = (lispobj*)start;
     int widetag;
     long nwords;
     lispobj layout, adjusted_layout;
@@ -399,168 +503,383 @@ static void relocate_space(uword_t start, lispobj* end, struct heap_adjust* adj)
     sword_t delta;
     int i;
 
-    adj->n_relocs_abs = adj->n_relocs_rel = 0;
-    for ( ; where < end ; where += nwords ) {
-        lispobj word = *where;
-        if (!is_header(word)) {
-            adjust_pointers(where, 2, adj);
-            nwords = 2;
-            continue;
+    lispobj word = *where;
+    if (!is_header(word)) {
+        adjust_pointers(where, 2, adj);
+        return 2;
+    }
+    widetag = header_widetag(word);
+    nwords = sizetab[widetag](where);
+    if (adj->record && relocated_individually_p(where, widetag)) {
+        note_object(adj, where);
+        return nwords;
+    }
+    switch (widetag) {
+    case FUNCALLABLE_INSTANCE_WIDETAG:
+        // Special note on the word at where[1] in funcallable instances:
+        // - If no immobile code, then the word points to read-only space,
+        ///  hence needs no adjustment.
+        // - Otherwise, the word might point to a relocated range,
+        //   either the instance itself, or a trampoline in immobile space.
+        adjust_word_at(where+1, adj);
+        /* FALLTHROUGH */
+    case INSTANCE_WIDETAG:
+        layout = layout_of(where);
+        adjusted_layout = adjust_word(adj, layout);
+        // writeback the layout if it changed. The layout is not a tagged slot
+        // so it would not be fixed up otherwise.
+        if (adjusted_layout != layout)
+            FIXUP(layout_of(where) = adjusted_layout, &layout_of(where));
+        // When recording, the layout is where it was
+        struct bitmap bitmap =
+            get_layout_bitmap(LAYOUT(adj->record ? layout : adjusted_layout));
+        lispobj* slots = where+1;
+        for (i=0; i<(nwords-1); ++i)
+            if (bitmap_logbitp(i, bitmap)) adjust_pointers(slots+i, 1, adj);
+        return nwords;
+    case FDEFN_WIDETAG:
+        adjust_pointers(where+1, 2, adj);
+        // For most architectures, 'raw_addr' doesn't satisfy is_lisp_pointer()
+        // so adjust_pointers() would ignore it. Therefore we need to
+        // forcibly adjust it. This is correct whether or not there are tag bits.
+        adjust_word_at(where+3, adj);
+        return nwords;
+    case CODE_HEADER_WIDETAG:
+        if (filler_obj_p(where)) {
+            if (where[2]) adjust_word_at(where+2, adj);
+            return nwords;
         }
-        widetag = header_widetag(word);
-        nwords = sizetab[widetag](where);
-        switch (widetag) {
-        case FUNCALLABLE_INSTANCE_WIDETAG:
-            // Special note on the word at where[1] in funcallable instances:
-            // - If no immobile code, then the word points to read-only space,
-            ///  hence needs no adjustment.
-            // - Otherwise, the word might point to a relocated range,
-            //   either the instance itself, or a trampoline in immobile space.
-            adjust_word_at(where+1, adj);
-            /* FALLTHROUGH */
-        case INSTANCE_WIDETAG:
-            layout = layout_of(where);
-            adjusted_layout = adjust_word(adj, layout);
-            // writeback the layout if it changed. The layout is not a tagged slot
-            // so it would not be fixed up otherwise.
-            if (adjusted_layout != layout) layout_of(where) = adjusted_layout;
-            struct bitmap bitmap = get_layout_bitmap(LAYOUT(adjusted_layout));
-            lispobj* slots = where+1;
-            for (i=0; i<(nwords-1); ++i)
-                if (bitmap_logbitp(i, bitmap)) adjust_pointers(slots+i, 1, adj);
-            continue;
-        case FDEFN_WIDETAG:
-            adjust_pointers(where+1, 2, adj);
-            // For most architectures, 'raw_addr' doesn't satisfy is_lisp_pointer()
-            // so adjust_pointers() would ignore it. Therefore we need to
-            // forcibly adjust it. This is correct whether or not there are tag bits.
-            adjust_word_at(where+3, adj);
-            continue;
-        case CODE_HEADER_WIDETAG:
-            if (filler_obj_p(where)) {
-                if (where[2]) adjust_word_at(where+2, adj);
-                continue;
-            }
-            // Fixup the constant pool. The word at where+1 is a fixnum.
-            code = (struct code*)where;
-            adjust_pointers(where+2, code_header_words(code)-2, adj);
+        // Fixup the constant pool. The word at where+1 is a fixnum.
+        code = (struct code*)where;
+        adjust_pointers(where+2, code_header_words(code)-2, adj);
 #if defined LISP_FEATURE_X86 || defined LISP_FEATURE_X86_64 || \
     defined LISP_FEATURE_PPC || defined LISP_FEATURE_PPC64
-            // Fixup absolute jump table
-            lispobj* jump_table = code_jumptable_start(code);
-            int count = jumptable_count(jump_table);
-            for (i = 1; i < count; ++i) adjust_word_at(jump_table+i, adj);
+        // Fixup absolute jump table
+        lispobj* jump_table = code_jumptable_start(code);
+        int count = jumptable_count(jump_table);
+        for (i = 1; i < count; ++i) adjust_word_at(jump_table+i, adj);
 #endif
-            // Fixup all embedded simple-funs
-            for_each_simple_fun(i, f, code, 1, {
-                fix_fun_header_layout((lispobj*)f, adj);
+        // Fixup all embedded simple-funs
+        for_each_simple_fun(i, f, code, 1, {
+            fix_fun_header_layout((lispobj*)f, adj);
 #if FUN_SELF_FIXNUM_TAGGED
-                if (f->self != (lispobj)f->insts)
-                    FIXUP(f->self = (lispobj)f->insts, &f->self);
+            if (f->self != (lispobj)f->insts)
+                FIXUP(f->self = (lispobj)f->insts, &f->self);
 #else
-                adjust_pointers(&f->self, 1, adj);
+            adjust_pointers(&f->self, 1, adj);
 #endif
-            });
-            {
-              // Now that the packed integer comprising the list of fixup locations
-              // has been fixed-up (if necessary), apply them to the code.
-              lispobj original_vaddr = inverse_adjust(adj, (lispobj)code);
-              // code->fixups, if a bignum pointer, was fixed up as part of
-              // the constant pool.
-              gencgc_apply_code_fixups((struct code*)original_vaddr, code);
-              adjust_code_refs(adj, code, original_vaddr);
-            }
-            continue;
-        case CLOSURE_WIDETAG:
-            fix_fun_header_layout(where, adj);
+        });
+        {
+          // Now that the packed integer comprising the list of fixup locations
+          // has been fixed-up (if necessary), apply them to the code.
+          lispobj original_vaddr = inverse_adjust(adj, (lispobj)code);
+          // code->fixups, if a bignum pointer, was fixed up as part of
+          // the constant pool.
+          gencgc_apply_code_fixups((struct code*)original_vaddr, code);
+          adjust_code_refs(adj, code, original_vaddr);
+        }
+        return nwords;
+    case CLOSURE_WIDETAG:
+        fix_fun_header_layout(where, adj);
 #if defined(LISP_FEATURE_X86) || defined(LISP_FEATURE_X86_64)
-            // For x86[-64], the closure fun appears to be a fixnum,
-            // and might need adjustment unless pointing to immobile code.
-            // Then fall into the general case; where[1] won't get re-adjusted
-            // because it doesn't satisfy is_lisp_pointer().
-            adjust_word_at(where+1, adj);
+        // For x86[-64], the closure fun appears to be a fixnum,
+        // and might need adjustment unless pointing to immobile code.
+        // Then fall into the general case; where[1] won't get re-adjusted
+        // because it doesn't satisfy is_lisp_pointer().
+        adjust_word_at(where+1, adj);
 #endif
-            break;
-        // Vectors require extra care because of address-based hashing.
-        case SIMPLE_VECTOR_WIDETAG:
-          if (vector_flagp(*where, VectorAddrHashing)) {
-              struct vector* v = (struct vector*)where;
-              // If you could make a hash-table vector with space for exactly 1 k/v pair,
-              // it would have length 5.
-              gc_assert(vector_len(v) >= 5); // KLUDGE: need a manifest constant for fixed overhead
-              lispobj* data = (lispobj*)v->data;
-              adjust_pointers(&data[vector_len(v)-1], 1, adj);
-              int hwm = KV_PAIRS_HIGH_WATER_MARK(data);
-              boolean needs_rehash = 0;
-              lispobj *where = &data[2], *end = &data[2*(hwm+1)];
-              // Adjust the elements, checking for need to rehash.
-              for ( ; where < end ; where += 2) {
-                  // Really we should use the hash values to figure out which
-                  // keys were address-sensitive. This simply overapproximates
-                  // by assuming that any change forces rehash.
-                  // (Similar issue exists in 'fixup_space' in immobile-space.c)
-                  lispobj ptr = *where; // key
-                  if (is_lisp_pointer(ptr) && (delta = calc_adjustment(adj, ptr)) != 0) {
-                      FIXUP(*where = ptr + delta, where);
-                      needs_rehash = 1;
-                  }
-                  ptr = where[1]; // value
-                  if (is_lisp_pointer(ptr) && (delta = calc_adjustment(adj, ptr)) != 0)
-                      FIXUP(where[1] = ptr + delta, where+1);
+        break;
+    // Vectors require extra care because of address-based hashing.
+    case SIMPLE_VECTOR_WIDETAG:
+      if (vector_flagp(*where, VectorAddrHashing)) {
+          struct vector* v = (struct vector*)where;
+          // If you could make a hash-table vector with space for exactly 1 k/v pair,
+          // it would have length 5.
+          gc_assert(vector_len(v) >= 5); // KLUDGE: need a manifest constant for fixed overhead
+          lispobj* data = (lispobj*)v->data;
+          adjust_pointers(&data[vector_len(v)-1], 1, adj);
+          int hwm = KV_PAIRS_HIGH_WATER_MARK(data);
+          boolean needs_rehash = 0;
+          lispobj *where = &data[2], *end = &data[2*(hwm+1)];
+          // Adjust the elements, checking for need to rehash.
+          for ( ; where < end ; where += 2) {
+              // Really we should use the hash values to figure out which
+              // keys were address-sensitive. This simply overapproximates
+              // by assuming that any change forces rehash.
+              // (Similar issue exists in 'fixup_space' in immobile-space.c)
+              lispobj ptr = *where; // key
+              if (is_lisp_pointer(ptr) && (delta = calc_adjustment(adj, ptr)) != 0) {
+                  FIXUP(*where = ptr + delta, where);
+                  needs_rehash = 1;
               }
-              if (needs_rehash) // set v->data[1], the need-to-rehash bit
-                  KV_PAIRS_REHASH(data) |= make_fixnum(1);
-              continue;
+              ptr = where[1]; // value
+              if (is_lisp_pointer(ptr) && (delta = calc_adjustment(adj, ptr)) != 0)
+                  FIXUP(where[1] = ptr + delta, where+1);
           }
-        // All the array header widetags.
-        case SIMPLE_ARRAY_WIDETAG:
+          if (needs_rehash) // set v->data[1], the need-to-rehash bit
+              KV_PAIRS_REHASH(data) |= make_fixnum(1);
+          return nwords;
+      }
+    // All the array header widetags.
+    case SIMPLE_ARRAY_WIDETAG:
 #ifdef COMPLEX_CHARACTER_STRING_WIDETAG
-        case COMPLEX_CHARACTER_STRING_WIDETAG:
+    case COMPLEX_CHARACTER_STRING_WIDETAG:
 #endif
-        case COMPLEX_BASE_STRING_WIDETAG:
-        case COMPLEX_BIT_VECTOR_WIDETAG:
-        case COMPLEX_VECTOR_WIDETAG:
-        case COMPLEX_ARRAY_WIDETAG:
-        // And the rest of the purely descriptor objects.
-        case SYMBOL_WIDETAG:
-        case VALUE_CELL_WIDETAG:
-        case WEAK_POINTER_WIDETAG:
-        case RATIO_WIDETAG:
-        case COMPLEX_WIDETAG:
-            break;
-
-        // Other
-        case SAP_WIDETAG:
-            if ((delta = calc_adjustment(adj, where[1])) != 0) {
-                fprintf(stderr,
-                        "WARNING: SAP at %p -> %p in relocatable core\n",
-                        where, (void*)where[1]);
-                FIXUP(where[1] += delta, where+1);
-            }
-            continue;
-        case BIGNUM_WIDETAG:
+    case COMPLEX_BASE_STRING_WIDETAG:
+    case COMPLEX_BIT_VECTOR_WIDETAG:
+    case COMPLEX_VECTOR_WIDETAG:
+    case COMPLEX_ARRAY_WIDETAG:
+    // And the rest of the purely descriptor objects.
+    case SYMBOL_WIDETAG:
+    case VALUE_CELL_WIDETAG:
+    case WEAK_POINTER_WIDETAG:
+    case RATIO_WIDETAG:
+    case COMPLEX_WIDETAG:
+        break;
+
+    // Other
+    case SAP_WIDETAG:
+        if ((delta = calc_adjustment(adj, where[1])) != 0) {
+            fprintf(stderr,
+                    "WARNING: SAP at %p -> %p in relocatable core\n",
+                    where, (void*)where[1]);
+            FIXUP(where[1] += delta, where+1);
+        }
+        return nwords;
+    case BIGNUM_WIDETAG:
 #ifndef LISP_FEATURE_64_BIT
-        case SINGLE_FLOAT_WIDETAG:
+    case SINGLE_FLOAT_WIDETAG:
 #endif
-        case DOUBLE_FLOAT_WIDETAG:
-        case COMPLEX_SINGLE_FLOAT_WIDETAG:
-        case COMPLEX_DOUBLE_FLOAT_WIDETAG:
+    case DOUBLE_FLOAT_WIDETAG:
+    case COMPLEX_SINGLE_FLOAT_WIDETAG:
+    case COMPLEX_DOUBLE_FLOAT_WIDETAG:
 #ifdef SIMD_PACK_WIDETAG
-        case SIMD_PACK_WIDETAG:
+    case SIMD_PACK_WIDETAG:
 #endif
 #ifdef SIMD_PACK_256_WIDETAG
-        case SIMD_PACK_256_WIDETAG:
+    case SIMD_PACK_256_WIDETAG:
 #endif
-            continue;
-        default:
-          if (other_immediate_lowtag_p(widetag)
-              && specialized_vector_widetag_p(widetag))
-              continue;
-          else
-              lose("Unrecognized heap object: @%p: %"OBJ_FMTX, where, *where);
+        return nwords;
+    default:
+      if (other_immediate_lowtag_p(widetag)
+          && specialized_vector_widetag_p(widetag))
+          return nwords;
+      else
+          lose("Unrecognized heap object: @%p: %"OBJ_FMTX, where, *where);
+    }
+    adjust_pointers(where+1, nwords-1, adj);
+    return nwords;
+}
+
+/* Fix up the words [from,to) of a table's space which its bitmaps
+ * name, in the copy of those words at 'dest'. Return whether there were any */
+static boolean apply_relocation_bits(struct relocation_table* table,
+                                     struct heap_adjust* adj,
+                                     uword_t from, uword_t to, lispobj* dest)
+{
+    boolean any = 0;
+    uword_t i;
+    for (i = from / N_WORD_BITS ; i < relocation_bitmap_words(to) ; ++i) {
+        uword_t bits = table->words[i] | table->layouts[i];
+        if (!bits) continue;
+        any = 1;
+        lispobj* words = dest + (i * N_WORD_BITS - from);
+        for (bits = table->words[i] ; bits ; bits &= bits - 1)
+            adjust_word_at(words + __builtin_ctzll(bits), adj);
+        for (bits = table->layouts[i] ; bits ; bits &= bits - 1) {
+            uint32_t* half = (uint32_t*)(words + __builtin_ctzll(bits)) + 1;
+            *half = adjust_word(adj, *half);
         }
-        adjust_pointers(where+1, nwords-1, adj);
     }
+    return any;
+}
+
+/* Words per chunk when relocating in parallel, a multiple of N_WORD_BITS */
+#define RELOCATION_CHUNK_WORDS (64*1024)
+#define RELOCATION_CHUNK_OBJECTS 256
+
+struct relocation_job {
+    struct relocation_table* table;
+    struct heap_adjust* adj;
+};
+
+static void relocate_words_chunk(sword_t chunk, void* arg)
+{
+    struct relocation_job* job = arg;
+    uword_t from = chunk * RELOCATION_CHUNK_WORDS, to = from + RELOCATION_CHUNK_WORDS;
+    if (to > job->table->n_words) to = job->table->n_words;
+    apply_relocation_bits(job->table, job->adj, from, to, job->table->start + from);
+}
+
+static void relocate_objects_chunk(sword_t chunk, void* arg)
+{
+    struct relocation_job* job = arg;
+    uword_t i = chunk * RELOCATION_CHUNK_OBJECTS, end = i + RELOCATION_CHUNK_OBJECTS;
+    if (end > job->table->n_objects) end = job->table->n_objects;
+    for ( ; i < end ; ++i)
+        relocate_object(job->table->start + job->table->objects[i], job->adj);
+}
+
+int lazy_core_relocation;
+#ifdef LAZY_CORE_PAGES
+/* With --lazy-core-relocation, the pages of an uncompressed dynamic space
+ * which have words to fix up are left inaccessible, and each is read from
+ * the core file and fixed up by the first access to it. The other pages
+ * remain mapped from the file. */
+static struct {
+    struct relocation_table table;
+    struct heap_adjust adj;
+    size_t len;
+} lazy_relocation;
+
+static int lazy_relocation_page_p(sword_t page)
+{
+    uword_t i = page * (GENCGC_CARD_BYTES / N_WORD_BYTES) / N_WORD_BITS,
+            end = i + GENCGC_CARD_BYTES / N_WORD_BYTES / N_WORD_BITS;
+    if (end > relocation_bitmap_words(lazy_relocation.table.n_words))
+        end = relocation_bitmap_words(lazy_relocation.table.n_words);
+    for ( ; i < end ; ++i)
+        if (lazy_relocation.table.words[i] | lazy_relocation.table.layouts[i])
+            return 1;
+    return 0;
+}
+
+static int fill_lazy_relocation_page(sword_t page, char* copy,
+                                     int __attribute__((unused)) slot)
+{
+    size_t offset = page * GENCGC_CARD_BYTES, done = 0;
+    size_t bytes = lazy_relocation.len - offset;
+    if (bytes > GENCGC_CARD_BYTES) bytes = GENCGC_CARD_BYTES;
+    while (done < bytes) {
+        ssize_t n = pread(lazy_relocation.adj.fd, copy + done, bytes - done,
+                          lazy_relocation.adj.dynamic_space_file_offset + offset + done);
+        if (n <= 0)
+            lose("can't read core file (errno = %i)", errno);
+        done += n;
+    }
+    uword_t from = offset / N_WORD_BYTES, to = from + bytes / N_WORD_BYTES;
+    if (to > lazy_relocation.table.n_words) to = lazy_relocation.table.n_words;
+    return apply_relocation_bits(&lazy_relocation.table, &lazy_relocation.adj,
+                                 from, to, (lispobj*)copy);
+}
+
+static boolean relocate_lazily(struct relocation_table* table, struct heap_adjust* adj)
+{
+    size_t len = ALIGN_UP(table->n_words * N_WORD_BYTES, os_vm_page_size);
+    if (!lazy_core_relocation || lazy_core_space_p()
+        || table->start != (lispobj*)DYNAMIC_SPACE_START
+        || !adj->dynamic_space_file_offset)
+        return 0;
+    lazy_relocation.table = *table;
+    lazy_relocation.adj = *adj;
+    lazy_relocation.adj.fd = dup(adj->fd); // the loader closes its descriptor
+    if (lazy_relocation.adj.fd < 0)
+        return 0;
+    lazy_relocation.len = len;
+    make_core_space_lazy((char*)table->start, len, GENCGC_CARD_BYTES,
+                         fill_lazy_relocation_page, chunk_thread_count(),
+                         lazy_relocation_page_p);
+    return 1;
+}
+#else
+#define relocate_lazily(table, adj) 0
+#endif
+
+/* Relocate a space using the table saved for it in the core, returning 0 if
+ * there isn't one which fits */
+static boolean relocate_space_from_table(int id, uword_t start, lispobj* end,
+                                         struct heap_adjust* adj)
+{
+    uword_t* data = adj->tables[id];
+    if (!data || data[0] != (uword_t)(end - (lispobj*)start))
+        return 0;
+    struct relocation_table table;
+    table.start = (lispobj*)start;
+    table.n_words = data[0];
+    table.n_objects = data[1];
+    table.words = data + RELOCATION_TABLE_HEADER_WORDS;
+    table.layouts = table.words + relocation_bitmap_words(table.n_words);
+    table.objects = table.layouts + relocation_bitmap_words(table.n_words);
+    struct relocation_job job = { &table, adj };
+    boolean lazy = relocate_lazily(&table, adj);
+    sword_t n_object_chunks =
+        (table.n_objects + RELOCATION_CHUNK_OBJECTS - 1) / RELOCATION_CHUNK_OBJECTS;
+    if (!lazy) {
+        for_each_chunk(0, (table.n_words + RELOCATION_CHUNK_WORDS - 1) / RELOCATION_CHUNK_WORDS,
+                       relocate_words_chunk, &job);
+        for_each_chunk(0, n_object_chunks, relocate_objects_chunk, &job);
+    } else {
+        // The listed objects may be on lazy pages, which only a thread that
+        // can take SIGSEGV may touch. for_each_chunk()'s helpers block it.
+        sword_t chunk;
+        for (chunk = 0; chunk < n_object_chunks; ++chunk)
+            relocate_objects_chunk(chunk, &job);
+    }
+    if (!lazy) // else the lazy pages still need it
+        free(data);
+    adj->tables[id] = 0;
+    return 1;
+}
+
+#ifdef LISP_FEATURE_GENCGC
+/* Without a relocation table, dynamic space is walked in chunks of pages
+ * by as many threads as there are processors. Each chunk is walked from
+ * the first page in it which begins an object up to the next such page. */
+#define RELOCATION_CHUNK_PAGES 64
+
+struct relocation_walk {
+    struct heap_adjust* adj;
+    lispobj *start, *end;
+    char* block_starts;
+    sword_t n_pages;
+};
+
+static void relocate_pages_chunk(sword_t chunk, void* arg)
+{
+    struct relocation_walk* walk = arg;
+    sword_t page = chunk * RELOCATION_CHUNK_PAGES, limit = page + RELOCATION_CHUNK_PAGES;
+    if (limit > walk->n_pages) limit = walk->n_pages;
+    while (page < limit && !walk->block_starts[page]) ++page;
+    if (page == limit) return; // the previous chunk's walk covers these pages
+    sword_t next = limit;
+    while (next < walk->n_pages && !walk->block_starts[next]) ++next;
+    lispobj* where = walk->start + page * (GENCGC_CARD_BYTES / N_WORD_BYTES);
+    lispobj* end = next < walk->n_pages
+        ? walk->start + next * (GENCGC_CARD_BYTES / N_WORD_BYTES) : walk->end;
+    for ( ; where < end ; where += relocate_object(where, walk->adj) )
+        ;
+}
+
+static boolean relocate_space_in_parallel(int id, uword_t start, lispobj* end,
+                                          struct heap_adjust* adj)
+{
+    extern char* gc_read_block_starts(core_entry_elt_t, os_vm_offset_t, int);
+    if (id != DYNAMIC_CORE_SPACE_ID || !adj->n_ptes || chunk_thread_count() < 2)
+        return 0;
+    struct relocation_walk walk;
+    walk.adj = adj;
+    walk.start = (lispobj*)start;
+    walk.end = end;
+    walk.n_pages = adj->n_ptes;
+    walk.block_starts = gc_read_block_starts(adj->n_ptes, adj->ptes_offset, adj->fd);
+    for_each_chunk(0, (walk.n_pages + RELOCATION_CHUNK_PAGES - 1) / RELOCATION_CHUNK_PAGES,
+                   relocate_pages_chunk, &walk);
+    free(walk.block_starts);
+    return 1;
+}
+#else
+#define relocate_space_in_parallel(id, start, end, adj) 0
+#endif
+
+static void relocate_space(int id, uword_t start, lispobj* end, struct heap_adjust* adj)
+{
+    lispobj *where = (lispobj*)start;
+
+    adj->n_relocs_abs = adj->n_relocs_rel = 0;
+    if (!relocate_space_from_table(id, start, end, adj)
+        && !relocate_space_in_parallel(id, start, end, adj))
+        for ( ; where < end ; where += relocate_object(where, adj) )
+            ;
 #if SHOW_SPACE_RELOCATION
     fprintf(stderr, "space @ %p: fixed %d absolute + %d relative pointers\n",
             (lispobj*)start, adj->n_relocs_abs, adj->n_relocs_rel);
@@ -579,14 +898,18 @@ static void relocate_heap(struct heap_adjust* adj)
                         (char*)adj->range[i].start + adj->range[i].delta,
                         (char*)adj->range[i].end + adj->range[i].delta);
     }
-    relocate_space(STATIC_SPACE_OBJECTS_START, static_space_free_pointer, adj);
+    relocate_space(STATIC_CORE_SPACE_ID, STATIC_SPACE_OBJECTS_START,
+                   static_space_free_pointer, adj);
 #ifdef LISP_FEATURE_IMMOBILE_SPACE
-    relocate_space(FIXEDOBJ_SPACE_START, fixedobj_free_pointer, adj);
+    relocate_space(IMMOBILE_FIXEDOBJ_CORE_SPACE_ID, FIXEDOBJ_SPACE_START,
+                   fixedobj_free_pointer, adj);
 #endif
 #ifdef LISP_FEATURE_CHENEYGC
-    relocate_space(DYNAMIC_0_SPACE_START, (lispobj*)get_alloc_pointer(), adj);
+    relocate_space(DYNAMIC_CORE_SPACE_ID, DYNAMIC_0_SPACE_START,
+                   (lispobj*)get_alloc_pointer(), adj);
 #else
-    relocate_space(DYNAMIC_SPACE_START, (lispobj*)get_alloc_pointer(), adj);
+    relocate_space(DYNAMIC_CORE_SPACE_ID, DYNAMIC_SPACE_START,
+                   (lispobj*)get_alloc_pointer(), adj);
 #endif
 #ifdef LISP_FEATURE_IMMOBILE_SPACE
     // Pointers within varyobj space to varyobj space do not need adjustment
@@ -596,7 +919,8 @@ static void relocate_heap(struct heap_adjust* adj)
         lose("code-in-elf + PIE not supported yet\n");
         adj->range[2].delta = 0; // FIXME: isn't this this already the case?
     }
-    relocate_space(VARYOBJ_SPACE_START, varyobj_free_pointer, adj);
+    relocate_space(IMMOBILE_VARYOBJ_CORE_SPACE_ID, VARYOBJ_SPACE_START,
+                   varyobj_free_pointer, adj);
 #endif
 }
 
@@ -614,12 +938,147 @@ set_adjustment(struct heap_adjust* adj,
     adj->n_ranges = j+1;
 }
 
+#ifdef LISP_FEATURE_GENCGC
+uword_t* make_relocation_table(lispobj* start, lispobj* end, size_t* nbytes)
+{
+    struct heap_adjust adj;
+    struct relocation_table table;
+    memset(&adj, 0, sizeof adj);
+    memset(&table, 0, sizeof table);
+    // Pretend that every relocatable space moves, so that each word which
+    // could change is visited
+    set_adjustment(&adj, DYNAMIC_SPACE_START + os_vm_page_size, DYNAMIC_SPACE_START,
+                   ALIGN_UP((uword_t)get_alloc_pointer() - DYNAMIC_SPACE_START,
+                            os_vm_page_size));
+#ifdef LISP_FEATURE_IMMOBILE_SPACE
+    set_adjustment(&adj, FIXEDOBJ_SPACE_START + os_vm_page_size, FIXEDOBJ_SPACE_START,
+                   ALIGN_UP((uword_t)fixedobj_free_pointer - FIXEDOBJ_SPACE_START,
+                            os_vm_page_size));
+    set_adjustment(&adj, VARYOBJ_SPACE_START + os_vm_page_size, VARYOBJ_SPACE_START,
+                   ALIGN_UP((uword_t)varyobj_free_pointer - VARYOBJ_SPACE_START,
+                            os_vm_page_size));
+#endif
+    table.start = start;
+    table.n_words = end - start;
+    uword_t bitmap_words = relocation_bitmap_words(table.n_words);
+    table.words = calloc(2 * bitmap_words, sizeof (uword_t));
+    if (!table.words)
+        lose("can't allocate relocation table");
+    table.layouts = table.words + bitmap_words;
+    adj.record = &table;
+    lispobj* where;
+    for (where = start ; where < end ; where += relocate_object(where, &adj))
+        ;
+    *nbytes = (RELOCATION_TABLE_HEADER_WORDS + 2 * bitmap_words + table.n_objects)
+              * sizeof (uword_t);
+    uword_t* data = successful_malloc(*nbytes);
+    data[0] = table.n_words;
+    data[1] = table.n_objects;
+    memcpy(data + RELOCATION_TABLE_HEADER_WORDS, table.words,
+           2 * bitmap_words * sizeof (uword_t));
+    memcpy(data + RELOCATION_TABLE_HEADER_WORDS + 2 * bitmap_words, table.objects,
+           table.n_objects * sizeof (uword_t));
+    free(table.words);
+    free(table.objects);
+    return data;
+}
+#endif
+
+/* Read the relocation tables if the core has them and they can be used */
+static void read_relocation_tables(core_entry_elt_t* header, int fd,
+                                   os_vm_offset_t file_offset, struct heap_adjust* adj)
+{
+    core_entry_elt_t *ptr = header + 1, val, len;
+    for ( ; (val = ptr[0]) != END_CORE_ENTRY_TYPE_CODE ; ptr += len) {
+        len = ptr[1];
+        if (val != RELOCATION_TABLE_CORE_ENTRY_TYPE_CODE)
+            continue;
+        // The tables were made for a heap that is not split off into ELF sections
+        if (lisp_code_in_elf())
+            return;
+        sword_t i, n_tables = ptr[2];
+        for (i = 0 ; i < n_tables ; ++i) {
+            core_entry_elt_t *entry = ptr + 3 + 3*i;
+            int id = entry[0];
+            size_t nbytes = entry[1];
+            gc_assert(id <= MAX_CORE_SPACE_ID);
+            adj->tables[id] = successful_malloc(nbytes);
+            os_vm_offset_t offset = file_offset + (entry[2] + 1) * os_vm_page_size;
+            if (lseek(fd, offset, SEEK_SET) != offset
+                || read(fd, adj->tables[id], nbytes) != (ssize_t)nbytes)
+                lose("failed to read relocation table");
+        }
+        return;
+    }
+}
+
+/* Note where the core's page table is, in case dynamic space is relocated */
+static void find_saved_page_table(core_entry_elt_t* header, os_vm_offset_t file_offset,
+                                  struct heap_adjust* adj)
+{
+    core_entry_elt_t *ptr = header + 1, val, len;
+    for ( ; (val = ptr[0]) != END_CORE_ENTRY_TYPE_CODE ; ptr += len) {
+        len = ptr[1];
+        if (val == PAGE_TABLE_CORE_ENTRY_TYPE_CODE) {
+            adj->n_ptes = ptr[2];
+            adj->ptes_offset = file_offset + (ptr[4] + 1) * os_vm_page_size;
+            return;
+        }
+    }
+}
+
 #if defined(LISP_FEATURE_ELF) && defined(LISP_FEATURE_IMMOBILE_SPACE)
     extern int apply_pie_relocs(long,long,int);
 #else
 #   define apply_pie_relocs(dummy1,dummy2,dummy3) (0)
 #endif
 
+#define delta_page_p(bitmap, page) ((bitmap)[(page)/8] & (1 << ((page)%8)))
+/* Runs of at least this many changed pages are mapped from the delta core,
+ * and shorter ones are read over the base core's pages, so that a space
+ * with scattered changes doesn't cost a mapping per run */
+#define DELTA_MAP_PAGES 16
+
+/* Load a space of a delta core: map the space's pages from the base core,
+ * and then replace those which changed. The delta core stores a bitmap of
+ * the changed pages at 'offset', followed by their contents in order */
+static void load_delta_space(int fd, os_vm_offset_t offset, int id,
+                             char *addr, uword_t len, struct base_core *base)
+{
+    int execute = id == READ_ONLY_CORE_SPACE_ID;
+    uword_t n_pages = len / os_vm_page_size, page = 0, end;
+    uword_t base_len = base->spaces[id].page_count * os_vm_page_size;
+    if (base->fd < 0)
+        lose("delta core has no base core");
+    if (base_len > len)
+        base_len = len;
+    if (base_len)
+        load_core_bytes(base->fd, base->spaces[id].offset,
+                        (os_vm_address_t)addr, base_len, execute);
+    size_t bitmap_bytes = ALIGN_UP((n_pages + 7) / 8, os_vm_page_size);
+    unsigned char *bitmap = successful_malloc(bitmap_bytes);
+    if (lseek(fd, offset, SEEK_SET) != offset
+        || read(fd, bitmap, bitmap_bytes) != (ssize_t)bitmap_bytes)
+        lose("premature end of core file");
+    offset += bitmap_bytes;
+    for ( ; page < n_pages ; page = end) {
+        for (end = page; end < n_pages && delta_page_p(bitmap, end); ++end);
+        if (end == page) {
+            ++end;
+            continue;
+        }
+        char *where = addr + page * os_vm_page_size;
+        uword_t nbytes = (end - page) * os_vm_page_size;
+        if (end - page >= DELTA_MAP_PAGES || where >= addr + base_len)
+            load_core_bytes(fd, offset, (os_vm_address_t)where, nbytes, execute);
+        else if (lseek(fd, offset, SEEK_SET) != offset
+                 || read(fd, where, nbytes) != (ssize_t)nbytes)
+            lose("premature end of core file");
+        offset += nbytes;
+    }
+    free(bitmap);
+}
+
 /// Compute the bounds of the lisp assembly routine code object
 void calc_asm_routine_bounds()
 {
@@ -687,7 +1146,8 @@ static void
 process_directory(int count, struct ndir_entry *entry,
                   int fd, os_vm_offset_t file_offset,
                   int __attribute__((unused)) merge_core_pages,
-                  struct heap_adjust __attribute__((unused)) *adj)
+                  struct heap_adjust __attribute__((unused)) *adj,
+                  struct base_core *base)
 {
     extern void immobile_space_coreparse(uword_t,uword_t);
 
@@ -784,7 +1244,8 @@ process_directory(int count, struct ndir_entry *entry,
                entry->nwords);
 #endif
         int compressed = id & DEFLATED_CORE_SPACE_ID_FLAG;
-        id -= compressed;
+        int delta = id & DELTA_CORE_SPACE_ID_FLAG;
+        id -= compressed | delta;
         if (id < 1 || id > MAX_CORE_SPACE_ID)
             lose("unknown space ID %ld addr %p", id, (void*)addr);
 
@@ -901,7 +1362,8 @@ process_directory(int count, struct ndir_entry *entry,
                 if (id == READ_ONLY_CORE_SPACE_ID)
                     os_protect((os_vm_address_t)addr, len, OS_VM_PROT_WRITE);
 #endif
-                inflate_core_bytes(fd, offset + file_offset, (os_vm_address_t)addr, len);
+                decompress_core_bytes(fd, offset + file_offset, (char*)addr, len,
+                                      id == DYNAMIC_CORE_SPACE_ID);
 
 #ifdef LISP_FEATURE_DARWIN_JIT
                 if (id == READ_ONLY_CORE_SPACE_ID)
@@ -909,6 +1371,9 @@ process_directory(int count, struct ndir_entry *entry,
 #endif
 
             }
+            else if (delta)
+                // Comes from two files, so lazy relocation can't reread it
+                load_delta_space(fd, offset + file_offset, id, (char*)addr, len, base);
             else
 #ifdef LISP_FEATURE_DARWIN_JIT
             if (id == DYNAMIC_CORE_SPACE_ID || id == STATIC_CODE_CORE_SPACE_ID) {
@@ -917,6 +1382,8 @@ process_directory(int count, struct ndir_entry *entry,
 #endif
               {
                 load_core_bytes(fd, offset + file_offset, (os_vm_address_t)addr, len, id == READ_ONLY_CORE_SPACE_ID);
+                if (id == DYNAMIC_CORE_SPACE_ID)
+                    adj->dynamic_space_file_offset = offset + file_offset;
             }
         }
 
@@ -970,8 +1437,12 @@ process_directory(int count, struct ndir_entry *entry,
                    spaces[DYNAMIC_CORE_SPACE_ID].base, // expected
                    spaces[DYNAMIC_CORE_SPACE_ID].len);
 #  endif // LISP_FEATURE_GENCGC
+    end_startup_phase("load spaces");
     if (adj->range[0].delta | adj->range[1].delta | adj->range[2].delta) {
+        fill_lazy_core(0); // relocation visits every object
+        adj->fd = fd;
         relocate_heap(adj);
+        end_startup_phase("relocate heap");
     }
 
 #ifdef LISP_FEATURE_IMMOBILE_SPACE
@@ -1013,7 +1484,10 @@ load_core_file(char *file, os_vm_offset_t file_offset, int merge_core_pages)
     ssize_t count;
     lispobj initial_function = NIL;
     struct heap_adjust adj;
+    struct base_core base;
+    int i;
     memset(&adj, 0, sizeof adj);
+    base.fd = -1;
 
     if (fd < 0) {
         fprintf(stderr, "could not open file \"%s\"\n", file);
@@ -1021,6 +1495,7 @@ load_core_file(char *file, os_vm_offset_t file_offset, int merge_core_pages)
         exit(1);
     }
 
+    startup_phase_start = startup_clock_ns();
     lseek(fd, file_offset, SEEK_SET);
     header = calloc(os_vm_page_size, 1);
 
@@ -1049,14 +1524,41 @@ load_core_file(char *file, os_vm_offset_t file_offset, int merge_core_pages)
                 lose("core was built for runtime \"%.*s\" but this is \"%s\"",
                      (int)stringlen, (char*)ptr, build_id);
             break;
+        case BASE_CORE_CORE_ENTRY_TYPE_CODE:
+            {
+            // ptr[0] and ptr[1] identify the base core, and ptr[2] is the
+            // length of its name, which follows
+            char *name = base_core_filename;
+            if (!name) {
+                name = successful_malloc(ptr[2] + 1);
+                memcpy(name, ptr + 3, ptr[2]);
+                name[ptr[2]] = 0;
+            }
+            char *msg = open_base_core(name, &base);
+            if (msg)
+                lose("can't load base core \"%s\": %s", name, msg);
+            if (base.size != (uword_t)ptr[0] || base.checksum != (uword_t)ptr[1])
+                lose("\"%s\" is not the base core that this core was saved against",
+                     name);
+            if (name != base_core_filename)
+                free(name);
+            }
+            break;
         case DIRECTORY_CORE_ENTRY_TYPE_CODE:
+            read_relocation_tables(header, fd, file_offset, &adj);
+            find_saved_page_table(header, file_offset, &adj);
             process_directory(remaining_len / NDIR_ENTRY_LENGTH,
                               (struct ndir_entry*)ptr, fd, file_offset,
-                              merge_core_pages, &adj);
+                              merge_core_pages, &adj, &base);
+            if (base.fd >= 0)
+                close(base.fd);
+            for (i = 0 ; i <= MAX_CORE_SPACE_ID ; ++i)
+                free(adj.tables[i]); // those not used by relocation
             break;
         case PAGE_TABLE_CORE_ENTRY_TYPE_CODE:
             gc_load_corefile_ptes(ptr[0], ptr[1],
                                   file_offset + (ptr[2] + 1) * os_vm_page_size, fd);
+            end_startup_phase("page table");
             break;
         case INITIAL_FUN_CORE_ENTRY_TYPE_CODE:
             initial_function = adjust_word(&adj, (lispobj)*ptr);
@@ -1079,7 +1581,9 @@ load_core_file(char *file, os_vm_offset_t file_offset, int merge_core_pages)
             }
 #endif
             sanity_check_loaded_core(initial_function);
+            report_startup_phases();
             return initial_function;
+        case RELOCATION_TABLE_CORE_ENTRY_TYPE_CODE: break; // already processed
         case RUNTIME_OPTIONS_MAGIC: break; // already processed
         default:
             lose("unknown core header entry: %"OBJ_FMTX, (lispobj)val);
@@ -1282,9 +1786,28 @@ static void sanity_check_loaded_core(lispobj initial_function)
     for_each_hopscotch_key(key_index, ptr, reached)
         if (dynamic_space_pointer_p(ptr))
             tally(ptr, &v[0]);
-    // Pass 2: Count all heap objects
-    v[1].reached = &reached;
-    walk_generation(visit, -1, (uword_t)&v[1]);
+    // Pass 2: Count all heap objects, a chunk of pages per thread at a time
+    sword_t n_chunks = walk_generation_n_chunks(), chunk, j;
+    struct visitor* chunk_visitors = calloc(n_chunks, sizeof (struct visitor));
+    uword_t* extra = successful_malloc((n_chunks + 1) * sizeof (uword_t));
+    for (chunk = 0; chunk < n_chunks; ++chunk) {
+        chunk_visitors[chunk].reached = &reached;
+        extra[chunk] = (uword_t)&chunk_visitors[chunk];
+    }
+    walk_generation_by_chunks(visit, -1, extra);
+    for (chunk = 0; chunk < n_chunks; ++chunk) {
+        for (j = 0; j < 64; ++j) {
+            v[1].headers[j].count += chunk_visitors[chunk].headers[j].count;
+            v[1].headers[j].words += chunk_visitors[chunk].headers[j].words;
+        }
+        for (j = 0; j < 3; ++j) {
+            v[1].sv_subtypes[j].count += chunk_visitors[chunk].sv_subtypes[j].count;
+            v[1].sv_subtypes[j].words += chunk_visitors[chunk].sv_subtypes[j].words;
+        }
+    }
+    free(chunk_visitors);
+    free(extra);
+    end_startup_phase("sanity check");
     // Pass 3: Compare
     // Start with the conses
     v[0].headers[0].words = v[0].headers[0].count * 2;
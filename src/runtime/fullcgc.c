@@ -23,6 +23,7 @@
 #include "code.h"
 #include "immobile-space.h"
 #include "queue.h"
+#include "gc-thread-pool.h"
 
 #include <stdio.h>
 #ifndef LISP_FEATURE_WIN32
@@ -33,7 +34,13 @@
 #endif
 
 
-/* Most headered objects use MARK_BIT to record liveness.
+/* Objects in dynamic space record liveness in 'dynamic_mark_bits', a side
+ * table with one bit per doubleword of dynamic space, indexed by the address
+ * of the object's first word. Setting a bit is an atomic OR, so any number
+ * of threads can mark concurrently, and object headers in dynamic space
+ * are never written by the marker.
+ *
+ * Headered objects in immobile space use MARK_BIT in the header instead.
  * Bignums always use the leftmost bit regardless of word size.
  * Fdefns use 0x4000 which overlaps the 'written' bit in the generation byte,
  * but 'written' is not used except for code objects, so this is fine.
@@ -87,24 +94,6 @@ static void* get_free_page() {
     return mem;
 }
 
-/* The suballocator doles out blocks of bits for marking conses live.
- * Example: If pages are 32768 bytes, and Lisp words are 8 bytes,
- * then one GC page can hold 2K cons cells.
- * One byte marks 8 conses (1 bit per cons), 256 bytes mark 2048 conses.
- * 128 blocks of 256 bytes fit on a 32K GC page. */
-char *suballocator_free_ptr, *suballocator_end_ptr;
-
-static void* allocate_cons_mark_bits() {
-    int nbytes = GENCGC_CARD_BYTES / (2 * N_WORD_BYTES) / 8;
-    if (suballocator_free_ptr + nbytes > suballocator_end_ptr) {
-        suballocator_free_ptr = get_free_page();
-        suballocator_end_ptr = suballocator_free_ptr + GENCGC_CARD_BYTES;
-    }
-    void* mem = suballocator_free_ptr;
-    suballocator_free_ptr += nbytes;
-    return mem;
-}
-
 static void gc_enqueue(lispobj object)
 {
     gc_dcheck(is_lisp_pointer(object));
@@ -148,33 +137,209 @@ static lispobj gc_dequeue()
     return object;
 }
 
-/* The 'mark_bits' hashtable maps a page address to a block of mark bits
- * for headerless objects (conses) */
-struct hopscotch_table mark_bits;
+/* Parallel marking.
+ * Each marking thread owns a work-stealing deque in the style of Chase and Lev,
+ * but with a fixed capacity: if the owner's deque is full, work spills into
+ * 'scav_queue', which is then shared by all threads and guarded by a lock.
+ * The owner pushes and pops at the bottom; other threads steal at the top.
+ * Objects are never 0, so 0 represents "no work". */
+#if defined LISP_FEATURE_SB_THREAD && !defined LISP_FEATURE_WIN32
+#define PARALLEL_MARK 1
+#include <sched.h>
+
+#define MARK_DEQUE_CAPACITY (1<<16) /* elements; must be a power of 2 */
+struct mark_deque {
+    lispobj* buffer;
+    volatile sword_t top;
+    volatile sword_t bottom;
+    char padding[64]; // keep the next deque's indices off this cache line
+};
+static struct mark_deque* mark_deques;
+static int n_mark_deques;
+static int shared_queue_lock, weak_object_lock;
+static volatile int n_idle_markers;
+static __thread struct mark_deque* my_deque;
+
+static inline void acquire_marker_lock(int* lock) {
+    if (my_deque)
+        while (__sync_lock_test_and_set(lock, 1))
+            while (*(volatile int*)lock) ;
+}
+static inline void release_marker_lock(int* lock) {
+    if (my_deque) __sync_lock_release(lock);
+}
+
+static void deque_push(struct mark_deque* d, lispobj object)
+{
+    sword_t b = d->bottom;
+    sword_t t = d->top;
+    if (b - t >= MARK_DEQUE_CAPACITY) {
+        acquire_marker_lock(&shared_queue_lock);
+        gc_enqueue(object);
+        release_marker_lock(&shared_queue_lock);
+        return;
+    }
+    d->buffer[b & (MARK_DEQUE_CAPACITY-1)] = object;
+    __sync_synchronize(); // publish the element before the new bottom
+    d->bottom = b + 1;
+}
+
+static lispobj deque_pop(struct mark_deque* d)
+{
+    sword_t b = d->bottom - 1;
+    d->bottom = b;
+    __sync_synchronize();
+    sword_t t = d->top;
+    if (t > b) { // was empty
+        d->bottom = t;
+        return 0;
+    }
+    lispobj object = d->buffer[b & (MARK_DEQUE_CAPACITY-1)];
+    if (t == b) { // last element: race against thieves for it
+        if (!__sync_bool_compare_and_swap(&d->top, t, t + 1))
+            object = 0;
+        d->bottom = t + 1;
+    }
+    return object;
+}
+
+static lispobj deque_steal(struct mark_deque* d)
+{
+    sword_t t = d->top;
+    __sync_synchronize();
+    sword_t b = d->bottom;
+    if (t >= b) return 0;
+    lispobj object = d->buffer[t & (MARK_DEQUE_CAPACITY-1)];
+    return __sync_bool_compare_and_swap(&d->top, t, t + 1) ? object : 0;
+}
+
+/* Move a batch of objects from the shared queue into the caller's deque,
+ * returning one of them to be traced immediately. */
+static lispobj take_shared_work(struct mark_deque* d)
+{
+    if (!((volatile struct Qblock*)scav_queue.head_block)->count)
+        return 0;
+    lispobj result = 0;
+    int n = 0;
+    acquire_marker_lock(&shared_queue_lock);
+    if (scav_queue.head_block->count) {
+        result = gc_dequeue();
+        // Leave room in the deque so that pushing these can't overflow.
+        while (scav_queue.head_block->count && ++n < 256
+               && d->bottom - d->top < MARK_DEQUE_CAPACITY/2)
+            deque_push(d, gc_dequeue());
+    }
+    release_marker_lock(&shared_queue_lock);
+    return result;
+}
+
+static lispobj steal_work(int me)
+{
+    int i;
+    for (i = 1; i < n_mark_deques; ++i) {
+        struct mark_deque* victim = &mark_deques[(me + i) % n_mark_deques];
+        if (victim->top < victim->bottom) {
+            lispobj object = deque_steal(victim);
+            if (object) return object;
+        }
+    }
+    return 0;
+}
+
+static boolean work_visible()
+{
+    if (((volatile struct Qblock*)scav_queue.head_block)->count) return 1;
+    int i;
+    for (i = 0; i < n_mark_deques; ++i)
+        if (mark_deques[i].top < mark_deques[i].bottom) return 1;
+    return 0;
+}
+
+static void trace_object(lispobj* where);
+static void mark_pair(lispobj* where);
+
+/* Drain all marking work, on each thread of the pool. A thread which finds no
+ * work anywhere counts itself idle, and resumes if it sees new work appear.
+ * Only a thread which is not idle can create work, so once all threads are
+ * idle, marking is complete until the next round of weak object processing. */
+static void parallel_mark(int me, int n_workers,
+                          void __attribute__((unused)) *arg)
+{
+    struct mark_deque* d = &mark_deques[me];
+    my_deque = d;
+    for (;;) {
+        lispobj ptr = deque_pop(d);
+        if (!ptr) ptr = take_shared_work(d);
+        if (!ptr) ptr = steal_work(me);
+        if (ptr) {
+            if (!listp(ptr))
+                trace_object(native_pointer(ptr));
+            else
+                mark_pair((lispobj*)(ptr - LIST_POINTER_LOWTAG));
+            continue;
+        }
+        __sync_fetch_and_add(&n_idle_markers, 1);
+        for (;;) {
+            if (n_idle_markers == n_workers) {
+                my_deque = 0;
+                return;
+            }
+            if (work_visible()) {
+                __sync_fetch_and_sub(&n_idle_markers, 1);
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+static void gc_push(lispobj object)
+{
+    if (my_deque) deque_push(my_deque, object); else gc_enqueue(object);
+}
+
+#else
+
+#define acquire_marker_lock(dummy)
+#define release_marker_lock(dummy)
+static void gc_push(lispobj object) { gc_enqueue(object); }
+
+#endif
 
-static inline uword_t compute_page_key(lispobj cons) {
-    return ALIGN_DOWN(cons, GENCGC_CARD_BYTES);
+static unsigned char* dynamic_mark_bits;
+static os_vm_size_t dynamic_mark_bits_size;
+
+static inline uword_t compute_dword_number(lispobj* base) {
+    return ((uword_t)base - DYNAMIC_SPACE_START) >> (1+WORD_SHIFT);
 }
-static inline int compute_dword_number(lispobj cons) {
-    return (cons & (GENCGC_CARD_BYTES - 1)) >> (1+WORD_SHIFT);
+
+static inline int dynamic_space_markedp(lispobj* base) {
+    uword_t index = compute_dword_number(base);
+    return (dynamic_mark_bits[index / 8] >> (index % 8)) & 1;
 }
 
-static inline int cons_markedp(lispobj pointer) {
-    unsigned char* bits = (unsigned char*)
-        hopscotch_get(&mark_bits, compute_page_key(pointer), 0);
-    if (!bits) return 0;
-    int index = compute_dword_number(pointer);
-    return (bits[index / 8] >> (index % 8)) & 1;
+/* Set the mark bit for the object at 'base', returning 1 if it was
+ * previously unmarked, which means that the caller has to trace it. */
+static inline int set_dynamic_space_mark(lispobj* base) {
+    uword_t index = compute_dword_number(base);
+    unsigned char mask = 1 << (index % 8);
+    unsigned char* byte = dynamic_mark_bits + index / 8;
+    if (*byte & mask) return 0;
+    return !(__sync_fetch_and_or(byte, mask) & mask);
 }
 
 /* Return true if OBJ has already survived the current GC. */
 static inline int pointer_survived_gc_yet(lispobj pointer)
 {
-    if (!interesting_pointer_p(pointer))
+    lispobj* base = native_pointer(pointer);
+    if (find_page_index(base) >= 0) {
+        if (!listp(pointer) && embedded_obj_p(widetag_of(base)))
+            base = fun_code_header(base);
+        return dynamic_space_markedp(base);
+    }
+    if (!immobile_space_p(pointer))
         return 1;
-    if (listp(pointer))
-        return cons_markedp(pointer);
-    lispobj header = *native_pointer(pointer);
+    lispobj header = *base;
     int widetag = header_widetag(header);
     switch (widetag) {
     case BIGNUM_WIDETAG: return (header & BIGNUM_MARK_BIT) != 0;
@@ -188,25 +353,34 @@ static inline int pointer_survived_gc_yet(lispobj pointer)
 void __mark_obj(lispobj pointer)
 {
     gc_dcheck(is_lisp_pointer(pointer));
-    if (!interesting_pointer_p(pointer))
-        return;
-    if (!listp(pointer)) {
-        lispobj* base = native_pointer(pointer);
-        lispobj header = *base;
-        int widetag = header_widetag(header);
-        if (widetag == BIGNUM_WIDETAG) {
-            *base |= BIGNUM_MARK_BIT;
-            return; // don't enqueue - no pointers
-        } else {
+    lispobj* base = native_pointer(pointer);
+    int widetag = 0;
+    if (find_page_index(base) >= 0) {
+        if (!listp(pointer)) {
+            widetag = widetag_of(base);
             if (embedded_obj_p(widetag)) {
                 base = fun_code_header(base);
                 pointer = make_lispobj(base, OTHER_POINTER_LOWTAG);
-                header = *base;
+                widetag = CODE_HEADER_WIDETAG;
             }
-            uword_t markbit = (widetag == FDEFN_WIDETAG) ? FDEFN_MARK_BIT : MARK_BIT;
-            if (header & markbit) return; // already marked
-            *base |= markbit;
         }
+        if (!set_dynamic_space_mark(base)) return; // already marked
+    } else if (immobile_space_p(pointer)) {
+        lispobj header = *base;
+        widetag = header_widetag(header);
+        if (embedded_obj_p(widetag)) {
+            base = fun_code_header(base);
+            pointer = make_lispobj(base, OTHER_POINTER_LOWTAG);
+            header = *base;
+            widetag = CODE_HEADER_WIDETAG;
+        }
+        uword_t markbit = (widetag == FDEFN_WIDETAG) ? FDEFN_MARK_BIT : MARK_BIT;
+        if (header & markbit) return; // already marked
+        if (__sync_fetch_and_or(base, markbit) & markbit) return;
+    } else {
+        return;
+    }
+    if (!listp(pointer)) {
 #ifdef LISP_FEATURE_UBSAN
         if (specialized_vector_widetag_p(widetag) && is_lisp_pointer(base[1]))
             gc_mark_obj(base[1]);
@@ -218,20 +392,8 @@ void __mark_obj(lispobj pointer)
         }
 #endif
         if (leaf_obj_widetag_p(widetag)) return;
-    } else {
-        uword_t key = compute_page_key(pointer);
-        int index = compute_dword_number(pointer);
-        unsigned char* bits = (unsigned char*)hopscotch_get(&mark_bits, key, 0);
-        if (!bits) {
-            bits = allocate_cons_mark_bits();
-            hopscotch_insert(&mark_bits, key, (sword_t)bits);
-        } else if (bits[index / 8] & (1 << (index % 8))) {
-            return;
-        }
-        // Mark the cons
-        bits[index / 8] |= 1 << (index % 8);
     }
-    gc_enqueue(pointer);
+    gc_push(pointer);
 }
 
 inline void gc_mark_obj(lispobj thing) {
@@ -305,8 +467,11 @@ static void trace_object(lispobj* where)
         // Ergo, those may be treated just like ordinary simple vectors.
         // However, weakness remains as a special case.
         if (vector_flagp(header, VectorWeak)) {
+            // The lists of weak objects and the trigger table are not thread-safe
+            acquire_marker_lock(&weak_object_lock);
             if (!vector_flagp(header, VectorHashing)) {
                 add_to_weak_vector_list(where, header);
+                release_marker_lock(&weak_object_lock);
                 return;
             }
             // Ok, we're looking at a weak hash-table.
@@ -329,6 +494,7 @@ static void trace_object(lispobj* where)
                 hash_table->next_weak_hash_table = (lispobj)weak_hash_tables;
                 weak_hash_tables = hash_table;
             }
+            release_marker_lock(&weak_object_lock);
             return;
         }
         break;
@@ -364,8 +530,11 @@ static void trace_object(lispobj* where)
         break;
     case WEAK_POINTER_WIDETAG:
         weakptr = (struct weak_pointer*)where;
-        if (is_lisp_pointer(weakptr->value) && interesting_pointer_p(weakptr->value))
+        if (is_lisp_pointer(weakptr->value) && interesting_pointer_p(weakptr->value)) {
+            acquire_marker_lock(&weak_object_lock);
             add_to_weak_pointer_chain(weakptr);
+            release_marker_lock(&weak_object_lock);
+        }
         return;
     default:
         if (leaf_obj_widetag_p(widetag)) return;
@@ -376,26 +545,54 @@ static void trace_object(lispobj* where)
 
 void prepare_for_full_mark_phase()
 {
-    // FIXME: Estimate how large to create mark_bits based on dynamic space size.
-    // Guess 8 words per object, and X% of the objects are conses.
-    // The problem is guessing how localized the conses are: guess that N conses
-    // will reside on fraction*N different pages, which guides us as to how many
-    // hash table entries are needed.
-    hopscotch_create(&mark_bits, HOPSCOTCH_HASH_FUN_DEFAULT,
-                     N_WORD_BYTES, /* table values are machine words */
-                     65536, /* initial size */
-                     0);
+    // The bitmap is mapped fresh for each collection, which makes it zero-filled,
+    // and only the parts covering pages in use ever become resident.
+    gc_assert(!dynamic_mark_bits); // no lazy sweep can be in progress
+    dynamic_mark_bits_size =
+        ALIGN_UP(page_table_pages * (GENCGC_CARD_BYTES / (2*N_WORD_BYTES) / 8),
+                 os_vm_page_size);
+    dynamic_mark_bits = (unsigned char*)os_allocate(dynamic_mark_bits_size);
+    if (!dynamic_mark_bits)
+        lose("Can't allocate %"OS_VM_SIZE_FMT" bytes of mark bits",
+             dynamic_mark_bits_size);
 
     free_page = page_table_pages;
-    suballocator_free_ptr = suballocator_end_ptr = 0;
     struct Qblock* block = (struct Qblock*)get_free_page();
     dprintf(("Queue block holds %d objects\n", (int)QBLOCK_CAPACITY));
     scav_queue.head_block = block;
     scav_queue.tail_block = block;
     scav_queue.recycler   = 0;
     gc_assert(!scav_queue.head_block->count);
+
+#ifdef PARALLEL_MARK
+    if (gc_n_threads > 1) {
+        n_mark_deques = gc_n_threads;
+        mark_deques = (struct mark_deque*)
+            os_allocate(n_mark_deques * sizeof (struct mark_deque));
+        int i;
+        for (i = 0; i < n_mark_deques; ++i) {
+            mark_deques[i].buffer = (lispobj*)
+                os_allocate(MARK_DEQUE_CAPACITY * N_WORD_BYTES);
+            if (!mark_deques[i].buffer) lose("Can't allocate mark deque");
+        }
+    }
+#endif
 }
 
+#ifdef PARALLEL_MARK
+static void free_mark_deques()
+{
+    int i;
+    for (i = 0; i < n_mark_deques; ++i)
+        os_deallocate((os_vm_address_t)mark_deques[i].buffer,
+                      MARK_DEQUE_CAPACITY * N_WORD_BYTES);
+    os_deallocate((os_vm_address_t)mark_deques,
+                  n_mark_deques * sizeof (struct mark_deque));
+    mark_deques = 0;
+    n_mark_deques = 0;
+}
+#endif
+
 void execute_full_mark_phase()
 {
 #if HAVE_GETRUSAGE
@@ -417,6 +614,17 @@ void execute_full_mark_phase()
         gc_enqueue(obj);
         where += listp(obj) ? 2 : sizetab[widetag_of(where)](where);
     }
+#endif
+#ifdef PARALLEL_MARK
+    if (mark_deques) {
+        // Weak object processing happens between rounds, on this thread only.
+        do {
+            n_idle_markers = 0;
+            gc_run_on_thread_pool(parallel_mark, 0);
+        } while (test_weak_triggers(pointer_survived_gc_yet, gc_mark_obj) &&
+                 scav_queue.head_block->count);
+        free_mark_deques();
+    } else
 #endif
     do {
         lispobj ptr = gc_dequeue();
@@ -436,8 +644,8 @@ void execute_full_mark_phase()
              (a.field.tv_usec-b.field.tv_usec)) / 1000000.0
     if (gencgc_verbose)
         fprintf(stderr,
-                "[Mark phase: %d pages used, HT-count=%d, ET=%f+%f sys+usr]\n",
-                (int)(page_table_pages - free_page), mark_bits.count,
+                "[Mark phase: %d pages used, %d threads, ET=%f+%f sys+usr]\n",
+                (int)(page_table_pages - free_page), gc_n_threads,
                 timediff(before, after, ru_stime), timediff(before, after, ru_utime));
 #endif
 }
@@ -535,10 +743,24 @@ static void sweep_fixedobj_pages(long *zeroed)
 }
 #endif
 
+/* If 'arg' is 0, nothing is erased, and the return value is 1 if there is
+ * any garbage in the range */
 static uword_t sweep(lispobj* where, lispobj* end, uword_t arg)
 {
     long *zeroed = (long*)arg; // one count per generation
     sword_t nwords;
+    // Liveness is in the side table for dynamic space, else in the header.
+    boolean dynamic = find_page_index(where) >= 0;
+
+    // Read-only constants of the core are never freed, nor written
+    if (dynamic && readonly_core_page_end > readonly_core_page_start) {
+        lispobj *ro_start = (lispobj*)page_address(readonly_core_page_start),
+                *ro_end = (lispobj*)page_address(readonly_core_page_end);
+        if (where < ro_end && end > ro_start) {
+            uword_t garbage = where < ro_start ? sweep(where, ro_start, arg) : 0;
+            return (end > ro_end ? sweep(ro_end, end, arg) : 0) | garbage;
+        }
+    }
 
     // TODO: consecutive dead objects on same page should be merged.
     for ( ; where < end ; where += nwords ) {
@@ -550,9 +772,9 @@ static uword_t sweep(lispobj* where, lispobj* end, uword_t arg)
             case BIGNUM_WIDETAG: markbit = BIGNUM_MARK_BIT; break;
             case FDEFN_WIDETAG : markbit = FDEFN_MARK_BIT; break;
             }
-            if (word & markbit)
-                *where = word ^ markbit;
-            else {
+            if (dynamic ? dynamic_space_markedp(where) : (word & markbit) != 0) {
+                if (!dynamic) *where = word ^ markbit;
+            } else {
                 // Turn the object into either a (0 . 0) cons
                 // or an unboxed filler depending on size.
                 if (nwords <= 2) // could be SAP, SIMPLE-ARRAY-NIL, 1-word bignum, etc
@@ -560,6 +782,7 @@ static uword_t sweep(lispobj* where, lispobj* end, uword_t arg)
                 struct code* code  = (struct code*)where;
                 // Keep in sync with the definition of filler_obj_p()
                 if (!filler_obj_p((lispobj*)code)) {
+                    if (!zeroed) return 1;
                     page_index_t page = find_page_index(where);
                     int gen = page >= 0 ? page_table[page].gen
                       : immobile_obj_gen_bits(where);
@@ -573,9 +796,10 @@ static uword_t sweep(lispobj* where, lispobj* end, uword_t arg)
             }
         } else {
             nwords = 2;
-            if (!cons_markedp((lispobj)where)) {
+            if (!(dynamic && dynamic_space_markedp(where))) {
                 if (where[0] | where[1]) {
                cons:
+                    if (!zeroed) return 1;
                     gc_dcheck(!immobile_space_p((lispobj)where));
                     NOTE_GARBAGE(page_table[find_page_index(where)].gen,
                                  where, 2, zeroed,
@@ -605,15 +829,44 @@ void toggle_print_garbage(char *filename, int enable)
     }
 }
 
-void execute_full_sweep_phase()
+/* Per-thread counts of words zeroed in each generation by the parallel sweep */
+static long sweep_tallies[MAX_GC_THREADS][1+PSEUDO_STATIC_GENERATION];
+
+/* Lazy sweeping of dynamic space happens after the world is restarted,
+ * one block at a time with free_pages_lock held (see 'lazy_sweep_pending'
+ * in gencgc). The mark bits stay valid until release_lazy_sweep_marks() */
+boolean block_has_garbage(lispobj* where, lispobj* end)
+{
+    return sweep(where, end, 0) != 0;
+}
+void sweep_block(lispobj* where, lispobj* end, long* words_zeroed)
+{
+    sweep(where, end, (uword_t)words_zeroed);
+}
+void release_lazy_sweep_marks()
+{
+    os_deallocate((os_vm_address_t)dynamic_mark_bits, dynamic_mark_bits_size);
+    dynamic_mark_bits = 0;
+}
+
+/* What the heap profiler's sampled object is after marking, or 0 if it died */
+static lispobj heap_sample_survivor(lispobj obj)
 {
-    long words_zeroed[1+PSEUDO_STATIC_GENERATION]; // One count per generation
+    return pointer_survived_gc_yet(obj) ? obj : 0;
+}
 
+/* 'words_zeroed' receives one count per generation.
+ * If 'lazy' is true, dynamic space is not swept unless a log of garbage was
+ * requested. The return value is true if the sweep was left to the caller. */
+boolean execute_full_sweep_phase(long words_zeroed[1+PSEUDO_STATIC_GENERATION],
+                                 boolean lazy)
+{
     local_smash_weak_pointers();
+    heap_profile_cull(heap_sample_survivor);
     gc_dispose_private_pages();
     cull_weak_hash_tables(alivep_funs);
 
-    memset(words_zeroed, 0, sizeof words_zeroed);
+    memset(words_zeroed, 0, (1+PSEUDO_STATIC_GENERATION) * sizeof (long));
 #ifdef LISP_FEATURE_IMMOBILE_SPACE
     if (sweeplog) fprintf(sweeplog, "-- fixedobj space --\n");
     sweep_fixedobj_pages(words_zeroed);
@@ -621,8 +874,26 @@ void execute_full_sweep_phase()
     sweep((lispobj*)VARYOBJ_SPACE_START, varyobj_free_pointer,
           (uword_t)words_zeroed);
 #endif
-    if (sweeplog) fprintf(sweeplog, "-- dynamic space --\n");
-    walk_generation(sweep, -1, (uword_t)words_zeroed);
+    if (sweep_mode & 2) // the log of garbage should be complete on return
+        lazy = 0;
+    if (lazy) {
+        // The mark bits are released after the last block is swept
+    } else if (gc_n_threads > 1 && !(sweep_mode & 2)) {
+        // Blocks are independent once marking is done, and each thread
+        // tallies separately. A log of garbage is always written serially.
+        uword_t extra[MAX_GC_THREADS];
+        int i, gen;
+        memset(sweep_tallies, 0, sizeof sweep_tallies);
+        for (i = 0; i < gc_n_threads; ++i)
+            extra[i] = (uword_t)sweep_tallies[i];
+        walk_generation_in_parallel(sweep, -1, extra);
+        for (i = 0; i < gc_n_threads; ++i)
+            for (gen = 0; gen <= PSEUDO_STATIC_GENERATION; ++gen)
+                words_zeroed[gen] += sweep_tallies[i][gen];
+    } else {
+        if (sweeplog) fprintf(sweeplog, "-- dynamic space --\n");
+        walk_generation(sweep, -1, (uword_t)words_zeroed);
+    }
     if (gencgc_verbose) {
         fprintf(stderr, "[Sweep phase: ");
         int i;
@@ -630,17 +901,21 @@ void execute_full_sweep_phase()
             fprintf(stderr, "%ld%s", words_zeroed[i], i?"+":"");
         fprintf(stderr, " words zeroed]\n");
     }
-    hopscotch_destroy(&mark_bits);
+    if (!lazy)
+        release_lazy_sweep_marks();
     if (sweeplog)
         fflush(sweeplog);
 
+    // Huge pages are protected at the end of GC (see protect_huge_pages)
     page_index_t first_page, last_page;
     for (first_page = 0; first_page < next_free_page; ++first_page)
         if (page_table[first_page].write_protected
-            && protection_mode(first_page) == PHYSICAL) {
+            && protection_mode(first_page) == PHYSICAL
+            && !huge_page_card_p(first_page)) {
             last_page = first_page;
             while (page_table[last_page+1].write_protected
-                   && protection_mode(last_page+1) == PHYSICAL)
+                   && protection_mode(last_page+1) == PHYSICAL
+                   && !huge_page_card_p(last_page+1))
                 ++last_page;
             os_protect(page_address(first_page),
                        (last_page - first_page + 1) * GENCGC_CARD_BYTES,
@@ -650,4 +925,5 @@ void execute_full_sweep_phase()
     while (free_page < page_table_pages) {
         page_table[free_page++].type = FREE_PAGE_FLAG;
     }
+    return lazy;
 }
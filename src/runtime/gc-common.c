@@ -51,6 +51,7 @@
 #include "var-io.h"
 #include "search.h"
 #include "murmur_hash.h"
+#include "tracelog.h"
 
 #ifdef LISP_FEATURE_SPARC
 #define LONG_FLOAT_SIZE 4
@@ -1229,12 +1230,15 @@ int finalizer_thread_runflag = 1;
 CRITICAL_SECTION finalizer_mutex;
 CONDITION_VARIABLE finalizer_condvar;
 void finalizer_thread_wait () {
+    trace_begin("finalizer wait", 0);
     EnterCriticalSection(&finalizer_mutex);
     if (finalizer_thread_runflag)
         SleepConditionVariableCS(&finalizer_condvar, &finalizer_mutex, INFINITE);
     LeaveCriticalSection(&finalizer_mutex);
+    trace_end("finalizer wait", 0);
 }
 void finalizer_thread_wake () {
+    trace_instant("finalizer wake", 0);
     WakeAllConditionVariable(&finalizer_condvar);
 }
 void finalizer_thread_stop () {
@@ -1247,12 +1251,15 @@ void finalizer_thread_stop () {
 pthread_mutex_t finalizer_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t finalizer_condvar = PTHREAD_COND_INITIALIZER;
 void finalizer_thread_wait () {
+    trace_begin("finalizer wait", 0);
     thread_mutex_lock(&finalizer_mutex);
     if (finalizer_thread_runflag)
         pthread_cond_wait(&finalizer_condvar, &finalizer_mutex);
     thread_mutex_unlock(&finalizer_mutex);
+    trace_end("finalizer wait", 0);
 }
 void finalizer_thread_wake() {
+    trace_instant("finalizer wake", 0);
     pthread_cond_broadcast(&finalizer_condvar);
 }
 void finalizer_thread_stop() {
@@ -163,4 +163,13 @@ extern lispobj fdefn_callee_lispobj(struct fdefn *fdefn);
 
 boolean valid_widetag_p(unsigned char widetag);
 
+#ifdef LISP_FEATURE_GENCGC
+/* Sampling heap profiler, in sprof.c */
+extern uword_t heap_profile_interval;
+extern void heap_profile_sample(struct thread*, lispobj, uword_t, void*);
+extern void heap_profile_cull(lispobj (*survivor)(lispobj));
+/* In gencgc.c, for coalesce.c to call while saving a core */
+extern void drop_hot_object(lispobj*);
+#endif
+
 #endif /* _GC_INTERNAL_H_ */
@@ -327,13 +327,23 @@ static inline boolean bitmap_logbitp(unsigned int index, struct bitmap bitmap)
 #define OS_VM_PROT_JIT_ALL OS_VM_PROT_ALL
 #endif
 
+extern boolean gc_remset_active;
+extern void gc_log_unprotected_page(page_index_t);
+extern void unprotect_huge_page(page_index_t);
+
 /* This is used bu the fault handler, and potentially during GC */
 static inline void unprotect_page_index(page_index_t page_index)
 {
+    if (huge_page_card_p(page_index)) {
+        unprotect_huge_page(page_index);
+        return;
+    }
     os_protect(page_address(page_index), GENCGC_CARD_BYTES, OS_VM_PROT_JIT_ALL);
     unsigned char *pflagbits = (unsigned char*)&page_table[page_index].gen - 1;
     __sync_fetch_and_or(pflagbits, WP_CLEARED_FLAG);
     __sync_fetch_and_and(pflagbits, ~WRITE_PROTECTED_FLAG);
+    if (gc_remset_active)
+        gc_log_unprotected_page(page_index);
 }
 
 static inline void protect_page(void* page_addr, page_index_t page_index)
@@ -343,7 +353,9 @@ static inline void protect_page(void* page_addr, page_index_t page_index)
       return;
     }
 #endif
-    os_protect((void *)page_addr, GENCGC_CARD_BYTES, OS_VM_PROT_JIT_READ);
+    // Huge pages are protected at the end of GC (see protect_huge_pages)
+    if (!huge_page_card_p(page_index))
+        os_protect((void *)page_addr, GENCGC_CARD_BYTES, OS_VM_PROT_JIT_READ);
 
     /* Note: we never touch the write_protected_cleared bit when protecting
      * a page. Consider two random threads that reach their SIGSEGV handlers
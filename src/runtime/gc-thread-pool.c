@@ -0,0 +1,224 @@
+/*
+ * A pool of helper threads for the garbage collector
+ */
+
+/*
+ * This software is part of the SBCL system. See the README file for
+ * more information.
+ *
+ * This software is derived from the CMU CL system, which was
+ * written at Carnegie Mellon University and released into the
+ * public domain. The software is in the public domain and is
+ * provided with absolutely no warranty. See the COPYING and CREDITS
+ * files for more information.
+ */
+
+/* The helpers are not Lisp threads: they have no 'struct thread', never
+ * touch Lisp TLS, and run with all blockable signals blocked. They sleep
+ * on a condition variable until the thread performing GC hands out a job,
+ * and the caller of gc_run_on_thread_pool() participates as worker 0,
+ * returning only after every helper has finished.
+ *
+ * Helpers are created at startup rather than on demand, because GC can be
+ * entered while some other (stopped) thread holds a libc lock which
+ * pthread_create() would need. A forked child inherits none of the helpers,
+ * and collects serially until gc_thread_pool_after_fork() recreates them.
+ * SB-POSIX:FORK calls that in the child before any other thread can exist;
+ * the children of RUN-PROGRAM exec without ever needing the helpers.
+ *
+ * Helper 1 can also take a background job, which keeps running after the
+ * world is restarted. A new job waits until the background job is over,
+ * so whoever posted it should arrange for it to end promptly. */
+
+#include <stdio.h>
+#include <string.h>
+#include "sbcl.h"
+#include "runtime.h"
+#include "os.h"
+#include "interr.h"
+#include "gc-thread-pool.h"
+
+int gc_n_threads = 1;
+
+#if defined LISP_FEATURE_SB_THREAD && !defined LISP_FEATURE_WIN32
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_finish = PTHREAD_COND_INITIALIZER;
+static int n_helpers;          // helpers which exist in this process
+static unsigned int job_serial; // incremented once per job
+static unsigned int start_serial; // value of job_serial when helpers were made
+static int n_busy;             // helpers which have not finished the current job
+static gc_pool_action job_action;
+static void* job_arg;
+static gc_pool_action background_action; // nonzero until the job finishes
+static void* background_arg;
+static int background_running;
+
+static void* gc_helper_main(void* arg)
+{
+    int index = (int)(uword_t)arg;
+    unsigned int seen = start_serial;
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        while (job_serial == seen
+               && !(index == 1 && background_action && !background_running))
+            pthread_cond_wait(&pool_start, &pool_lock);
+        if (job_serial == seen) {
+            gc_pool_action action = background_action;
+            void* action_arg = background_arg;
+            background_running = 1;
+            pthread_mutex_unlock(&pool_lock);
+            action(0, 1, action_arg);
+            pthread_mutex_lock(&pool_lock);
+            background_action = 0;
+            background_running = 0;
+            pthread_cond_broadcast(&pool_finish);
+            continue;
+        }
+        seen = job_serial;
+        gc_pool_action action = job_action;
+        void* action_arg = job_arg;
+        int n_workers = 1 + n_helpers;
+        pthread_mutex_unlock(&pool_lock);
+        action(index, n_workers, action_arg);
+        pthread_mutex_lock(&pool_lock);
+        if (--n_busy == 0)
+            pthread_cond_broadcast(&pool_finish);
+    }
+    return 0;
+}
+
+static int helpers_wanted;
+
+static void start_helpers()
+{
+    int n = helpers_wanted, i;
+    if (n <= 0) return;
+    sigset_t all, saved;
+    sigfillset(&all);
+    // Helpers inherit the creator's signal mask.
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    start_serial = job_serial;
+    for (i = 1; i <= n; ++i) {
+        pthread_t tid;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int err = pthread_create(&tid, &attr, gc_helper_main, (void*)(uword_t)i);
+        pthread_attr_destroy(&attr);
+        if (err) {
+            fprintf(stderr, "GC helper thread creation failed: %s\n", strerror(err));
+            break;
+        }
+        ++n_helpers;
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, 0);
+    gc_n_threads = 1 + n_helpers;
+}
+
+static void forget_helpers_in_child()
+{
+    pthread_mutex_init(&pool_lock, 0);
+    pthread_cond_init(&pool_start, 0);
+    pthread_cond_init(&pool_finish, 0);
+    n_helpers = n_busy = 0;
+    background_action = 0;
+    background_running = 0;
+    gc_n_threads = 1;
+}
+
+void gc_thread_pool_after_fork()
+{
+    if (helpers_wanted && !n_helpers) start_helpers();
+}
+
+void gc_thread_pool_init()
+{
+    if (gc_n_threads > MAX_GC_THREADS) gc_n_threads = MAX_GC_THREADS;
+    if (gc_n_threads <= 1) return;
+    helpers_wanted = gc_n_threads - 1;
+    pthread_atfork(0, 0, forget_helpers_in_child);
+    start_helpers();
+}
+
+void gc_run_on_thread_pool(gc_pool_action action, void* arg)
+{
+    if (!n_helpers) {
+        action(0, 1, arg);
+        return;
+    }
+    pthread_mutex_lock(&pool_lock);
+    while (background_action)
+        pthread_cond_wait(&pool_finish, &pool_lock);
+    job_action = action;
+    job_arg = arg;
+    n_busy = n_helpers;
+    ++job_serial;
+    pthread_cond_broadcast(&pool_start);
+    pthread_mutex_unlock(&pool_lock);
+    action(0, 1 + n_helpers, arg);
+    pthread_mutex_lock(&pool_lock);
+    while (n_busy)
+        pthread_cond_wait(&pool_finish, &pool_lock);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+int gc_run_on_idle_thread_pool(gc_pool_action action, void* arg)
+{
+    if (!n_helpers) return 0;
+    // The caller ensures that no background job is posted concurrently
+    pthread_mutex_lock(&pool_lock);
+    int busy = background_action != 0;
+    pthread_mutex_unlock(&pool_lock);
+    if (busy) return 0;
+    gc_run_on_thread_pool(action, arg);
+    return 1;
+}
+
+int gc_run_in_background(gc_pool_action action, void* arg)
+{
+    if (!n_helpers) return 0;
+    pthread_mutex_lock(&pool_lock);
+    while (background_action)
+        pthread_cond_wait(&pool_finish, &pool_lock);
+    background_action = action;
+    background_arg = arg;
+    pthread_cond_broadcast(&pool_start);
+    pthread_mutex_unlock(&pool_lock);
+    return 1;
+}
+
+void gc_wait_for_background()
+{
+    if (!n_helpers) return;
+    pthread_mutex_lock(&pool_lock);
+    while (background_action)
+        pthread_cond_wait(&pool_finish, &pool_lock);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+#else
+
+void gc_thread_pool_init() { gc_n_threads = 1; }
+void gc_thread_pool_after_fork() { }
+void gc_run_on_thread_pool(gc_pool_action action, void* arg)
+{
+    action(0, 1, arg);
+}
+int gc_run_on_idle_thread_pool(gc_pool_action __attribute__((unused)) action,
+                               void __attribute__((unused)) *arg)
+{
+    return 0;
+}
+int gc_run_in_background(gc_pool_action __attribute__((unused)) action,
+                         void __attribute__((unused)) *arg)
+{
+    return 0;
+}
+void gc_wait_for_background() { }
+
+#endif
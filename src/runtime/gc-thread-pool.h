@@ -0,0 +1,42 @@
+/*
+ * This software is part of the SBCL system. See the README file for
+ * more information.
+ *
+ * This software is derived from the CMU CL system, which was
+ * written at Carnegie Mellon University and released into the
+ * public domain. The software is in the public domain and is
+ * provided with absolutely no warranty. See the COPYING and CREDITS
+ * files for more information.
+ */
+
+#ifndef _GC_THREAD_POOL_H_
+#define _GC_THREAD_POOL_H_
+
+/* Total number of threads which perform parallelizable GC work,
+ * including the thread which invoked GC. 1 means "do everything serially".
+ * Set by the --gc-threads runtime option. */
+extern int gc_n_threads;
+#define MAX_GC_THREADS 256
+
+/* An action receives its own index in [0, n_workers) and the argument
+ * that was passed to gc_run_on_thread_pool(). Index 0 is always the
+ * calling thread. */
+typedef void (*gc_pool_action)(int worker, int n_workers, void* arg);
+
+extern void gc_thread_pool_init(void);
+/* Recreate the helpers in the child of fork(), which has none. Must be
+ * called before the child starts any thread of its own */
+extern void gc_thread_pool_after_fork(void);
+extern void gc_run_on_thread_pool(gc_pool_action action, void* arg);
+/* Like gc_run_on_thread_pool(), but rather than wait for a background job
+ * to finish, return 0 without running 'action'. Also returns 0 if there are
+ * no helpers. */
+extern int gc_run_on_idle_thread_pool(gc_pool_action action, void* arg);
+
+/* Run 'action' as the only worker on a helper thread, and return without
+ * waiting for it to finish. Returns 0 if there is no helper to run it.
+ * At most one background job exists at a time. */
+extern int gc_run_in_background(gc_pool_action action, void* arg);
+extern void gc_wait_for_background(void);
+
+#endif /* _GC_THREAD_POOL_H_ */
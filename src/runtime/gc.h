@@ -38,5 +38,9 @@ extern boolean gc_active_p;
 extern int sb_sprof_enabled;
 
 extern os_vm_size_t bytes_consed_between_gcs;
+extern int gencgc_huge_pages;
+extern os_vm_size_t gencgc_rss_target;
+extern int gencgc_numa;
+extern int gc_lazy_sweep;
 
 #endif /* _GC_H_ */
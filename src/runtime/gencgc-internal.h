@@ -147,10 +147,26 @@ struct __attribute__((packed)) corefile_pte {
 
 extern page_index_t page_table_pages;
 
+/* Pages of constants from a core saved with :READ-ONLY-CONSTANTS */
+extern page_index_t readonly_core_page_start, readonly_core_page_end;
+static inline boolean readonly_core_page_p(page_index_t page) {
+    return page >= readonly_core_page_start && page < readonly_core_page_end;
+}
+
+/* With huge pages, the cards from 'huge_page_first_card' on are physically
+ * protected and unprotected only a whole huge page at a time */
+extern page_index_t huge_page_first_card;
+extern int cards_per_huge_page;
+static inline boolean huge_page_card_p(page_index_t page) {
+    return cards_per_huge_page && page >= huge_page_first_card;
+}
+
 
 /* forward declarations */
 
 void update_dynamic_space_free_pointer(void);
+struct thread;
+void gc_flush_remset_buffer(struct thread*);
 void gc_close_region(struct alloc_region *alloc_region, int page_type_flag);
 static inline void ensure_region_closed(struct alloc_region *alloc_region,
                                         int page_type_flag)
@@ -272,6 +288,13 @@ extern page_index_t next_free_page;
 extern uword_t
 walk_generation(uword_t (*proc)(lispobj*,lispobj*,uword_t),
                 generation_index_t generation, uword_t extra);
+extern void
+walk_generation_in_parallel(uword_t (*proc)(lispobj*,lispobj*,uword_t),
+                            generation_index_t generation, uword_t* extra);
+extern page_index_t walk_generation_n_chunks(void);
+extern void
+walk_generation_by_chunks(uword_t (*proc)(lispobj*,lispobj*,uword_t),
+                          generation_index_t generation, uword_t* extra);
 
 generation_index_t gc_gen_of(lispobj obj, int defaultval);
 
@@ -27,6 +27,8 @@
 #include <errno.h>
 #include <string.h>
 #include <inttypes.h>
+#include <time.h>
+#include <fcntl.h>
 #include "sbcl.h"
 #ifndef LISP_FEATURE_WIN32
 #include <signal.h>
@@ -59,11 +61,19 @@
 #include "hopscotch.h"
 #include "genesis/cons.h"
 #include "forwarding-ptr.h"
+#include "gc-thread-pool.h"
+#include "lazy-core.h"
+#include "tracelog.h"
 #include "lispregs.h"
 
 /* forward declarations */
 page_index_t  gc_find_freeish_pages(page_index_t *restart_page_ptr, sword_t nbytes,
-                                    int page_type_flag, generation_index_t gen);
+                                    sword_t extend_to, int page_type_flag,
+                                    generation_index_t gen);
+static page_index_t find_freeish_pages_below(page_index_t limit, page_index_t *restart_page_ptr,
+                                             sword_t nbytes, sword_t extend_to,
+                                             int page_type_flag, generation_index_t gen,
+                                             sword_t *most_bytes_found_ptr);
 
 
 /*
@@ -328,6 +338,11 @@ struct generation {
      * prevent a GC when a large number of new live objects have been
      * added, in which case a GC could be a waste of time */
     double minimum_age_before_gc;
+
+    /* the bytes of dead objects which the most recent non-moving collection
+     * erased in this generation. That space is still counted in
+     * bytes_allocated until a copying collection of the generation. */
+    os_vm_size_t swept_bytes;
 };
 
 /* an array of generation structures. There needs to be one more
@@ -335,6 +350,34 @@ struct generation {
  * generation is temporarily raised then lowered. */
 struct generation generations[NUM_GENERATIONS];
 
+/* A record of one invocation of collect_garbage(). The phases of a copying
+ * collection are: pinning of ambiguous roots, scavenging of other roots,
+ * scavenging of newspace, weak object processing, and freeing of oldspace.
+ * A mark-only collection counts its transitive mark as 'newspace' and its
+ * sweep as 'free'.
+ * This has to match the alien type GC-EVENT in src/code/gc.lisp */
+struct gc_event {
+    uint64_t serial;          // 1 for the first collection in this process
+    uint64_t gen;             // highest generation collected, 7 if mark-only
+    uint64_t stw_ns;          // time to stop the world, or 0 if not measured
+    uint64_t threads_stopped; // by gc_stop_the_world(), when it measures stw_ns
+    uint64_t gc_ns;           // time spent in collect_garbage()
+    uint64_t pin_ns, roots_ns, newspace_ns, weak_ns, free_ns;
+    uint64_t root_pages;      // pages of older generations scavenged as roots
+    uint64_t bytes_copied;    // not counting pages or large objects promoted
+    uint64_t objects_pinned;
+};
+/* The last GC_EVENT_LOG_SIZE collections, the newest one being at index
+ * (gc_event_count-1) % GC_EVENT_LOG_SIZE. GC-EVENTS in Lisp has the same
+ * constant. */
+#define GC_EVENT_LOG_SIZE 128
+struct gc_event gc_event_log[GC_EVENT_LOG_SIZE];
+uint64_t gc_event_count;
+static struct gc_event gc_event_sum; // every field summed over all collections
+static struct gc_event *current_gc_event;
+static uint64_t stw_ns_for_next_gc_event, threads_stopped_for_next_gc_event;
+static os_vm_size_t bytes_promoted_in_place;
+
 /* the oldest generation that is will currently be GCed by default.
  * Valid values are: 0, 1, ... HIGHEST_NORMAL_GENERATION
  *
@@ -370,12 +413,34 @@ static pthread_mutex_t free_pages_lock = PTHREAD_MUTEX_INITIALIZER;
 #endif
 #endif
 
+/* If nonzero, a mark-only collection restarts the world without sweeping
+ * dynamic space. Set by --gc-lazy-sweep. See start_lazy_sweep() */
+int gc_lazy_sweep = 0;
+static boolean lazy_sweep_active;
+
+/* If nonzero, collecting the oldest normal generation without raising it
+ * copies only the live objects of sparsely used blocks.
+ * See retain_dense_blocks() */
+int gencgc_mark_region = 0;
+/* A block is sparse if at least this percentage of its lines are free */
+int gencgc_sparse_block_percent = 50;
+#define MARK_REGION_LINE_BYTES 256
+static boolean mark_region_prepass;
+static void ensure_block_swept(page_index_t page);
+
 extern os_vm_size_t gencgc_release_granularity;
 os_vm_size_t gencgc_release_granularity = GENCGC_RELEASE_GRANULARITY;
 
 extern os_vm_size_t gencgc_alloc_granularity;
 os_vm_size_t gencgc_alloc_granularity = GENCGC_ALLOC_GRANULARITY;
 
+/* If nonzero, the part of dynamic space not mapped from the core, and
+ * code space, are backed by transparent huge pages if the OS allows.
+ * See gc_enable_huge_pages() */
+int gencgc_huge_pages = 0;
+page_index_t huge_page_first_card;
+int cards_per_huge_page;
+
 
 /*
  * miscellaneous heap functions
@@ -555,11 +620,14 @@ print_generation_stats(void)
 
 extern char* gc_logfile;
 char * gc_logfile = NULL;
+/* 0 to log generation tables as text before and after each collection,
+ * 1 to log one JSON object per collection, from its gc_event */
+int gc_logfile_format = 0;
 
 extern void
 log_generation_stats(char *logfile, char *header)
 {
-    if (logfile) {
+    if (logfile && !gc_logfile_format) {
         FILE * log = fopen(logfile, "a");
         if (log) {
             fprintf(log, "%s\n", header);
@@ -572,10 +640,182 @@ log_generation_stats(char *logfile, char *header)
     }
 }
 
+static uint64_t gc_clock_ns()
+{
+#ifdef LISP_FEATURE_UNIX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+/* Called by gc_stop_the_world() when it measures its own duration */
+void gc_note_stw_time(uint64_t ns, int n_threads)
+{
+    stw_ns_for_next_gc_event = ns;
+    threads_stopped_for_next_gc_event = n_threads;
+}
+
+/* Averages over all collections, for the summary printed at exit */
+void write_gc_event_summary(FILE *file)
+{
+    uint64_t n = gc_event_count;
+    if (n)
+        fprintf(file, "GC: average root-pages=%"PRIu64" copied=%"PRIu64
+                " bytes pinned=%"PRIu64" objects threads-stopped=%"PRIu64"\n",
+                gc_event_sum.root_pages / n, gc_event_sum.bytes_copied / n,
+                gc_event_sum.objects_pinned / n, gc_event_sum.threads_stopped / n);
+}
+
+/* Pause-time goal. When gc_max_pause_ns is nonzero, the nursery size and
+ * whether to collect an older generation are decided from a model of the
+ * previous collections:
+ *   pause = overhead + bytes copied / copy rate
+ * where the copy rate is measured over the roots and newspace phases, and
+ * the overhead is everything else, including the time to stop the world.
+ * bytes_consed_between_gcs remains the largest nursery size used. */
+uint64_t gc_max_pause_ns;
+static struct {
+    double copy_rate;        // bytes per nanosecond, 0 until measured
+    double overhead_ns;
+    double nursery_survival; // fraction of generation 0 copied by its GC
+} pause_model;
+/* Bytes left in generation 0 by the previous GC, which the next one copies
+ * again unless it promotes them */
+static os_vm_size_t nursery_retained;
+/* Consecutive GCs that left a generation uncollected to meet the goal.
+ * Collection of a generation is never put off more than this many times,
+ * nor when less than a quarter of the heap is free. */
+static unsigned char gcs_deferred[NUM_GENERATIONS];
+#define MAX_PAUSE_DEFERRALS 8
+
+/* Fold the measurements of the GC just done into the model. Estimates are
+ * exponentially decaying averages, weighting the newest sample by 1/4 */
+static void update_pause_model(struct gc_event *ev, uint64_t pause_ns,
+                               os_vm_size_t nursery_bytes)
+{
+    uint64_t copy_ns = ev->roots_ns + ev->newspace_ns;
+    if (!copy_ns) return; // no clock
+#define BLEND(old, sample) ((old) ? ((old)*3 + (sample))/4 : (sample))
+    // Too little copying makes for a meaningless rate
+    if (ev->bytes_copied >= 64*1024)
+        pause_model.copy_rate = BLEND(pause_model.copy_rate,
+                                      (double)ev->bytes_copied / copy_ns);
+    pause_model.overhead_ns = BLEND(pause_model.overhead_ns,
+                                    (double)(pause_ns > copy_ns ? pause_ns - copy_ns : 0));
+    if (ev->gen == 0 && nursery_bytes) {
+        double survival = (double)ev->bytes_copied / nursery_bytes;
+        pause_model.nursery_survival = BLEND(pause_model.nursery_survival,
+                                             survival < 1.0 ? survival : 1.0);
+    }
+#undef BLEND
+}
+
+/* The number of bytes to allocate before the next GC */
+static os_vm_size_t nursery_size()
+{
+    os_vm_size_t limit = bytes_consed_between_gcs;
+    if (!gc_max_pause_ns || !pause_model.copy_rate)
+        return limit;
+    double budget = gc_max_pause_ns - pause_model.overhead_ns
+        - nursery_retained / pause_model.copy_rate;
+    double survival = pause_model.nursery_survival > 0.01
+        ? pause_model.nursery_survival : 0.01;
+    double size = budget > 0 ? budget * pause_model.copy_rate / survival : 0;
+    os_vm_size_t least = 1024*1024 < limit ? 1024*1024 : limit;
+    return size < least ? least : size > limit ? limit : (os_vm_size_t)size;
+}
+
+/* Each thread's allocation region size is chosen at every GC so that if the
+ * thread kept allocating at the rate it did since the previous GC, it would
+ * claim a new region about ALLOC_REGION_REFILLS times per nursery. The rate
+ * is an exponentially decaying average. Threads which allocate little get
+ * the smallest regions, which can be taken from the tail of a partly used
+ * page, and no region exceeds gencgc_max_region_bytes. Setting that to 0
+ * gives every thread the smallest regions. */
+#define ALLOC_REGION_REFILLS 50
+os_vm_size_t gencgc_max_region_bytes = 64*GENCGC_CARD_BYTES;
+
+static void resize_alloc_region(struct thread *th)
+{
+    os_vm_size_t goal = (3*th->alloc_region_goal
+                         + th->alloc_epoch_bytes / ALLOC_REGION_REFILLS) / 4;
+    os_vm_size_t limit = nursery_size() / ALLOC_REGION_REFILLS;
+    if (limit > gencgc_max_region_bytes)
+        limit = gencgc_max_region_bytes;
+    th->alloc_region_goal = goal < limit ? goal : limit;
+    th->alloc_epoch_bytes = 0;
+}
+
+/* Whether to promote generation 0 early, because copying its survivors yet
+ * again would use up more than half of the pause goal */
+static boolean pause_goal_wants_promotion()
+{
+    return gc_max_pause_ns && pause_model.copy_rate
+        && nursery_retained / pause_model.copy_rate > gc_max_pause_ns / 2;
+}
+
+/* Whether 'gen', which is due for collection, can be collected in a GC that
+ * has already taken 'elapsed_ns'. Every live object is assumed to be copied. */
+static boolean pause_goal_permits(generation_index_t gen, uint64_t elapsed_ns)
+{
+    if (!gc_max_pause_ns || !pause_model.copy_rate
+        || gcs_deferred[gen] >= MAX_PAUSE_DEFERRALS
+        || dynamic_space_size - bytes_allocated < dynamic_space_size / 4
+        || elapsed_ns + generations[gen].bytes_allocated / pause_model.copy_rate
+           <= gc_max_pause_ns)
+        return 1;
+    ++gcs_deferred[gen];
+    return 0;
+}
+
+static void write_gc_event_json(FILE *file, struct gc_event *ev)
+{
+    fprintf(file, "{\"gc\":%"PRIu64",\"gen\":%"PRIu64
+            ",\"stw_ns\":%"PRIu64",\"threads_stopped\":%"PRIu64",\"gc_ns\":%"PRIu64
+            ",\"pin_ns\":%"PRIu64",\"roots_ns\":%"PRIu64",\"newspace_ns\":%"PRIu64
+            ",\"weak_ns\":%"PRIu64",\"free_ns\":%"PRIu64
+            ",\"root_pages\":%"PRIu64",\"bytes_copied\":%"PRIu64
+            ",\"objects_pinned\":%"PRIu64",\"generations\":[",
+            ev->serial, ev->gen, ev->stw_ns, ev->threads_stopped, ev->gc_ns,
+            ev->pin_ns, ev->roots_ns, ev->newspace_ns, ev->weak_ns, ev->free_ns,
+            ev->root_pages, ev->bytes_copied, ev->objects_pinned);
+    generation_index_t i;
+    for (i = 0; i <= PSEUDO_STATIC_GENERATION; ++i)
+        fprintf(file, "%s{\"bytes_allocated\":%"OS_VM_SIZE_FMT",\"num_gc\":%d}",
+                i ? "," : "", (uintptr_t)generations[i].bytes_allocated,
+                generations[i].num_gc);
+    fprintf(file, "],\"bytes_allocated\":%"OS_VM_SIZE_FMT"}\n",
+            (uintptr_t)bytes_allocated);
+}
+
+static void log_gc_event(char *logfile, struct gc_event *ev)
+{
+    if (logfile && gc_logfile_format) {
+        FILE * log = fopen(logfile, "a");
+        if (log) {
+            write_gc_event_json(log, ev);
+            fclose(log);
+        } else {
+            fprintf(stderr, "Could not open gc logfile: %s\n", logfile);
+            fflush(stderr);
+        }
+    }
+}
+
 extern void
 report_heap_exhaustion(long available, long requested, struct thread *th)
 {
-    if (gc_logfile) {
+    if (gc_logfile && gc_logfile_format) {
+        FILE * log = fopen(gc_logfile, "a");
+        if (log) {
+            fprintf(log, "{\"heap_exhausted\":{\"available\":%ld,\"requested\":%ld}}\n",
+                    available, requested);
+            fclose(log);
+        }
+    } else if (gc_logfile) {
         FILE * log = fopen(gc_logfile, "a");
         if (log) {
             write_heap_exhaustion_report(log, available, requested, th);
@@ -613,6 +853,13 @@ zero_range_with_mmap(os_vm_address_t addr, os_vm_size_t length) {
     // In practice this should not happen because objects from a core file can't
     // become garbage. Except in save-lisp-and-die they can, and we must be
     // cautious not to resurrect bytes that originally came from the file.
+    if (addr < anon_dynamic_space_start && addr + length > anon_dynamic_space_start) {
+        // Remapping the anonymous part would lose its huge page advice
+        os_vm_size_t head = anon_dynamic_space_start - addr;
+        zero_range_with_mmap(addr, head);
+        zero_range_with_mmap(anon_dynamic_space_start, length - head);
+        return;
+    }
     if ((os_vm_address_t)addr >= anon_dynamic_space_start) {
         if (madvise(addr, length, MADV_DONTNEED) != 0)
             lose("madvise failed");
@@ -855,7 +1102,87 @@ static page_index_t
         alloc_start_pages[0] = gencgc_alloc_start_page; \
         alloc_start_pages[1] = gencgc_alloc_start_page; \
         alloc_start_pages[2] = gencgc_alloc_start_page; \
-        alloc_start_pages[3] = gencgc_alloc_start_page
+        alloc_start_pages[3] = gencgc_alloc_start_page; \
+        reset_numa_alloc_start_pages()
+
+/* If nonzero, dynamic space is divided into one range of pages per NUMA
+ * node, each preferring memory of its node, and a new region for Lisp (as
+ * opposed to GC) is looked for in the range of the node which the thread
+ * runs on before anywhere else. With SBCL_FAKE_NUMA_NODES=<n> in the
+ * environment, there are n nodes, and a thread's node is its kernel thread
+ * id modulo n, so that all of this can be tested on a single node */
+int gencgc_numa = 0;
+#define MAX_NUMA_NODES 64
+static struct {
+    int n_nodes; // 0 unless enabled
+    boolean fake;
+    page_index_t alloc_start[MAX_NUMA_NODES][4];
+} numa;
+
+static inline page_index_t numa_node_first_page(int node)
+{
+    return node * page_table_pages / numa.n_nodes;
+}
+
+static void reset_numa_alloc_start_pages()
+{
+    int node, i;
+    for (node = 0; node < numa.n_nodes; ++node)
+        for (i = 0; i < 4; ++i)
+            numa.alloc_start[node][i] = numa_node_first_page(node);
+}
+
+/* Divide dynamic space among the NUMA nodes */
+static void gc_init_numa()
+{
+    int n_nodes = 0, node;
+    char *fake = getenv("SBCL_FAKE_NUMA_NODES");
+    if (fake) {
+        n_nodes = atoi(fake);
+        numa.fake = 1;
+    } else {
+#ifdef LISP_FEATURE_LINUX
+        // A list such as "0-1" or "0,2-3", of which the last is the highest
+        FILE *file = fopen("/sys/devices/system/node/possible", "r");
+        char separator;
+        if (file) {
+            while (fscanf(file, "%d%c", &node, &separator) >= 1)
+                n_nodes = node + 1;
+            fclose(file);
+        }
+#endif
+    }
+    if (n_nodes < 2)
+        return; // nothing to do
+    numa.n_nodes = n_nodes > MAX_NUMA_NODES ? MAX_NUMA_NODES : n_nodes;
+    reset_numa_alloc_start_pages();
+#ifdef LISP_FEATURE_LINUX
+    if (!numa.fake)
+        for (node = 0; node < numa.n_nodes; ++node) {
+            page_index_t end = node + 1 < numa.n_nodes
+                ? numa_node_first_page(node + 1) : page_table_pages;
+            char *start = page_address(numa_node_first_page(node));
+            if (os_numa_prefer_node(start, page_address(end) - start, node)) {
+                fprintf(stderr, "WARNING: can't bind dynamic space to NUMA nodes\n");
+                break;
+            }
+        }
+#endif
+}
+
+static int numa_current_node()
+{
+#ifdef LISP_FEATURE_LINUX
+    if (numa.fake) {
+        struct thread *th = get_sb_vm_thread();
+        return th ? (int)((uword_t)th->os_kernel_tid % numa.n_nodes) : 0;
+    }
+    unsigned int cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, 0) == 0 && node < (unsigned)numa.n_nodes)
+        return node;
+#endif
+    return 0;
+}
 
 static inline page_index_t
 alloc_start_page(int page_type_flag, int large)
@@ -906,7 +1233,8 @@ static inline boolean region_closed_p(struct alloc_region* region) {
  * are allocated, although they will initially be empty.
  */
 static void
-gc_alloc_new_region(sword_t nbytes, int page_type_flag, struct alloc_region *alloc_region)
+gc_alloc_new_region(sword_t nbytes, sword_t goal,
+                    int page_type_flag, struct alloc_region *alloc_region)
 {
     page_index_t first_page;
     page_index_t last_page;
@@ -923,11 +1251,26 @@ gc_alloc_new_region(sword_t nbytes, int page_type_flag, struct alloc_region *all
     gc_assert(region_closed_p(alloc_region));
     ret = thread_mutex_lock(&free_pages_lock);
     gc_assert(ret == 0);
-    first_page = alloc_start_page(page_type_flag, 0);
-    last_page = gc_find_freeish_pages(&first_page, nbytes,
-                                      ((nbytes >= (sword_t)GENCGC_CARD_BYTES) ?
-                                       SINGLE_OBJECT_FLAG : 0) | page_type_flag,
-                                      gc_alloc_generation);
+    int flags = ((nbytes >= (sword_t)GENCGC_CARD_BYTES) ? SINGLE_OBJECT_FLAG : 0)
+                | page_type_flag;
+    last_page = -1;
+    if (numa.n_nodes && !gc_active_p) {
+        int node = numa_current_node();
+        sword_t most_bytes_found;
+        first_page = numa.alloc_start[node][page_type_flag];
+        last_page = find_freeish_pages_below(node + 1 < numa.n_nodes
+                                             ? numa_node_first_page(node + 1)
+                                             : page_table_pages,
+                                             &first_page, nbytes, goal, flags,
+                                             gc_alloc_generation, &most_bytes_found);
+        if (last_page >= 0)
+            numa.alloc_start[node][page_type_flag] = first_page;
+    }
+    if (last_page < 0) {
+        first_page = alloc_start_page(page_type_flag, 0);
+        last_page = gc_find_freeish_pages(&first_page, nbytes, goal, flags,
+                                          gc_alloc_generation);
+    }
 
     /* Set up the alloc_region. */
     alloc_region->last_page = last_page;
@@ -1193,7 +1536,7 @@ gc_alloc_large(sword_t nbytes, int page_type_flag, struct alloc_region *alloc_re
         first_page = alloc_region->last_page+1;
     }
 
-    last_page = gc_find_freeish_pages(&first_page, nbytes,
+    last_page = gc_find_freeish_pages(&first_page, nbytes, 0,
                                       SINGLE_OBJECT_FLAG | page_type_flag,
                                       gc_alloc_generation);
 
@@ -1342,13 +1685,20 @@ page_extensible_p(page_index_t index, generation_index_t gen, int allocated) {
 
 /* Search for at least nbytes of space, possibly picking up any
  * remaining space on the tail of a page that was not fully used.
+ * The space found is extended over free pages, if there are any, until
+ * it is at least 'extend_to' bytes long, but no further search is made
+ * for a range that long.
  *
  * The found space is guaranteed to be page-aligned if the SINGLE_OBJECT_FLAG
  * bit is set in page_type_flag.
+ *
+ * Only pages below 'limit' are considered. If there isn't enough space,
+ * return -1 and store the most that was found in '*most_bytes_found_ptr'.
  */
-page_index_t
-gc_find_freeish_pages(page_index_t *restart_page_ptr, sword_t nbytes,
-                      int page_type_flag, generation_index_t gen)
+static page_index_t
+find_freeish_pages_below(page_index_t limit, page_index_t *restart_page_ptr,
+                         sword_t nbytes, sword_t extend_to, int page_type_flag,
+                         generation_index_t gen, sword_t *most_bytes_found_ptr)
 {
     page_index_t most_bytes_found_from = 0, most_bytes_found_to = 0;
     page_index_t first_page, last_page, restart_page = *restart_page_ptr;
@@ -1367,11 +1717,13 @@ gc_find_freeish_pages(page_index_t *restart_page_ptr, sword_t nbytes,
             nbytes_goal = 65536;
 #endif
     }
+    if (extend_to < nbytes_goal || !multi_object)
+        extend_to = nbytes_goal;
     page_type_flag &= ~SINGLE_OBJECT_FLAG;
 
     gc_assert(nbytes>=0);
     first_page = restart_page;
-    while (first_page < page_table_pages) {
+    while (first_page < limit) {
         bytes_found = 0;
         if (page_free_p(first_page)) {
             gc_dcheck(!page_bytes_used(first_page));
@@ -1400,8 +1752,8 @@ gc_find_freeish_pages(page_index_t *restart_page_ptr, sword_t nbytes,
         /* page_free_p() can legally be used at index 'page_table_pages'
          * because the array dimension is 1+page_table_pages */
         for (last_page = first_page+1;
-             bytes_found < nbytes_goal &&
-               page_free_p(last_page) && last_page < page_table_pages;
+             bytes_found < extend_to &&
+               page_free_p(last_page) && last_page < limit;
              last_page++) {
             /* page_free_p() implies 0 bytes used, thus GENCGC_CARD_BYTES available.
              * It also implies !write_protected, and if the OS's conception were
@@ -1427,11 +1779,19 @@ gc_find_freeish_pages(page_index_t *restart_page_ptr, sword_t nbytes,
 
     /* Check for a failure */
     if (bytes_found < nbytes) {
-        gc_assert(restart_page >= page_table_pages);
-        gc_heap_exhausted_error_or_lose(most_bytes_found, nbytes);
+        gc_assert(restart_page >= limit);
+        *most_bytes_found_ptr = most_bytes_found;
+        return -1;
     }
 
     gc_assert(most_bytes_found_to);
+    // A page in use may hold garbage which nobody swept yet. Only the first
+    // page of the range can be in use, the others being free.
+    if (lazy_sweep_active) {
+        page_index_t page;
+        for (page = most_bytes_found_from; page < most_bytes_found_to; ++page)
+            if (page_bytes_used(page)) ensure_block_swept(page);
+    }
     // most_bytes_found_to is the upper exclusive bound on the found range.
     // next_free_page is the high water mark of most_bytes_found_to.
     if (most_bytes_found_to > next_free_page) {
@@ -1442,6 +1802,19 @@ gc_find_freeish_pages(page_index_t *restart_page_ptr, sword_t nbytes,
     return most_bytes_found_to-1;
 }
 
+page_index_t
+gc_find_freeish_pages(page_index_t *restart_page_ptr, sword_t nbytes,
+                      sword_t extend_to, int page_type_flag, generation_index_t gen)
+{
+    sword_t most_bytes_found;
+    page_index_t last_page =
+        find_freeish_pages_below(page_table_pages, restart_page_ptr, nbytes, extend_to,
+                                 page_type_flag, gen, &most_bytes_found);
+    if (last_page < 0)
+        gc_heap_exhausted_error_or_lose(most_bytes_found, nbytes);
+    return last_page;
+}
+
 /* Allocate bytes.  All the rest of the special-purpose allocation
  * functions will eventually call this.
  * This entry point is only for use within the GC itself.
@@ -1472,7 +1845,7 @@ gc_alloc_with_region(struct alloc_region *region, sword_t nbytes, int page_type_
     /* Else not enough free space in the current region: retry with a
      * new region. */
     ensure_region_closed(region, page_type_flag);
-    gc_alloc_new_region(nbytes, page_type_flag, region);
+    gc_alloc_new_region(nbytes, 0, page_type_flag, region);
     new_obj = region->free_pointer;
     new_free_pointer = (char*)new_obj + nbytes;
     gc_assert(new_free_pointer <= region->end_addr);
@@ -1648,6 +2021,7 @@ copy_large_object(lispobj object, sword_t nwords, int page_type_flag)
         generations[from_space].bytes_allocated -= (bytes_freed + nbytes);
         generations[new_space].bytes_allocated += nbytes;
         bytes_allocated -= bytes_freed;
+        bytes_promoted_in_place += nbytes;
 
         /* Add the region to the new_areas if requested. */
         if (page_type_flag & BOXED_PAGE_FLAG)
@@ -2320,15 +2694,10 @@ static void __attribute__((unused)) pin_exact_root(lispobj obj)
  * See 'doc/internals-notes/fdefn-gc-safety' for execution schedules
  * that lead to invariant loss.
  */
+static int page_points_to_younger_p(page_index_t page);
 static int
 update_page_write_prot(page_index_t page)
 {
-    generation_index_t gen = page_table[page].gen;
-    sword_t j;
-    int wp_it = 1;
-    lispobj *page_addr = (lispobj*)page_address(page);
-    sword_t num_words = page_bytes_used(page) / N_WORD_BYTES;
-
     /* Shouldn't be a free page. */
     gc_dcheck(!page_free_p(page)); // Implied by the next assertion
     gc_assert(page_bytes_used(page) != 0);
@@ -2349,8 +2718,24 @@ update_page_write_prot(page_index_t page)
         page_table[page].pinned)
         return (0);
 
-    /* Scan the page for pointers to younger generations or the
-     * temp generation, which is numerically 7 but logically younger */
+    if (page_points_to_younger_p(page))
+        return 0;
+    protect_page(page_address(page), page);
+    return 1;
+}
+
+/* Scan 'page' for pointers to younger generations or the
+ * temp generation, which is numerically 7 but logically younger.
+ * Return 0 if there are none, in which case the page may be protected.
+ * This reads but never writes the heap or the page table, so it can be
+ * performed on many pages concurrently. */
+static int
+page_points_to_younger_p(page_index_t page)
+{
+    generation_index_t gen = page_table[page].gen;
+    sword_t j;
+    lispobj *page_addr = (lispobj*)page_address(page);
+    sword_t num_words = page_bytes_used(page) / N_WORD_BYTES;
 
     /* This is conservative: any word satisfying is_lisp_pointer() is
      * assumed to be a pointer. To do otherwise would require a family
@@ -2388,10 +2773,8 @@ update_page_write_prot(page_index_t page)
                 /* and an in-use part of the page? */
                 (((lispobj)ptr & (GENCGC_CARD_BYTES-1)) < page_bytes_used(index) ||
                  ((page_table[index].type & OPEN_REGION_PAGE_FLAG)
-                  && (IN_BOXED_REGION_P(ptr) || IN_REGION_P(ptr,unboxed))))) {
-                wp_it = 0;
-                break;
-            }
+                  && (IN_BOXED_REGION_P(ptr) || IN_REGION_P(ptr,unboxed)))))
+                return 1;
         }
 #ifdef LISP_FEATURE_IMMOBILE_SPACE
         else if (immobile_space_p((lispobj)ptr) &&
@@ -2421,18 +2804,12 @@ update_page_write_prot(page_index_t page)
             }
             // A bogus generation number implies a not-really-pointer,
             // but it won't cause misbehavior.
-            if (pointee_gen < gen || pointee_gen == SCRATCH_GENERATION) {
-                wp_it = 0;
-                break;
-            }
+            if (pointee_gen < gen || pointee_gen == SCRATCH_GENERATION)
+                return 1;
         }
 #endif
     }
-
-    if (wp_it == 1)
-        protect_page(page_addr, page);
-
-    return (wp_it);
+    return 0;
 }
 
 /* Is this page holding a normal (non-weak, non-hashtable) large-object
@@ -2500,75 +2877,265 @@ update_code_writeprotection(page_index_t first_page, page_index_t last_page,
  *
  * One complication is when the newspace is the top temp. generation.
  */
-static void
-scavenge_root_gens(generation_index_t from, generation_index_t to)
+
+/* With more than one GC thread, the root pages are first examined
+ * concurrently by the helper threads to see which of them could possibly
+ * point to a younger generation. A page which can't has nothing for
+ * scavenging to do, and would be write-protected by update_page_write_prot()
+ * after scavenging anyway, so it is simply protected instead.
+ * Transporting objects remains the job of the thread doing GC. */
+static unsigned char *root_page_dirty;
+struct root_filter {
+    generation_index_t from, to;
+};
+#define ROOT_FILTER_CHUNK 64 /* pages */
+
+static void filter_root_pages(int worker, int n_workers, void* arg)
 {
-    page_index_t i;
+    struct root_filter* range = arg;
+    page_index_t chunk, i;
+    for (chunk = worker * ROOT_FILTER_CHUNK ; chunk < next_free_page ;
+         chunk += n_workers * ROOT_FILTER_CHUNK) {
+        page_index_t end = chunk + ROOT_FILTER_CHUNK;
+        if (end > next_free_page) end = next_free_page;
+        for (i = chunk; i < end; ++i) {
+            generation_index_t gen = page_table[i].gen;
+            int dirty = 1;
+            if (page_boxed_p(i) && !is_code(page_table[i].type)
+                && page_bytes_used(i) != 0
+                && gen != new_space && gen >= range->from && gen <= range->to
+                && !page_table[i].write_protected && !page_table[i].pinned)
+                dirty = page_points_to_younger_p(i);
+            root_page_dirty[i] = dirty;
+        }
+    }
+}
 
-    for (i = 0; i < next_free_page; i++) {
-        generation_index_t generation = page_table[i].gen;
-        if (page_boxed_p(i)
-            && (page_bytes_used(i) != 0)
-            && (generation != new_space)
-            && (generation >= from)
-            && (generation <= to)) {
+/* The remembered set.
+ * With 'gencgc_remset' set, scavenge_root_gens() visits only the pages
+ * listed in 'remset_pages' rather than examining each page of the older
+ * generations. Every boxed page of generation 1 or older which is not
+ * write-protected is in the set, as is every such code page, because
+ * CODE-HEADER-SET clears the soft protection of code pages directly.
+ *  - unprotect_page_index() logs the page into the current thread's
+ *    sequential store buffer, which is flushed into the set when it fills,
+ *    when the thread exits, and before the roots are scavenged;
+ *  - GC adds the pages of each generation it writes as it protects or
+ *    relabels them;
+ *  - after GC, pages which are protected again are dropped.
+ * The set is built by a scan of the page table at the end of the first
+ * GC after 'gencgc_remset' is set. */
+int gencgc_remset = 0;
+boolean gc_remset_active;
+static page_index_t *remset_pages, remset_count;
+static unsigned char *remset_member;
+
+static inline void remset_add(page_index_t page)
+{
+    if (!__sync_fetch_and_or(&remset_member[page], 1))
+        remset_pages[__sync_fetch_and_add(&remset_count, 1)] = page;
+}
 
-            /* This should be the start of a region */
-            gc_assert(page_starts_contiguous_block_p(i));
+void gc_flush_remset_buffer(struct thread* th)
+{
+    struct extra_thread_data* extra = thread_extra_data(th);
+    int i;
+    if (gc_remset_active)
+        for (i = 0; i < extra->remset_ssb_count; ++i)
+            remset_add(extra->remset_ssb[i]);
+    extra->remset_ssb_count = 0;
+}
 
-            if (large_simple_vector_p(i)) {
-                /* Scavenge only the written pages of a large vector.
-                 * There are no other large objects of special interest.
-                 * Bignums are non-pointer objects, so aren't roots.
-                 * INSTANCE and CLOSURE are theoretically capable of being
-                 * large, but the compiler can't create them.
-                 * Code is for practical purposes read-only after creation
-                 * (other than assigning to simple-fun-name and documentation),
-                 * and scavenging skips the unboxed portion anyway.
-                 * The only potential improvement would be to deal better
-                 * with large hash-table storage vectors. */
-                if (!page_table[i].write_protected) {
-                    scavenge((lispobj*)page_address(i) + 2,
-                             GENCGC_CARD_BYTES / N_WORD_BYTES - 2);
+/* Threads other than lisp threads, and GC itself, add to the set directly */
+void gc_log_unprotected_page(page_index_t page)
+{
+    struct thread* th = get_sb_vm_thread();
+    if (!th || gc_active_p) {
+        remset_add(page);
+        return;
+    }
+    struct extra_thread_data* extra = thread_extra_data(th);
+    if (extra->remset_ssb_count == REMSET_SSB_SIZE)
+        gc_flush_remset_buffer(th);
+    extra->remset_ssb[extra->remset_ssb_count++] = page;
+}
+
+static inline boolean remset_page_p(page_index_t page)
+{
+    generation_index_t gen = page_table[page].gen;
+    return page_bytes_used(page) != 0 && page_boxed_p(page)
+        && gen != 0 && gen != SCRATCH_GENERATION
+        && (!page_table[page].write_protected || protection_mode(page) == LOGICAL);
+}
+
+/* At the end of GC, start or stop maintaining the remembered set
+ * according to 'gencgc_remset', or drop pages which are protected */
+static void update_remset()
+{
+    page_index_t i, n = 0;
+
+    if (!gencgc_remset || !ENABLE_PAGE_PROTECTION) {
+        if (gc_remset_active) {
+            for (i = 0; i < remset_count; i++)
+                remset_member[remset_pages[i]] = 0;
+            remset_count = 0;
+            gc_remset_active = 0;
+        }
+        return;
+    }
+    if (!gc_remset_active) {
+        for (i = 0; i < next_free_page; i++)
+            if (remset_page_p(i)) {
+                remset_member[i] = 1;
+                remset_pages[n++] = i;
+            }
+        gc_remset_active = 1;
+    } else {
+        for (i = 0; i < remset_count; i++) {
+            page_index_t page = remset_pages[i];
+            if (page < next_free_page && remset_page_p(page))
+                remset_pages[n++] = page;
+            else
+                remset_member[page] = 0;
+        }
+    }
+    remset_count = n;
+}
+
+static int compare_page_index(const void* a, const void* b)
+{
+    page_index_t x = *(page_index_t*)a, y = *(page_index_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Scavenge the contiguous block starting at root page 'i' unless it is
+ * write-protected, and return its last page. */
+static page_index_t
+scavenge_root_block(page_index_t i, boolean filtered)
+{
+    generation_index_t generation = page_table[i].gen;
+#define ROOT_PAGE_CLEAN_P(page) (filtered && !root_page_dirty[page])
+
+    /* This should be the start of a region */
+    gc_assert(page_starts_contiguous_block_p(i));
+
+    if (large_simple_vector_p(i)) {
+        /* Scavenge only the written pages of a large vector.
+         * There are no other large objects of special interest.
+         * Bignums are non-pointer objects, so aren't roots.
+         * INSTANCE and CLOSURE are theoretically capable of being
+         * large, but the compiler can't create them.
+         * Code is for practical purposes read-only after creation
+         * (other than assigning to simple-fun-name and documentation),
+         * and scavenging skips the unboxed portion anyway.
+         * The only potential improvement would be to deal better
+         * with large hash-table storage vectors. */
+        if (!page_table[i].write_protected) {
+            if (ROOT_PAGE_CLEAN_P(i))
+                protect_page(page_address(i), i);
+            else {
+                scavenge((lispobj*)page_address(i) + 2,
+                         GENCGC_CARD_BYTES / N_WORD_BYTES - 2);
+                update_page_write_prot(i);
+                ++current_gc_event->root_pages;
+            }
+        }
+        while (!page_ends_contiguous_block_p(i, generation)) {
+            ++i;
+            if (!page_table[i].write_protected) {
+                if (ROOT_PAGE_CLEAN_P(i))
+                    protect_page(page_address(i), i);
+                else {
+                    scavenge((lispobj*)page_address(i),
+                             page_bytes_used(i) / N_WORD_BYTES);
                     update_page_write_prot(i);
+                    ++current_gc_event->root_pages;
                 }
-                while (!page_ends_contiguous_block_p(i, generation)) {
-                    ++i;
-                    if (!page_table[i].write_protected) {
-                        scavenge((lispobj*)page_address(i),
-                                 page_bytes_used(i) / N_WORD_BYTES);
-                        update_page_write_prot(i);
-                    }
-                }
+            }
+        }
+    } else {
+        page_index_t last_page;
+        boolean write_protected = 1, clean = 1;
+        /* Now work forward until the end of the region */
+        for (last_page = i; ; last_page++) {
+            if (!page_table[last_page].write_protected) {
+                write_protected = 0;
+                clean = clean && ROOT_PAGE_CLEAN_P(last_page);
+            }
+            if (page_ends_contiguous_block_p(last_page, generation))
+                break;
+        }
+        if (!write_protected && clean) {
+            page_index_t j;
+            for (j = i; j <= last_page; j++)
+                if (!page_table[j].write_protected)
+                    protect_page(page_address(j), j);
+        } else if (!write_protected) {
+            lispobj* start = (lispobj*)page_address(i);
+            lispobj* limit = (lispobj*)(page_address(last_page)
+                                        + page_bytes_used(last_page));
+            heap_scavenge(start, limit);
+            current_gc_event->root_pages += last_page - i + 1;
+            /* Now scan the pages and write protect those that
+             * don't have pointers to younger generations. */
+            if (CODE_PAGES_USE_SOFT_PROTECTION && is_code(page_table[i].type)) {
+                update_code_writeprotection(i, last_page, start, limit);
             } else {
-                page_index_t last_page;
-                boolean write_protected = 1;
-                /* Now work forward until the end of the region */
-                for (last_page = i; ; last_page++) {
-                    write_protected =
-                        write_protected && page_table[last_page].write_protected;
-                    if (page_ends_contiguous_block_p(last_page, generation))
-                        break;
-                }
-                if (!write_protected) {
-                    lispobj* start = (lispobj*)page_address(i);
-                    lispobj* limit = (lispobj*)(page_address(last_page)
-                                                + page_bytes_used(last_page));
-                    heap_scavenge(start, limit);
-                    /* Now scan the pages and write protect those that
-                     * don't have pointers to younger generations. */
-                    if (CODE_PAGES_USE_SOFT_PROTECTION && is_code(page_table[i].type)) {
-                        update_code_writeprotection(i, last_page, start, limit);
-                    } else {
-                        page_index_t j;
-                        for (j = i; j <= last_page; j++) // scan by page
-                            update_page_write_prot(j);
-                    }
-                }
-                i = last_page;
+                page_index_t j;
+                for (j = i; j <= last_page; j++) // scan by page
+                    update_page_write_prot(j);
             }
         }
+        i = last_page;
+    }
+    return i;
+#undef ROOT_PAGE_CLEAN_P
+}
+
+static inline boolean root_block_p(page_index_t i,
+                                   generation_index_t from, generation_index_t to)
+{
+    generation_index_t generation = page_table[i].gen;
+    return page_boxed_p(i)
+        && (page_bytes_used(i) != 0)
+        && (generation != new_space)
+        && (generation >= from)
+        && (generation <= to);
+}
+
+static void
+scavenge_root_gens(generation_index_t from, generation_index_t to)
+{
+    page_index_t i;
+    boolean filtered = 0;
+
+    if (gc_remset_active) {
+        struct thread* th;
+        for_each_thread(th)
+            gc_flush_remset_buffer(th);
+        // Visit blocks in address order, each only once
+        page_index_t k, n = remset_count, last = -1;
+        qsort(remset_pages, n, sizeof (page_index_t), compare_page_index);
+        for (k = 0; k < n; k++) {
+            page_index_t page = remset_pages[k];
+            if (page <= last || page >= next_free_page || page_bytes_used(page) == 0)
+                continue;
+            i = find_page_index(page_scan_start(page));
+            if (root_block_p(i, from, to))
+                last = scavenge_root_block(i, 0);
+        }
+        return;
     }
+
+    if (ENABLE_PAGE_PROTECTION && gc_n_threads > 1 && root_page_dirty) {
+        struct root_filter range = { from, to };
+        gc_run_on_thread_pool(filter_root_pages, &range);
+        filtered = 1;
+    }
+
+    for (i = 0; i < next_free_page; i++)
+        if (root_block_p(i, from, to))
+            i = scavenge_root_block(i, filtered);
 }
 
 
@@ -2762,7 +3329,9 @@ unprotect_oldspace(void)
 
             /* Remove any write-protection. We should be able to rely
              * on the write-protect flag to avoid redundant calls. */
-            if (page_table[i].write_protected) {
+            if (page_table[i].write_protected && huge_page_card_p(i))
+                unprotect_huge_page(i);
+            else if (page_table[i].write_protected) {
                 page_table[i].write_protected = 0;
                 page_addr = page_address(i);
                 if (!region_addr) {
@@ -3288,6 +3857,210 @@ walk_generation(uword_t (*proc)(lispobj*,lispobj*,uword_t),
     return 0;
 }
 
+/* As walk_generation(), but the blocks are divided among the GC threads.
+ * Each thread claims runs of pages from a shared counter and visits every
+ * block which starts on a page that it claimed. Worker N passes extra[N]
+ * to 'proc', whose return value is ignored: the walk can't stop early. */
+struct parallel_walk {
+    uword_t (*proc)(lispobj*,lispobj*,uword_t);
+    int genmask;
+    uword_t* extra;
+    page_index_t next_chunk;
+};
+#define WALK_CHUNK_PAGES 128
+
+static void walk_chunk_pages(struct parallel_walk* walk, page_index_t first, uword_t extra)
+{
+    page_index_t limit = first + WALK_CHUNK_PAGES, i;
+    if (limit > next_free_page) limit = next_free_page;
+    for (i = first; i < limit; i++) {
+        // A page continuing a block belongs to whoever visits the block's start
+        if (page_bytes_used(i) == 0 || !page_starts_contiguous_block_p(i)
+            || !((1 << page_table[i].gen) & walk->genmask))
+            continue;
+        page_index_t last_page = i;
+        while (!page_ends_contiguous_block_p(last_page, page_table[i].gen))
+            ++last_page;
+        walk->proc((lispobj*)page_address(i),
+                   (lispobj*)(page_bytes_used(last_page) + page_address(last_page)),
+                   extra);
+        i = last_page;
+    }
+}
+
+static void walk_generation_chunks(int worker, int __attribute__((unused)) n_workers,
+                                   void* arg)
+{
+    struct parallel_walk* walk = arg;
+    for (;;) {
+        page_index_t first = __sync_fetch_and_add(&walk->next_chunk, WALK_CHUNK_PAGES);
+        if (first >= next_free_page) return;
+        walk_chunk_pages(walk, first, walk->extra[worker]);
+    }
+}
+
+void
+walk_generation_in_parallel(uword_t (*proc)(lispobj*,lispobj*,uword_t),
+                            generation_index_t generation, uword_t* extra)
+{
+    struct parallel_walk walk;
+    walk.proc = proc;
+    walk.genmask = generation >= 0 ? 1 << generation : ~0;
+    walk.extra = extra;
+    walk.next_chunk = 0;
+    gc_run_on_thread_pool(walk_generation_chunks, &walk);
+}
+
+/* As walk_generation_in_parallel(), but on threads of its own rather than
+ * the GC's, so that it works before the GC is running. The pages are cut
+ * into walk_generation_n_chunks() chunks, and chunk N passes extra[N] */
+page_index_t walk_generation_n_chunks()
+{
+    return (next_free_page + WALK_CHUNK_PAGES - 1) / WALK_CHUNK_PAGES;
+}
+
+static void walk_one_chunk(sword_t chunk, void* arg)
+{
+    struct parallel_walk* walk = arg;
+    walk_chunk_pages(walk, chunk * WALK_CHUNK_PAGES, walk->extra[chunk]);
+}
+
+void
+walk_generation_by_chunks(uword_t (*proc)(lispobj*,lispobj*,uword_t),
+                          generation_index_t generation, uword_t* extra)
+{
+    struct parallel_walk walk;
+    walk.proc = proc;
+    walk.genmask = generation >= 0 ? 1 << generation : ~0;
+    walk.extra = extra;
+    for_each_chunk(0, walk_generation_n_chunks(), walk_one_chunk, &walk);
+}
+
+/* Lazy sweeping.
+ * After a mark-only collection with 'gc_lazy_sweep' set, the world restarts
+ * before dynamic space is swept, so that the pause lasts only as long as
+ * the mark. Each block which was in use has its first page flagged in
+ * 'lazy_sweep_pending', and is swept, at the latest, when:
+ *  - gc_find_freeish_pages() is about to hand out a range of pages which
+ *    starts on a partially used page of the block;
+ *  - a GC helper thread in the background gets to it;
+ *  - finish_lazy_sweep() is called, at the start of the next GC or before
+ *    a heap walk from Lisp.
+ * The flags and the sweeping are protected by free_pages_lock.
+ * Dead objects can't be reached by the mutator, so sweeping them while it
+ * runs is invisible except to a heap walk.
+ * A write-protected page which has garbage is unprotected exactly as if the
+ * mutator had written to it, so the next GC will scan it. */
+static unsigned char *lazy_sweep_pending;
+static page_index_t lazy_sweep_cursor, lazy_sweep_limit;
+
+/* free_pages_lock is held */
+static void lazy_sweep_block(page_index_t first)
+{
+    extern boolean block_has_garbage(lispobj*, lispobj*);
+    extern void sweep_block(lispobj*, lispobj*, long*);
+    generation_index_t gen = page_table[first].gen;
+    page_index_t last, page;
+
+    lazy_sweep_pending[first] = 0;
+    for (last = first; !page_ends_contiguous_block_p(last, gen); ++last)
+        ;
+    lispobj* where = (lispobj*)page_address(first);
+    lispobj* end = (lispobj*)(page_address(last) + page_bytes_used(last));
+    if (!block_has_garbage(where, end))
+        return;
+    for (page = first; page <= last; ++page)
+        if (page_table[page].write_protected && protection_mode(page) == PHYSICAL)
+            unprotect_page_index(page);
+    long words_zeroed[1+PSEUDO_STATIC_GENERATION];
+    memset(words_zeroed, 0, sizeof words_zeroed);
+    sweep_block(where, end, words_zeroed);
+    int i;
+    for (i = 0; i <= PSEUDO_STATIC_GENERATION; ++i)
+        generations[i].swept_bytes += words_zeroed[i] * N_WORD_BYTES;
+}
+
+/* free_pages_lock is held */
+static void ensure_block_swept(page_index_t page)
+{
+    page_index_t first = find_page_index(page_scan_start(page));
+    if (lazy_sweep_pending[first])
+        lazy_sweep_block(first);
+}
+
+/* Sweep pending blocks in address order until none remain. This is the
+ * background job, and is also how finish_lazy_sweep() mops up. */
+static void sweep_pending_blocks(int __attribute__((unused)) worker,
+                                 int __attribute__((unused)) n_workers,
+                                 void __attribute__((unused)) *arg)
+{
+    boolean done;
+    do {
+        int ret = thread_mutex_lock(&free_pages_lock);
+        gc_assert(ret == 0);
+        // Take the lock once per block, so that allocators can get in
+        page_index_t page = lazy_sweep_cursor;
+        while (page < lazy_sweep_limit && !lazy_sweep_pending[page])
+            ++page;
+        if (page < lazy_sweep_limit)
+            lazy_sweep_block(page);
+        lazy_sweep_cursor = page + 1;
+        done = lazy_sweep_cursor >= lazy_sweep_limit;
+        ret = thread_mutex_unlock(&free_pages_lock);
+        gc_assert(ret == 0);
+    } while (!done);
+}
+
+/* Called at the end of a mark-only collection, with the world stopped,
+ * when execute_full_sweep_phase() skipped dynamic space. The background
+ * sweeper isn't started until collect_garbage() is done with the page table
+ * and the remembered set (see start_background_sweep) */
+static void start_lazy_sweep()
+{
+    page_index_t page;
+    for (page = 0; page < next_free_page; ++page)
+        lazy_sweep_pending[page] =
+            page_bytes_used(page) != 0 && page_starts_contiguous_block_p(page);
+    lazy_sweep_cursor = 0;
+    lazy_sweep_limit = next_free_page;
+    lazy_sweep_active = 1;
+}
+
+/* Called last thing in collect_garbage(). protect_huge_pages() and
+ * update_remset() don't take free_pages_lock, so the sweeper must not
+ * run until they're done. */
+static void start_background_sweep()
+{
+    if (lazy_sweep_active)
+        gc_run_in_background(sweep_pending_blocks, 0);
+}
+
+/* Sweep whatever is left after a mark-only collection. Any thread may call
+ * this, but not with free_pages_lock held or in the middle of GC. */
+void finish_lazy_sweep()
+{
+    extern void release_lazy_sweep_marks();
+    if (!lazy_sweep_active)
+        return;
+    sweep_pending_blocks(0, 1, 0);
+    gc_wait_for_background();
+    int ret = thread_mutex_lock(&free_pages_lock);
+    gc_assert(ret == 0);
+    if (lazy_sweep_active) { // unless another thread got here first
+        lazy_sweep_active = 0;
+        release_lazy_sweep_marks();
+    }
+    ret = thread_mutex_unlock(&free_pages_lock);
+    gc_assert(ret == 0);
+}
+
+#if defined LISP_FEATURE_SB_THREAD && !defined LISP_FEATURE_WIN32
+/* The background sweeper could hold free_pages_lock when another thread
+ * forks, and would not be there in the child to release it. */
+static void lock_free_pages() { ignore_value(thread_mutex_lock(&free_pages_lock)); }
+static void unlock_free_pages() { ignore_value(thread_mutex_unlock(&free_pages_lock)); }
+#endif
+
 
 /* Write-protect all the dynamic boxed pages in the given generation. */
 static void
@@ -3302,6 +4075,8 @@ write_protect_generation_pages(generation_index_t generation)
               && generation != PSEUDO_STATIC_GENERATION);
 
     while (start  < next_free_page) {
+        if (gc_remset_active && page_table[start].gen == generation)
+            remset_add(start);
         if (!protect_page_p(start, generation)
 #ifdef LISP_FEATURE_DARWIN_JIT
             || is_code(page_table[start].type)
@@ -3332,7 +4107,12 @@ write_protect_generation_pages(generation_index_t generation)
         }
 
         n_hw_prot += end - start;
-        os_protect(page_address(start), npage_bytes(end - start), OS_VM_PROT_JIT_READ);
+        // Huge pages are protected at the end of GC (see protect_huge_pages)
+        page_index_t limit = end;
+        if (huge_page_card_p(limit - 1))
+            limit = huge_page_card_p(start) ? start : huge_page_first_card;
+        if (limit > start)
+            os_protect(page_address(start), npage_bytes(limit - start), OS_VM_PROT_JIT_READ);
 
         start = end;
     }
@@ -3347,6 +4127,63 @@ write_protect_generation_pages(generation_index_t generation)
     }
 }
 
+/* Unprotect the huge page containing 'page'. Physical protection of huge
+ * pages is all or nothing, so every card of it loses its protection */
+void unprotect_huge_page(page_index_t page)
+{
+    page_index_t first = page - (page - huge_page_first_card) % cards_per_huge_page;
+    page_index_t i;
+    os_protect(page_address(first), npage_bytes(cards_per_huge_page), OS_VM_PROT_JIT_ALL);
+    for (i = first; i < first + cards_per_huge_page; ++i) {
+        unsigned char *pflagbits = (unsigned char*)&page_table[i].gen - 1;
+        if (!(__sync_fetch_and_add(pflagbits, 0) & WRITE_PROTECTED_FLAG))
+            continue;
+        __sync_fetch_and_or(pflagbits, WP_CLEARED_FLAG);
+        __sync_fetch_and_and(pflagbits, ~WRITE_PROTECTED_FLAG);
+        if (gc_remset_active)
+            gc_log_unprotected_page(i);
+    }
+}
+
+/* Changing the protection of part of a huge page splits it, so cards in huge
+ * pages are only marked as protected during GC. At the end, protect each huge
+ * page of which every card can be, and unmark the cards of all the others */
+static void protect_huge_pages()
+{
+    if (!cards_per_huge_page || !ENABLE_PAGE_PROTECTION)
+        return;
+    page_index_t first, i;
+    int n_protected = 0, n_cards_unprotected = 0;
+    for (first = huge_page_first_card; first < next_free_page; first += cards_per_huge_page) {
+        page_index_t end = first + cards_per_huge_page;
+        boolean protect = end <= next_free_page, marked = 0;
+        for (i = first; i < end && i < next_free_page; ++i)
+            if (page_table[i].write_protected && protection_mode(i) == PHYSICAL)
+                marked = 1;
+            else
+                protect = 0;
+        if (protect) {
+            os_protect(page_address(first), npage_bytes(cards_per_huge_page),
+                       OS_VM_PROT_JIT_READ);
+            ++n_protected;
+        } else if (marked) {
+            for (i = first; i < end && i < next_free_page; ++i)
+                if (page_table[i].write_protected && protection_mode(i) == PHYSICAL) {
+                    page_table[i].write_protected = 0;
+                    ++n_cards_unprotected;
+                    if (gc_remset_active)
+                        remset_add(i);
+                }
+            // In case some were protected before the last GC
+            os_protect(page_address(first), npage_bytes(cards_per_huge_page),
+                       OS_VM_PROT_JIT_ALL);
+        }
+    }
+    if (gencgc_verbose > 1)
+        printf("huge pages protected %d, cards left unprotected %d\n",
+               n_protected, n_cards_unprotected);
+}
+
 static void unprotect_all_pages()
 {
 #ifndef LISP_FEATURE_DARWIN_JIT
@@ -3367,6 +4204,11 @@ static void unprotect_all_pages()
         }
     }
 #endif
+    // The sweep leaves read-only constants alone, so they stay shared
+    if (readonly_core_page_end > readonly_core_page_start)
+        os_protect(page_address(readonly_core_page_start),
+                   npage_bytes(readonly_core_page_end - readonly_core_page_start),
+                   OS_VM_PROT_READ);
 }
 
 #if !GENCGC_IS_PRECISE
@@ -3441,6 +4283,83 @@ move_pinned_pages_to_newspace()
     }
 }
 
+/* After a mark-only collection, a dead object in dynamic space has been
+ * turned into a (0 . 0) cons or a code header with no boxed words */
+static inline boolean swept_garbage_p(lispobj* where)
+{
+    if (is_header(*where))
+        return widetag_of(where) == CODE_HEADER_WIDETAG && where[1] == 0;
+    return (where[0] | where[1]) == 0;
+}
+
+/* Return the number of lines from 'start' to 'end' which some
+ * live object overlaps. */
+static uword_t count_lines_in_use(lispobj* start, lispobj* end)
+{
+    uword_t n_used = 0;
+    sword_t last_line = -1, nwords;
+    lispobj* where;
+
+    for (where = start ; where < end ; where += nwords) {
+        nwords = is_header(*where) ? sizetab[header_widetag(*where)](where) : 2;
+        if (swept_garbage_p(where))
+            continue;
+        sword_t first = ((char*)where - (char*)start) / MARK_REGION_LINE_BYTES;
+        sword_t last = ((char*)(where + nwords) - 1 - (char*)start)
+                       / MARK_REGION_LINE_BYTES;
+        if (first <= last_line)
+            first = last_line + 1;
+        if (last >= first) {
+            n_used += last - first + 1;
+            last_line = last;
+        }
+    }
+    return n_used;
+}
+
+/* The mark-region policy for the oldest normal generation, in the manner of
+ * Immix: a mark-only collection has already marked the whole heap and swept
+ * every dead object into a filler. Each contiguous block of small-object pages
+ * in from_space is divided into lines of MARK_REGION_LINE_BYTES, and a line is
+ * in use if any live object overlaps it. Blocks with fewer than
+ * 'gencgc_sparse_block_percent' free lines are moved to newspace wholesale,
+ * as are pinned pages, so that the scavenger leaves their contents in place.
+ * Only the sparse blocks remain in from_space to be evacuated. */
+static void
+retain_dense_blocks()
+{
+    page_index_t first, last, i;
+    page_index_t n_retained = 0, n_evacuated = 0;
+
+    for (first = 0; first < next_free_page; first = last + 1) {
+        last = first;
+        if (page_table[first].gen != from_space || page_bytes_used(first) == 0
+            || page_single_obj_p(first) || !page_starts_contiguous_block_p(first))
+            continue;
+        while (!page_ends_contiguous_block_p(last, from_space))
+            ++last;
+        lispobj* start = (lispobj*)page_address(first);
+        lispobj* end = (lispobj*)(page_address(last) + page_bytes_used(last));
+        uword_t n_lines = ALIGN_UP((char*)end - (char*)start, MARK_REGION_LINE_BYTES)
+                          / MARK_REGION_LINE_BYTES;
+        uword_t n_free = n_lines - count_lines_in_use(start, end);
+        if (n_free * 100 >= n_lines * gencgc_sparse_block_percent) {
+            n_evacuated += 1 + last - first;
+            continue;
+        }
+        for (i = first; i <= last; i++) {
+            page_table[i].gen = new_space;
+            int used = page_bytes_used(i);
+            generations[new_space].bytes_allocated += used;
+            generations[from_space].bytes_allocated -= used;
+        }
+        n_retained += 1 + last - first;
+    }
+    if (gencgc_verbose)
+        fprintf(stderr, "mark-region: %ld pages kept, %ld pages evacuated\n",
+                (long)n_retained, (long)n_evacuated);
+}
+
 #if GENCGC_IS_PRECISE && !defined(reg_CODE)
 
 lispobj *
@@ -3494,6 +4413,65 @@ void pin_stack(struct thread* th) {
 }
 #endif
 
+/* The objects to copy ahead of all others in the final GC before saving,
+ * because an access profile shows that the pages they were loaded on were
+ * touched. The penultimate GC drops those which are dead and stores the new
+ * addresses of the others, after which they are 'live'.
+ * Coalescing and moving read-only constants then leave some of them
+ * superseded by another copy, which drop_hot_object() removes from the list
+ * through 'index', lest the final GC keep them alive. */
+static struct {
+    lispobj *objects;
+    sword_t count;
+    boolean live;
+    boolean indexed;
+    struct hopscotch_table index; // object -> 1 + its position in 'objects'
+} hot_objects;
+
+/* Called at the end of the penultimate GC, while the old copies of objects
+ * still hold forwarding pointers */
+static void forward_hot_objects()
+{
+    sword_t i, n = 0;
+    for (i = 0; i < hot_objects.count; ++i) {
+        lispobj obj = hot_objects.objects[i];
+        lispobj *native = native_pointer(obj);
+        if (forwarding_pointer_p(native))
+            hot_objects.objects[n++] = forwarding_pointer_value(native);
+        else if (!from_space_p(obj)) // a large object promoted in place
+            hot_objects.objects[n++] = obj;
+    }
+    hot_objects.count = n;
+    hot_objects.live = 1;
+}
+
+static void index_hot_objects()
+{
+    sword_t i;
+    hopscotch_create(&hot_objects.index, HOPSCOTCH_HASH_FUN_DEFAULT, N_WORD_BYTES,
+                     1<<12, 0);
+    for (i = 0; i < hot_objects.count; ++i)
+        hopscotch_insert(&hot_objects.index, (uword_t)native_pointer(hot_objects.objects[i]),
+                         1 + i);
+    hot_objects.indexed = 1;
+}
+
+/* Called when every reference to 'obj' that the heap walk saw was replaced
+ * by a reference to another copy. Only order is lost if it is still live */
+void drop_hot_object(lispobj* obj)
+{
+    if (!hot_objects.indexed) return;
+    sword_t position = hopscotch_get(&hot_objects.index, (uword_t)obj, 0);
+    if (position) hot_objects.objects[position-1] = 0; // scavenging 0 does nothing
+}
+
+/* Where the heap profiler's sampled object is now, or 0 if it died */
+static lispobj heap_sample_survivor(lispobj obj)
+{
+    TEST_WEAK_CELL(obj, obj, 0);
+    return obj;
+}
+
 /* Garbage collect a generation. If raise is 0 then the remains of the
  * generation are not raised to the next generation. */
 static void NO_SANITIZE_ADDRESS NO_SANITIZE_MEMORY
@@ -3501,6 +4479,12 @@ garbage_collect_generation(generation_index_t generation, int raise)
 {
     page_index_t i;
     struct thread *th;
+    uint64_t phase_start = gc_clock_ns();
+    os_vm_size_t newspace_bytes = 0;
+#define END_PHASE(slot) { uint64_t now = gc_clock_ns(); \
+                          current_gc_event->slot += now - phase_start; \
+                          trace_complete(#slot, now - phase_start); \
+                          phase_start = now; }
 
     gc_assert(generation <= PSEUDO_STATIC_GENERATION);
 
@@ -3535,6 +4519,19 @@ garbage_collect_generation(generation_index_t generation, int raise)
     pin_all_dynamic_space_code = read_TLS(GC_PIN_CODE_PAGES, 0) & make_fixnum(1);
 #endif
 
+    /* Mark and sweep the entire heap first if dense blocks of this
+     * generation are to be kept in place. */
+    boolean mark_region = generation == HIGHEST_NORMAL_GENERATION && !raise
+        && gencgc_mark_region && !pin_all_dynamic_space_code;
+    if (mark_region) {
+        mark_region_prepass = 1;
+        garbage_collect_generation(PSEUDO_STATIC_GENERATION, 0);
+        mark_region_prepass = 0;
+        hopscotch_reset(&pinned_objects);
+        gc_n_stack_pins = 0;
+        phase_start = gc_clock_ns();
+    }
+
     /* Set the global src and dest. generations */
     if (generation < PSEUDO_STATIC_GENERATION) {
 
@@ -3577,6 +4574,9 @@ garbage_collect_generation(generation_index_t generation, int raise)
         if (ENABLE_PAGE_PROTECTION)
             unprotect_oldspace();
 
+        if (mark_region)
+            retain_dense_blocks();
+
     } else { // "full" [sic] GC
 
         gc_assert(!pin_all_dynamic_space_code); // not supported (but could be)
@@ -3800,6 +4800,19 @@ garbage_collect_generation(generation_index_t generation, int raise)
      * will not attempt to relocate their contents. */
     if (compacting_p())
         move_pinned_pages_to_newspace();
+    current_gc_event->objects_pinned += pinned_objects.count;
+    END_PHASE(pin_ns);
+    // Anything added to newspace from here on was copied, except for
+    // large objects, which copy_large_object() promotes in place.
+    if (compacting_p())
+        newspace_bytes = generations[new_space].bytes_allocated;
+    bytes_promoted_in_place = 0;
+
+    /* Before saving a core with an access profile, copy the objects which
+     * were touched ahead of all others, to pack them onto fewer pages.
+     * They're all in the oldest normal generation at that point */
+    if (hot_objects.live && generation == HIGHEST_NORMAL_GENERATION && compacting_p())
+        scavenge(hot_objects.objects, hot_objects.count);
 
     /* Scavenge all the rest of the roots. */
 
@@ -3858,9 +4871,24 @@ garbage_collect_generation(generation_index_t generation, int raise)
 
     if (!compacting_p()) {
         extern void execute_full_mark_phase();
-        extern void execute_full_sweep_phase();
+        extern boolean execute_full_sweep_phase(long*, boolean);
+        long words_zeroed[1+PSEUDO_STATIC_GENERATION];
+        // Verifying the heap would trip over garbage which points to
+        // objects that were already swept.
+        boolean lazy = gc_lazy_sweep && generation < verify_gens
+                       && !mark_region_prepass;
+#ifdef LISP_FEATURE_DARWIN_JIT
+        lazy = 0; // the sweeper could not write to code pages
+#endif
+        END_PHASE(roots_ns);
         execute_full_mark_phase();
-        execute_full_sweep_phase();
+        END_PHASE(newspace_ns);
+        lazy = execute_full_sweep_phase(words_zeroed, lazy);
+        for (i = 0; i <= PSEUDO_STATIC_GENERATION; ++i)
+            generations[i].swept_bytes = words_zeroed[i] * N_WORD_BYTES;
+        if (lazy)
+            start_lazy_sweep();
+        END_PHASE(free_ns);
         goto maybe_verify;
     }
 
@@ -3927,10 +4955,15 @@ garbage_collect_generation(generation_index_t generation, int raise)
 
     /* Finally scavenge the new_space generation. Keep going until no
      * more objects are moved into the new generation */
+    END_PHASE(roots_ns);
     scavenge_newspace(new_space);
+    current_gc_event->bytes_copied += generations[new_space].bytes_allocated
+        - newspace_bytes - bytes_promoted_in_place;
+    END_PHASE(newspace_ns);
 
     scan_binding_stack();
     smash_weak_pointers();
+    heap_profile_cull(heap_sample_survivor);
 #ifdef LISP_FEATURE_METASPACE
     // *PRIMITIVE-OBJECT-LAYOUTS* (in readonly space) is a root, but it only points
     // to other objects in readonly space; however, those other objects (above
@@ -3957,6 +4990,10 @@ garbage_collect_generation(generation_index_t generation, int raise)
     /* Return private-use pages to the general pool so that Lisp can have them */
     gc_dispose_private_pages();
     cull_weak_hash_tables(weak_ht_alivep_funs);
+    END_PHASE(weak_ns);
+
+    if (hot_objects.count && !hot_objects.live && generation == HIGHEST_NORMAL_GENERATION)
+        forward_hot_objects();
 
     wipe_nonpinned_words();
     // Do this last, because until wipe_nonpinned_words() happens,
@@ -3976,8 +5013,11 @@ garbage_collect_generation(generation_index_t generation, int raise)
     if (!raise) {
         for (i = 0; i < next_free_page; i++)
             if ((page_bytes_used(i) != 0)
-                && (page_table[i].gen == SCRATCH_GENERATION))
+                && (page_table[i].gen == SCRATCH_GENERATION)) {
                 page_table[i].gen = generation;
+                if (gc_remset_active && generation != 0)
+                    remset_add(i);
+            }
         gc_assert(g->bytes_allocated == 0);
         g->bytes_allocated = generations[SCRATCH_GENERATION].bytes_allocated;
         generations[SCRATCH_GENERATION].bytes_allocated = 0;
@@ -3989,6 +5029,8 @@ garbage_collect_generation(generation_index_t generation, int raise)
     /* Set the new gc trigger for the GCed generation. */
     g->gc_trigger = g->bytes_allocated + g->bytes_consed_between_gc;
     g->num_gc = raise ? 0 : (1 + g->num_gc);
+    END_PHASE(free_ns);
+#undef END_PHASE
 
 maybe_verify:
     if (generation >= verify_gens)
@@ -4058,10 +5100,11 @@ remap_page_range (page_index_t from, page_index_t to)
         set_page_need_to_zero(i, 0);
 }
 
-static void
+/* Return the number of pages released */
+static page_index_t
 remap_free_pages (page_index_t from, page_index_t to)
 {
-    page_index_t first_page, last_page;
+    page_index_t first_page, last_page, n_released = 0;
 
     for (first_page = from; first_page <= to; first_page++) {
         if (!page_free_p(first_page) || !page_need_to_zero(first_page))
@@ -4074,9 +5117,79 @@ remap_free_pages (page_index_t from, page_index_t to)
             last_page++;
 
         remap_page_range(first_page, last_page-1);
+        n_released += last_page - first_page;
 
         first_page = last_page;
     }
+    return n_released;
+}
+
+/* After a GC of an old generation, free pages are given back to the OS from
+ * the top of the heap down, until the pages which are in use or not yet
+ * released amount to 'gencgc_rss_target' bytes (0 meaning all of them).
+ * Given a GC helper thread, this happens in the background once the world
+ * is restarted, a chunk at a time with free_pages_lock held, so that an
+ * allocator gets either a page not yet released, which it zeroes itself as
+ * usual, or a zeroed one. The next GC stops it, and the pages it did not get
+ * to are released after that GC. */
+os_vm_size_t gencgc_rss_target = 0;
+#define RELEASE_CHUNK_BYTES (2*1024*1024)
+static struct {
+    page_index_t cursor;   // pages below this are yet to be looked at
+    page_index_t resident; // pages in use or not released, below 'cursor'
+    boolean stop;
+    boolean in_foreground; // while saving a core
+} release;
+
+static void release_free_pages(int __attribute__((unused)) worker,
+                               int __attribute__((unused)) n_workers,
+                               void __attribute__((unused)) *arg)
+{
+    page_index_t chunk = (RELEASE_CHUNK_BYTES > gencgc_release_granularity
+                          ? RELEASE_CHUNK_BYTES : gencgc_release_granularity)
+        / GENCGC_CARD_BYTES;
+    page_index_t target = gencgc_rss_target / GENCGC_CARD_BYTES;
+    boolean done;
+    do {
+        int ret = thread_mutex_lock(&free_pages_lock);
+        gc_assert(ret == 0);
+        done = release.stop || release.cursor <= 0 || release.resident <= target;
+        if (!done) {
+            page_index_t end = release.cursor;
+            page_index_t start = (end - 1) - (end - 1) % chunk;
+            release.resident -= remap_free_pages(start, end - 1);
+            release.cursor = start;
+        }
+        ret = thread_mutex_unlock(&free_pages_lock);
+        gc_assert(ret == 0);
+    } while (!done);
+}
+
+/* Called with the world stopped at the end of GC */
+static void start_releasing_free_pages(page_index_t limit)
+{
+    page_index_t page, n_resident = 0;
+    if (release.cursor > limit) // left over from last time
+        limit = release.cursor;
+    for (page = 0; page < limit; ++page)
+        if (!page_free_p(page) || page_need_to_zero(page))
+            ++n_resident;
+    release.cursor = limit;
+    release.resident = n_resident;
+    if (release.in_foreground || !gc_run_in_background(release_free_pages, 0))
+        release_free_pages(0, 1, 0);
+}
+
+/* Called at the start of GC */
+static void stop_releasing_free_pages()
+{
+    int ret = thread_mutex_lock(&free_pages_lock);
+    gc_assert(ret == 0);
+    release.stop = 1;
+    ret = thread_mutex_unlock(&free_pages_lock);
+    gc_assert(ret == 0);
+    gc_wait_for_background();
+    release.stop = 0;
 }
 
 generation_index_t small_generation_limit = 1;
@@ -4106,6 +5219,19 @@ collect_garbage(generation_index_t last_gen)
     static page_index_t high_water_mark = 0;
 
     FSHOW((stderr, "/entering collect_garbage(%d)\n", last_gen));
+    trace_begin("GC", last_gen);
+    uint64_t gc_start_ns = gc_clock_ns();
+    current_gc_event = &gc_event_log[gc_event_count % GC_EVENT_LOG_SIZE];
+    memset(current_gc_event, 0, sizeof (struct gc_event));
+    current_gc_event->stw_ns = stw_ns_for_next_gc_event;
+    current_gc_event->threads_stopped = threads_stopped_for_next_gc_event;
+    stw_ns_for_next_gc_event = threads_stopped_for_next_gc_event = 0;
+    stop_releasing_free_pages();
+    finish_lazy_sweep();
+    // The collector may change the protection of any page,
+    // which would expose the unfilled pages of a lazy core space
+    fill_lazy_core(0);
+    reclaim_alloc_profile_buffers();
     log_generation_stats(gc_logfile, "=== GC Start ===");
 
     gc_active_p = 1;
@@ -4141,8 +5267,10 @@ collect_garbage(generation_index_t last_gen)
     struct thread *th;
     for_each_thread(th) {
         ensure_region_closed(&th->alloc_region, BOXED_PAGE_FLAG);
+        resize_alloc_region(th);
     }
     gc_close_all_regions();
+    os_vm_size_t nursery_bytes = generations[0].bytes_allocated;
 
     /* Immobile space generation bits are lazily updated for gen0
        (not touched on every object allocation) so do it now */
@@ -4156,6 +5284,7 @@ collect_garbage(generation_index_t last_gen)
         print_generation_stats();
 
     if (gc_mark_only) {
+        current_gc_event->gen = 1+PSEUDO_STATIC_GENERATION;
         garbage_collect_generation(PSEUDO_STATIC_GENERATION, 0);
         goto finish;
     }
@@ -4171,7 +5300,8 @@ collect_garbage(generation_index_t last_gen)
         } else {
             raise =
                 (gen < last_gen)
-                || (generations[gen].num_gc >= generations[gen].number_of_gcs_before_promotion);
+                || (generations[gen].num_gc >= generations[gen].number_of_gcs_before_promotion)
+                || (gen == 0 && pause_goal_wants_promotion());
             /* If we would not normally raise this one, but we're
              * running low on space in comparison to the object-sizes
              * we've been seeing, raise it and collect the next one
@@ -4198,7 +5328,9 @@ collect_garbage(generation_index_t last_gen)
 
         memset(n_scav_calls, 0, sizeof n_scav_calls);
         memset(n_scav_skipped, 0, sizeof n_scav_skipped);
+        current_gc_event->gen = gen;
         garbage_collect_generation(gen, raise);
+        gcs_deferred[gen] = 0;
         if (gencgc_verbose)
             fprintf(stderr,
                     "code scavenged: %d total, %d skipped\n",
@@ -4221,7 +5353,9 @@ collect_garbage(generation_index_t last_gen)
                      && (generations[gen].bytes_allocated
                          > generations[gen].gc_trigger)
                      && (generation_average_age(gen)
-                         > generations[gen].minimum_age_before_gc))));
+                         > generations[gen].minimum_age_before_gc)
+                     && pause_goal_permits(gen, gc_clock_ns() - gc_start_ns))));
+    nursery_retained = generations[0].bytes_allocated;
 
     /* Now if gen-1 was raised all generations before gen are empty.
      * If it wasn't raised then all generations before gen-1 are empty.
@@ -4261,10 +5395,14 @@ collect_garbage(generation_index_t last_gen)
     next_free_page = find_next_free_page();
     set_alloc_pointer((lispobj)(page_address(next_free_page)));
 
+    update_pause_model(current_gc_event,
+                       current_gc_event->stw_ns + gc_clock_ns() - gc_start_ns,
+                       nursery_bytes);
+
     /* Update auto_gc_trigger. Make sure we trigger the next GC before
      * running out of heap! */
-    if (bytes_consed_between_gcs <= (dynamic_space_size - bytes_allocated))
-        auto_gc_trigger = bytes_allocated + bytes_consed_between_gcs;
+    if (nursery_size() <= (dynamic_space_size - bytes_allocated))
+        auto_gc_trigger = bytes_allocated + nursery_size();
     else
         auto_gc_trigger = bytes_allocated + (dynamic_space_size - bytes_allocated)/2;
 
@@ -4285,12 +5423,14 @@ collect_garbage(generation_index_t last_gen)
     if (gen > small_generation_limit) {
         if (next_free_page > high_water_mark)
             high_water_mark = next_free_page;
-        remap_free_pages(0, high_water_mark);
+        start_releasing_free_pages(high_water_mark);
         high_water_mark = 0;
     }
 
     large_allocation = 0;
  finish:
+    protect_huge_pages();
+    update_remset();
     write_protect_immobile_space();
     gc_active_p = 0;
 
@@ -4306,7 +5446,18 @@ collect_garbage(generation_index_t last_gen)
 #endif
     }
 
+    current_gc_event->gc_ns = gc_clock_ns() - gc_start_ns;
+    current_gc_event->serial = ++gc_event_count;
+    {
+        uint64_t *sum = (uint64_t*)&gc_event_sum, *ev = (uint64_t*)current_gc_event;
+        unsigned int j;
+        for (j = 0; j < sizeof (struct gc_event) / sizeof (uint64_t); ++j)
+            sum[j] += ev[j];
+    }
+    log_gc_event(gc_logfile, current_gc_event);
     log_generation_stats(gc_logfile, "=== GC End ===");
+    start_background_sweep();
+    trace_end("GC", last_gen);
     SHOW("returning from collect_garbage");
     // Increment the finalizer runflag.  This acts as a count of the number
     // of GCs as well as a notification to wake the finalizer thread.
@@ -4344,6 +5495,7 @@ gc_init(void)
     gc_assert(test.write_protected);
     *pflagbits = WP_CLEARED_FLAG;
     gc_assert(test.write_protected_cleared);
+    gc_thread_pool_init();
 }
 
 static void gc_allocate_ptes()
@@ -4377,6 +5529,18 @@ static void gc_allocate_ptes()
      */
     page_table = calloc(1+page_table_pages, sizeof(struct page));
     gc_assert(page_table);
+    lazy_sweep_pending = calloc(page_table_pages, 1);
+    gc_assert(lazy_sweep_pending);
+    remset_member = calloc(page_table_pages, 1);
+    remset_pages = calloc(page_table_pages, sizeof (page_index_t));
+    gc_assert(remset_member && remset_pages);
+    if (gc_n_threads > 1) {
+        root_page_dirty = calloc(page_table_pages, 1);
+        gc_assert(root_page_dirty);
+#if defined LISP_FEATURE_SB_THREAD && !defined LISP_FEATURE_WIN32
+        pthread_atfork(lock_free_pages, unlock_free_pages, unlock_free_pages);
+#endif
+    }
 
     gc_common_init();
     hopscotch_create(&pinned_objects, HOPSCOTCH_HASH_FUN_DEFAULT, 0 /* hashset */,
@@ -4450,6 +5614,8 @@ lisp_alloc(struct alloc_region *region, sword_t nbytes,
 #endif
         return(new_obj);        /* yup */
     }
+    thread->slow_path_allocs++;
+    trace_begin("alloc slow path", nbytes);
 
     /* We don't want to count nbytes against auto_gc_trigger unless we
      * have to: it speeds up the tenuring of objects and slows down
@@ -4492,12 +5658,19 @@ lisp_alloc(struct alloc_region *region, sword_t nbytes,
             }
         }
     }
-    if (nbytes >= LARGE_OBJECT_SIZE && !(page_type_flag & CONS_PAGE_FLAG))
+    int lowtag = (page_type_flag & CONS_PAGE_FLAG) ? LIST_POINTER_LOWTAG : OTHER_POINTER_LOWTAG;
+    uword_t claimed; // bytes of heap taken from the allocator
+    if (nbytes >= LARGE_OBJECT_SIZE && !(page_type_flag & CONS_PAGE_FLAG)) {
         new_obj = gc_alloc_large(nbytes, page_type_flag, region);
-    else {
+        claimed = nbytes;
+    } else {
+        claimed = thread->alloc_epoch_bytes;
         page_type_flag &= ~CONS_PAGE_FLAG;
+        // The code region is shared, so its size is not up to any one thread
+        sword_t goal = page_type_flag == CODE_PAGE_TYPE ? 0 : thread->alloc_region_goal;
         ensure_region_closed(region, page_type_flag);
-        gc_alloc_new_region(nbytes, page_type_flag, region);
+        gc_alloc_new_region(nbytes, goal, page_type_flag, region);
+        thread->alloc_epoch_bytes += addr_diff(region->end_addr, region->start_addr);
         new_obj = region->free_pointer;
         new_free_pointer = (char*)new_obj + nbytes;
         gc_assert(new_free_pointer <= (char*)region->end_addr);
@@ -4507,8 +5680,10 @@ lisp_alloc(struct alloc_region *region, sword_t nbytes,
         if (addr_diff(region->end_addr, region->free_pointer) <= 4 * N_WORD_BYTES) {
             ensure_region_closed(region, page_type_flag);
             // Request > 4 words, forcing a new page to be claimed.
-            gc_alloc_new_region(6 * N_WORD_BYTES, page_type_flag, region);
+            gc_alloc_new_region(6 * N_WORD_BYTES, goal, page_type_flag, region);
+            thread->alloc_epoch_bytes += addr_diff(region->end_addr, region->start_addr);
         }
+        claimed = thread->alloc_epoch_bytes - claimed;
     }
 
 #if !(defined LISP_FEATURE_PPC || defined LISP_FEATURE_PPC64 \
@@ -4521,8 +5696,14 @@ lisp_alloc(struct alloc_region *region, sword_t nbytes,
     extern void allocator_record_backtrace(void*, struct thread*);
     if (gencgc_alloc_profiler && thread->state_word.sprof_enable)
         allocator_record_backtrace(__builtin_frame_address(0), thread);
+    if (heap_profile_interval)
+        heap_profile_sample(thread, make_lispobj(new_obj, lowtag), claimed,
+                            __builtin_frame_address(0));
+#else
+    (void)lowtag; (void)claimed;
 #endif
 
+    trace_end("alloc slow path", nbytes);
     return (new_obj);
 }
 
@@ -4590,6 +5771,9 @@ boolean continue_after_memoryfault_on_unprotected_pages = 0;
 int
 gencgc_handle_wp_violation(void* fault_addr)
 {
+    if (lazy_core_handle_fault(fault_addr))
+        return 1;
+
     page_index_t page_index = find_page_index(fault_addr);
 
 #if QSHOW_SIGNALS
@@ -4623,6 +5807,12 @@ gencgc_handle_wp_violation(void* fault_addr)
         // concurrently for the same page are fine because they're all doing
         // the same bit operations.
         gc_assert(!(page_table[page_index].type & OPEN_REGION_PAGE_FLAG));
+        if (readonly_core_page_p(page_index)) {
+            // A constant that the core was saved to share. Let Lisp signal
+            // an error rather than make the page private to this process.
+            unhandled_sigmemoryfault(fault_addr);
+            return 0;
+        }
         unsigned char *pflagbits = (unsigned char*)&page_table[page_index].gen - 1;
         unsigned char flagbits = __sync_fetch_and_add(pflagbits, 0);
         if (flagbits & WRITE_PROTECTED_FLAG) {
@@ -4692,7 +5882,8 @@ zero_all_free_ranges() /* called only by gc_and_save() */
  *   unset that flag from all pages.
  * + The pseudo-static generation isn't normally collected, but it seems
  *   reasonable to collect it at least when saving a core. So move the
- *   pages to a normal generation.
+ *   pages to a normal generation. Unless saving a delta core, where the
+ *   pages loaded from the base core have to stay where they are.
  */
 static void
 prepare_for_final_gc ()
@@ -4700,11 +5891,17 @@ prepare_for_final_gc ()
     page_index_t i;
 
     prepare_immobile_space_for_final_gc ();
+    // Constants that were mapped read-only get collected like the rest
+    if (readonly_core_page_end > readonly_core_page_start)
+        os_protect(page_address(readonly_core_page_start),
+                   npage_bytes(readonly_core_page_end - readonly_core_page_start),
+                   OS_VM_PROT_ALL);
+    readonly_core_page_start = readonly_core_page_end = 0;
     for (i = 0; i < next_free_page; i++) {
         // Compaction requires that we permit large objects to be copied henceforth.
         // Object of size >= LARGE_OBJECT_SIZE get re-allocated to single-object pages.
         page_table[i].type &= ~SINGLE_OBJECT_FLAG;
-        if (page_table[i].gen == PSEUDO_STATIC_GENERATION) {
+        if (page_table[i].gen == PSEUDO_STATIC_GENERATION && !delta_base_core) {
             int used = page_bytes_used(i);
             page_table[i].gen = HIGHEST_NORMAL_GENERATION;
             generations[PSEUDO_STATIC_GENERATION].bytes_allocated -= used;
@@ -4735,17 +5932,151 @@ prepare_for_final_gc ()
  * plus literal strings in code compiled to memory. */
 char gc_coalesce_string_literals = 0;
 
+/* Set this switch to 1 to move the constants that contain no pointers
+ * onto pages of their own, which are mapped read-only by the loader */
+char gc_readonly_constants = 0;
+
+/* The pages of constants which are never written, so that all processes
+ * mapping the same core file keep sharing them. See coalesce.c */
+page_index_t readonly_core_page_start, readonly_core_page_end;
+
+/* Claim free pages for 'nbytes' of unboxed objects in the pseudo-static
+ * generation, which the final GC will neither move nor allocate into,
+ * and return their address, or 0 if dynamic space has no such room */
+char* gc_claim_readonly_pages(sword_t nbytes)
+{
+    page_index_t npages = (nbytes + GENCGC_CARD_BYTES - 1) / GENCGC_CARD_BYTES;
+    page_index_t first = 0, page;
+    for (page = 0; page < page_table_pages && page - first < npages; ++page)
+        if (!page_free_p(page)) first = page + 1;
+    if (page - first < npages) return 0;
+    for (page = first; page < first + npages; ++page) {
+        page_table[page].type = UNBOXED_PAGE_FLAG;
+        page_table[page].gen = PSEUDO_STATIC_GENERATION;
+        set_page_scan_start_offset(page, npage_bytes(page - first));
+        set_page_bytes_used(page, GENCGC_CARD_BYTES);
+        set_page_need_to_zero(page, 1);
+    }
+    bytes_allocated += npage_bytes(npages);
+    generations[PSEUDO_STATIC_GENERATION].bytes_allocated += npage_bytes(npages);
+    if (first + npages > next_free_page) {
+        next_free_page = first + npages;
+        set_alloc_pointer((lispobj)page_address(next_free_page));
+    }
+    readonly_core_page_start = first;
+    readonly_core_page_end = first + npages;
+    return page_address(first);
+}
+
+/* The access profile to save with, as written by gc_write_access_profile() */
+char *gc_access_profile;
+
+/* Write the cards of dynamic space loaded from the core (those still in
+ * the pseudo-static generation) of which any OS page is present or swapped
+ * out, i.e. has been touched since the core was mapped from its file.
+ * Return 0 on success, or -1 if not supported or on error */
+int gc_write_access_profile(char *filename)
+{
+#ifdef LISP_FEATURE_LINUX
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0)
+        return -1;
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        close(fd);
+        return -1;
+    }
+    fprintf(file, "dynamic %lx %d\n", (unsigned long)DYNAMIC_SPACE_START, GENCGC_CARD_BYTES);
+    uint64_t entries[64];
+    page_index_t page;
+    int result = 0;
+    for (page = 0; page < next_free_page && !result; ++page) {
+        if (page_table[page].gen != PSEUDO_STATIC_GENERATION || !page_bytes_used(page))
+            continue;
+        uword_t os_page = (uword_t)page_address(page) / os_vm_page_size;
+        uword_t end = ((uword_t)page_address(page) + GENCGC_CARD_BYTES - 1)
+            / os_vm_page_size + 1;
+        boolean touched = 0;
+        while (os_page < end && !touched) {
+            int i, n = end - os_page > 64 ? 64 : end - os_page;
+            if (pread(fd, entries, n * sizeof (uint64_t), os_page * sizeof (uint64_t))
+                != (ssize_t)(n * sizeof (uint64_t))) {
+                result = -1;
+                break;
+            }
+            for (i = 0; i < n; ++i)
+                if (entries[i] >> 62) // bit 63 = present, 62 = swapped
+                    touched = 1;
+            os_page += n;
+        }
+        if (touched)
+            fprintf(file, "%ld\n", (long)page);
+    }
+    close(fd);
+    if (fclose(file))
+        result = -1;
+    return result;
+#else
+    return -1;
+#endif
+}
+
+/* Note the objects on the cards listed in 'filename', in order of
+ * address, if the profile was written for this dynamic space */
+static void note_hot_objects(char *filename, boolean verbose)
+{
+    FILE *file = fopen(filename, "r");
+    unsigned long start;
+    int card_bytes;
+    long page;
+    if (!file
+        || fscanf(file, "dynamic %lx %d", &start, &card_bytes) != 2
+        || start != DYNAMIC_SPACE_START || card_bytes != GENCGC_CARD_BYTES) {
+        fprintf(stderr, "WARNING: ignoring unusable access profile %s\n", filename);
+        if (file) fclose(file);
+        return;
+    }
+    sword_t capacity = 1024;
+    hot_objects.objects = successful_malloc(capacity * sizeof (lispobj));
+    lispobj *last = 0;
+    while (fscanf(file, "%ld", &page) == 1) {
+        if (page < 0 || page >= next_free_page || !page_bytes_used(page)
+            || page_table[page].gen != PSEUDO_STATIC_GENERATION)
+            continue;
+        lispobj *where = page_scan_start(page);
+        lispobj *end = (lispobj*)(page_address(page) + page_bytes_used(page));
+        for ( ; where < end ; where += OBJECT_SIZE(*where, where)) {
+            // Take every object overlapping the card, each only once
+            if (where <= last || (char*)(where + OBJECT_SIZE(*where, where)) <= page_address(page)
+                || filler_obj_p(where))
+                continue;
+            if (hot_objects.count == capacity) {
+                capacity *= 2;
+                hot_objects.objects = realloc(hot_objects.objects, capacity * sizeof (lispobj));
+                if (!hot_objects.objects)
+                    lose("can't grow the table of hot objects");
+            }
+            hot_objects.objects[hot_objects.count++] = compute_lispobj(where);
+            last = where;
+        }
+    }
+    fclose(file);
+    if (verbose)
+        printf("[%ld objects in the access profile]\n", (long)hot_objects.count);
+}
+
 /* Do a non-conservative GC, and then save a core with the initial
  * function being set to the value of 'lisp_init_function' */
 void
 gc_and_save(char *filename, boolean prepend_runtime,
-            boolean save_runtime_options, boolean compressed,
+            boolean save_runtime_options, int compression,
             int compression_level, int application_type)
 {
     FILE *file;
     void *runtime_bytes = NULL;
     size_t runtime_size;
     extern void coalesce_similar_objects();
+    extern void move_readonly_constants(boolean);
     boolean verbose = !lisp_startup_options.noinform;
 
     file = prepare_to_save(filename, prepend_runtime, &runtime_bytes,
@@ -4801,6 +6132,9 @@ gc_and_save(char *filename, boolean prepend_runtime,
      *  as empty pages, because we can't represent discontiguous ranges.
      */
     conservative_stack = 0;
+    // Nothing may touch free pages behind the back of what follows
+    stop_releasing_free_pages();
+    release.in_foreground = 1;
     /* We MUST collect all generations now, or else the coalescing by similarity
      * would have to be extra cautious not to create any old->young pointers.
      * Resetting oldest_gen_to_gc to its default is legal, because it is merely
@@ -4809,6 +6143,10 @@ gc_and_save(char *filename, boolean prepend_runtime,
      * that some objects be retained despite appearing to be unreachable.
      */
     gencgc_oldest_gen_to_gc = HIGHEST_NORMAL_GENERATION;
+    // The profiled pages are found where the core put them, so this
+    // has to be done before anything moves.
+    if (gc_access_profile)
+        note_hot_objects(gc_access_profile, verbose);
     // From here on until exit, there is no chance of continuing
     // in Lisp if something goes wrong during GC.
     prepare_for_final_gc();
@@ -4824,6 +6162,8 @@ gc_and_save(char *filename, boolean prepend_runtime,
         printf("[coalescing similar vectors... ");
         fflush(stdout);
     }
+    if (hot_objects.live)
+        index_hot_objects();
     /* FIXME: add comment explaining why coalescing is deferred until
      * after the penultimate GC. Must it wait ? */
     coalesce_similar_objects();
@@ -4834,8 +6174,19 @@ gc_and_save(char *filename, boolean prepend_runtime,
      * down and perform a relocation instead of a collection? */
     if (verbose) { printf("[performing final GC..."); fflush(stdout); }
     prepare_for_final_gc();
+    // The pages of read-only constants are claimed from the low pages
+    // freed by the penultimate GC, and the final GC allocates around them.
+    if (gc_readonly_constants)
+        move_readonly_constants(verbose);
     gencgc_alloc_start_page = 0;
     collect_garbage(HIGHEST_NORMAL_GENERATION+1);
+    if (hot_objects.indexed) {
+        hopscotch_destroy(&hot_objects.index);
+        hot_objects.indexed = 0;
+    }
+    free(hot_objects.objects);
+    hot_objects.objects = 0;
+    hot_objects.count = 0;
 #ifdef SINGLE_THREAD_BOXED_REGION // clean up static-space object pre-save.
     gc_init_region(SINGLE_THREAD_BOXED_REGION);
 #endif
@@ -4851,8 +6202,9 @@ gc_and_save(char *filename, boolean prepend_runtime,
     zero_all_free_ranges();
     // Assert that defrag will not move the init_function
     gc_assert(!immobile_space_p(lisp_init_function));
-    // Defragment and set all objects' generations to pseudo-static
-    prepare_immobile_space_for_save(verbose);
+    // Defragment (except against a base core, whose objects must not move)
+    // and set all objects' generations to pseudo-static
+    prepare_immobile_space_for_save(!delta_base_core, verbose);
 
 #ifdef LISP_FEATURE_X86_64
     untune_asm_routines_for_microarch();
@@ -4870,7 +6222,7 @@ gc_and_save(char *filename, boolean prepend_runtime,
 
     save_to_filehandle(file, filename, lisp_init_function,
                        prepend_runtime, save_runtime_options,
-                       compressed ? compression_level : COMPRESSION_LEVEL_NONE);
+                       compression, compression_level);
     /* Oops. Save still managed to fail. Since we've mangled the stack
      * beyond hope, there's not much we can do.
      * (beyond FUNCALLing lisp_init_function, but I suspect that's
@@ -4880,6 +6232,54 @@ gc_and_save(char *filename, boolean prepend_runtime,
 
 /* Read corefile ptes from 'fd' which has already been positioned
  * and store into the page table */
+#ifdef LAZY_CORE_PAGES
+/* Whether [start,start+len) of a lazy core space holds unboxed
+ * pages, whose contents could be handed to system calls */
+static int unboxed_chunk_p(char *start, size_t len)
+{
+    page_index_t page = find_page_index(start), last = find_page_index(start + len - 1);
+    for ( ; page <= last; ++page)
+        if ((page_table[page].type & PAGE_TYPE_MASK) == UNBOXED_PAGE_FLAG)
+            return 1;
+    return 0;
+}
+#endif
+
+/* Ask for transparent huge pages for the part of dynamic space which isn't
+ * mapped from the core (private file mappings don't get them anyway) and for
+ * code space. Memory is then given back to the OS a whole huge page at a time
+ * and write protection applies to whole huge pages, so as not to split them */
+static void gc_enable_huge_pages()
+{
+#if defined LISP_FEATURE_LINUX && defined MADV_HUGEPAGE
+    long bytes = 0;
+    FILE *file = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+    if (file) {
+        if (fscanf(file, "%ld", &bytes) != 1)
+            bytes = 0;
+        fclose(file);
+    }
+    char *start = PTR_ALIGN_UP((char*)anon_dynamic_space_start, bytes ? bytes : 1);
+    char *end = PTR_ALIGN_DOWN((char*)DYNAMIC_SPACE_START + dynamic_space_size,
+                               bytes ? bytes : 1);
+    if (bytes <= GENCGC_CARD_BYTES || bytes % GENCGC_CARD_BYTES || start >= end
+        || madvise(start, end - start, MADV_HUGEPAGE)) {
+        fprintf(stderr, "WARNING: huge pages are not available\n");
+        return;
+    }
+    huge_page_first_card = find_page_index(start);
+    cards_per_huge_page = bytes / GENCGC_CARD_BYTES;
+    if (gencgc_release_granularity < (os_vm_size_t)bytes)
+        gencgc_release_granularity = bytes;
+#ifdef LISP_FEATURE_IMMOBILE_SPACE
+    // Code space is never protected by the OS, so it can simply be advised
+    madvise((void*)VARYOBJ_SPACE_START, VARYOBJ_SPACE_SIZE, MADV_HUGEPAGE);
+#endif
+#else
+    fprintf(stderr, "WARNING: huge pages are not supported on this platform\n");
+#endif
+}
+
 void gc_load_corefile_ptes(core_entry_elt_t n_ptes, core_entry_elt_t total_bytes,
                            os_vm_offset_t offset, int fd)
 {
@@ -4918,11 +6318,16 @@ void gc_load_corefile_ptes(core_entry_elt_t n_ptes, core_entry_elt_t total_bytes
             struct corefile_pte pte;
             memcpy(&pte, data+i*sizeof (struct corefile_pte), sizeof pte);
             // Low 2 bits of the corefile_pte hold the 'type' flags.
-            // Low bit of bytes_used indicates a large (a/k/a single) object.
+            // Low bit of bytes_used indicates a large (a/k/a single) object,
+            // and the next bit a page of read-only constants.
             char type = ((pte.bytes_used & 1) ? SINGLE_OBJECT_FLAG : 0)
                         | (pte.sso & 0x03);
             page_table[page].type = type;
-            pte.bytes_used &= ~1;
+            if (pte.bytes_used & 2) {
+                if (!readonly_core_page_end) readonly_core_page_start = page;
+                readonly_core_page_end = page + 1;
+            }
+            pte.bytes_used &= ~3;
             if (type != FREE_PAGE_FLAG) {
                 /* It is possible, though rare, for the saved page table
                  * to contain free pages below alloc_ptr. */
@@ -4939,6 +6344,7 @@ void gc_load_corefile_ptes(core_entry_elt_t n_ptes, core_entry_elt_t total_bytes
               ((char*)get_alloc_pointer() - page_address(0)));
     // write-protecting needs the current value of next_free_page
     next_free_page = n_ptes;
+    fill_lazy_core(unboxed_chunk_p);
     if (gen != 0 && ENABLE_PAGE_PROTECTION) {
         // coreparse can avoid hundreds to thousands of mprotect() calls by
         // treating the whole range from the corefile as protectable, except
@@ -4979,7 +6385,12 @@ void gc_load_corefile_ptes(core_entry_elt_t n_ptes, core_entry_elt_t total_bytes
             os_protect(page_address(start), npage_bytes(end - start), OS_VM_PROT_JIT_READ);
             start = end;
         }
+        protect_lazy_core();
     }
+    if (gencgc_huge_pages)
+        gc_enable_huge_pages();
+    if (gencgc_numa)
+        gc_init_numa();
 
 #ifdef LISP_FEATURE_DARWIN_JIT
     /* For some reason doing an early pthread_jit_write_protect_np sometimes fails.
@@ -4990,6 +6401,49 @@ void gc_load_corefile_ptes(core_entry_elt_t n_ptes, core_entry_elt_t total_bytes
 
 }
 
+/* Read the 'n_ptes' corefile ptes at 'offset' in 'fd', and return one byte
+ * per page which is nonzero if an object begins at the start of the page.
+ * The loader uses this to divide dynamic space among threads before the
+ * page table proper is loaded. */
+char* gc_read_block_starts(core_entry_elt_t n_ptes, os_vm_offset_t offset, int fd)
+{
+    size_t nbytes = n_ptes * sizeof (struct corefile_pte);
+    char* data = successful_malloc(nbytes + 1);
+    char* starts = successful_malloc(n_ptes + 1);
+    if (lseek(fd, offset, SEEK_SET) != offset
+        || read(fd, data, nbytes) != (ssize_t)nbytes)
+        lose("failed to read page table");
+    page_index_t page;
+    for (page = 0; page < (page_index_t)n_ptes; ++page) {
+        struct corefile_pte pte;
+        memcpy(&pte, data + page * sizeof (struct corefile_pte), sizeof pte);
+        // A used page with a scan start offset of 0 begins a contiguous block.
+        // The low bits of each field are flags (see gc_load_corefile_ptes)
+        starts[page] = (pte.bytes_used & ~3) != 0 && (pte.sso & ~0x03) == 0;
+    }
+    free(data);
+    return starts;
+}
+
+#ifdef LAZY_CORE_PAGES
+void gc_restore_core_protection(char *start, size_t len, char *where)
+{
+    if (!page_table || !ENABLE_PAGE_PROTECTION) {
+        if (where == start)
+            os_protect((os_vm_address_t)where, len, OS_VM_PROT_ALL);
+        return;
+    }
+    // A fresh copy is already unprotected
+    page_index_t page = find_page_index(start), last = find_page_index(start + len - 1);
+    for ( ; page <= last; ++page) {
+        boolean protect = page_table[page].write_protected && !(non_protectable_page_p(page));
+        if (protect || where == start)
+            os_protect((os_vm_address_t)where + (page_address(page) - start), npage_bytes(1),
+                       protect ? OS_VM_PROT_JIT_READ : OS_VM_PROT_ALL);
+    }
+}
+#endif
+
 /* Prepare the array of corefile_ptes for save */
 void gc_store_corefile_ptes(struct corefile_pte *ptes)
 {
@@ -5004,7 +6458,7 @@ void gc_store_corefile_ptes(struct corefile_pte *ptes)
         ptes[i].sso = word | (0x03 & page_table[i].type);
         page_bytes_t used = page_bytes_used(i);
         gc_assert(!(used & LOWTAG_MASK));
-        ptes[i].bytes_used = used | page_single_obj_p(i);
+        ptes[i].bytes_used = used | page_single_obj_p(i) | (readonly_core_page_p(i) << 1);
     }
 }
 
@@ -55,6 +55,10 @@ static inline lispobj points_to_asm_code_p(uword_t ptr) {
 extern boolean alloc_profiling;
 extern os_vm_address_t alloc_profile_buffer;
 extern lispobj alloc_profile_data; // Lisp SIMPLE-VECTOR
+struct thread;
+extern void assign_alloc_profile_buffer(struct thread*);
+extern void release_alloc_profile_buffer(struct thread*);
+extern void reclaim_alloc_profile_buffers(void);
 
 #ifdef LISP_FEATURE_WIN32
 #define ENVIRON _environ
@@ -1307,13 +1307,15 @@ int* code_component_order;
  * 'coreparse' causes all pages in dynamic space to be pseudo-static, but
  * each immobile object stores its own generation, so this must be done at
  * save time, or else it would require touching every object on startup */
-void prepare_immobile_space_for_save(boolean verbose)
+void prepare_immobile_space_for_save(boolean defrag, boolean verbose)
 {
-    if (verbose) {
-        printf("[defragmenting immobile space... ");
-        fflush(stdout);
+    if (defrag) {
+        if (verbose) {
+            printf("[defragmenting immobile space... ");
+            fflush(stdout);
+        }
+        defrag_immobile_space(verbose);
     }
-    defrag_immobile_space(verbose);
 
     lispobj* obj = (lispobj*)FIXEDOBJ_SPACE_START;
     lispobj* limit = fixedobj_free_pointer;
@@ -1338,7 +1340,7 @@ void prepare_immobile_space_for_save(boolean verbose)
         } else
             assign_generation(obj, PSEUDO_STATIC_GENERATION);
     }
-    if (verbose) printf("done]\n");
+    if (defrag && verbose) printf("done]\n");
 }
 
 //// Interface
@@ -21,7 +21,7 @@
 #define FIXEDOBJ_RESERVED_PAGES 1
 
 extern void prepare_immobile_space_for_final_gc(void);
-extern void prepare_immobile_space_for_save(boolean verbose);
+extern void prepare_immobile_space_for_save(boolean defrag, boolean verbose);
 extern boolean immobile_space_preserve_pointer(void*);
 extern void update_immobile_nursery_bits(void);
 extern void scavenge_immobile_roots(generation_index_t,generation_index_t);
@@ -113,7 +113,7 @@ extern boolean immobile_card_protected_p(void*);
 static inline boolean immobile_space_p(lispobj __attribute__((unused)) obj) { return 0; }
 #define immobile_obj_gen_bits(dummy) 0
 #define prepare_immobile_space_for_final_gc()
-#define prepare_immobile_space_for_save(dummy)
+#define prepare_immobile_space_for_save(dummy1,dummy2)
 #define immobile_space_preserve_pointer(dummy) 0
 #define scavenge_immobile_roots(dummy1,dummy2)
 #define scavenge_immobile_newspace(dummy)
@@ -69,11 +69,7 @@
 #include "genesis/cons.h"
 #include "genesis/vector.h"
 
-#ifdef ATOMIC_LOGGING
-#include "atomiclog.inc"
-uword_t *eventdata;
-int n_logevents;
-#endif
+#include "tracelog.h"
 
 #ifdef ADDRESS_SANITIZER
 #include <sanitizer/asan_interface.h>
@@ -294,35 +290,8 @@ __attribute__((unused)) static char* cur_thread_name()
  * kernel properly, so we fix it up ourselves in the
  * arch_os_get_context(..) function. -- CSR, 2002-07-23
  */
-#ifdef ATOMIC_LOGGING
-void dump_eventlog()
-{
-    int i = 0;
-    uword_t *e = eventdata;
-    while (i<n_logevents) {
-        char *fmt = (char*)e[i+1];
-        switch (e[i]) {
-        default: printf("busted event log"); return;
-        case 2: printf(fmt); break;
-        case 3: printf(fmt,e[i+2]); break;
-        case 4: printf(fmt,e[i+2],e[i+3]); break;
-        case 5: printf(fmt,e[i+2],e[i+3],e[i+4]); break;
-        case 6: printf(fmt,e[i+2],e[i+3],e[i+4],e[i+5]); break;
-        case 7: printf(fmt,e[i+2],e[i+3],e[i+4],e[i+5],e[i+6]); break;
-        }
-        putchar('\n');
-        i += e[i];
-    }
-}
-static void record_signal(int sig, void* context)
-{
-    event3("sig%d @%p in %d", sig, (void*)*os_context_pc_addr(context),
-           (int)get_sb_vm_thread()->os_kernel_tid);
-}
-#define RECORD_SIGNAL(sig,ctxt) if(sig!=SIGSEGV)record_signal(sig,ctxt);
-#else
-#define RECORD_SIGNAL(sig,ctxt)
-#endif
+// Memory faults are too frequent to be worth a trace event
+#define RECORD_SIGNAL(sig,ctxt) if(sig!=SIGSEGV)trace_instant("signal",sig);
 
 #ifdef LISP_FEATURE_WIN32
 # define should_handle_in_this_thread(c) (1)
@@ -1438,6 +1407,14 @@ sig_stop_for_gc_handler(int __attribute__((unused)) signal,
     /* We say that the thread is "stopped" as of now, but the blocking operation
      * occurs below at thread_wait_until_not(STATE_STOPPED). Note that sem_post()
      * is expressly permitted in signal handlers, and set_thread_state uses it */
+#ifdef STOP_THE_WORLD_BARRIER
+    /* Read before stopping, since once this thread is stopped, the world may
+     * be restarted at any moment */
+    int generation = stw_generation;
+#define wait_until_resumed(thread) wait_for_world_start(thread, generation)
+#else
+#define wait_until_resumed(thread) thread_wait_until_not(STATE_STOPPED, thread)
+#endif
     set_thread_state(thread, STATE_STOPPED, 0);
     FSHOW_SIGNAL((stderr,"suspended\n"));
 
@@ -1447,7 +1424,7 @@ sig_stop_for_gc_handler(int __attribute__((unused)) signal,
      * actually a must. */
     scrub_control_stack();
 
-    /* Now we wait on a semaphore, which, to be pedantic, is not specified as async-safe.
+    /* Now we wait on a semaphore or futex, which, to be pedantic, is not specified as async-safe.
      * Normally the way to implement a "suspend" operation is to issue any blocking
      * syscall such as sigsuspend() or select(). Apparently every OS + C runtime that
      * we wish to support has no problem with sem_wait() here in the signal handler. */
@@ -1457,7 +1434,7 @@ sig_stop_for_gc_handler(int __attribute__((unused)) signal,
     {
     struct timespec t_beginwait, t_endwait, t_runtime;
     clock_gettime(CLOCK_MONOTONIC, &t_beginwait);
-    my_state = thread_wait_until_not(STATE_STOPPED, thread);
+    my_state = wait_until_resumed(thread);
     clock_gettime(CLOCK_MONOTONIC, &t_endwait);
     clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t_runtime);
     // calculate CPU time in microseconds
@@ -1471,8 +1448,9 @@ sig_stop_for_gc_handler(int __attribute__((unused)) signal,
     pthread_cond_broadcast(&gcmetrics_condvar);
     }
 #else
-    int my_state = thread_wait_until_not(STATE_STOPPED, thread);
+    int my_state = wait_until_resumed(thread);
 #endif
+#undef wait_until_resumed
 
     FSHOW_SIGNAL((stderr,"resumed\n"));
 
@@ -1998,9 +1976,6 @@ sigabrt_handler(int __attribute__((unused)) signal,
 void
 interrupt_init(void)
 {
-#ifdef ATOMIC_LOGGING
-    eventdata = calloc(EVENTBUFMAX, N_WORD_BYTES);
-#endif
     int __attribute__((unused)) i;
     SHOW("entering interrupt_init()");
     sigemptyset(&deferrable_sigset);
@@ -0,0 +1,249 @@
+/*
+ * Parallel and on-demand processing of the spaces of a core being loaded
+ */
+
+/*
+ * This software is part of the SBCL system. See the README file for
+ * more information.
+ *
+ * This software is derived from the CMU CL system, which was
+ * written at Carnegie Mellon University and released into the
+ * public domain. The software is in the public domain and is
+ * provided with absolutely no warranty. See the COPYING and CREDITS
+ * files for more information.
+ */
+
+#ifdef __linux__
+# define _GNU_SOURCE /* for mremap() */
+#endif
+#include "sbcl.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "runtime.h"
+#include "interr.h"
+#include "gc-assert.h"
+#include "lazy-core.h"
+
+#if defined LISP_FEATURE_SB_THREAD && !defined LISP_FEATURE_WIN32
+# include <pthread.h>
+# include <signal.h>
+# define MAX_CHUNK_THREADS 64
+#else
+# define MAX_CHUNK_THREADS 1
+#endif
+
+#ifdef LAZY_CORE_PAGES
+# include <sched.h>
+# include <signal.h>
+# include <sys/mman.h>
+# include "interrupt.h"
+#endif
+
+struct chunk_loop {
+    chunk_action action;
+    void *arg;
+    sword_t next, end;
+};
+
+static void *chunk_worker(void *arg)
+{
+    struct chunk_loop *loop = arg;
+    sword_t chunk;
+    while ((chunk = __sync_fetch_and_add(&loop->next, 1)) < loop->end)
+        loop->action(chunk, loop->arg);
+    return 0;
+}
+
+int chunk_thread_count(void)
+{
+#if MAX_CHUNK_THREADS > 1
+    long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    return n_threads < 1 ? 1 : n_threads > MAX_CHUNK_THREADS ? MAX_CHUNK_THREADS : n_threads;
+#else
+    return 1;
+#endif
+}
+
+/* The helper threads are not Lisp threads, and run with all signals blocked */
+void for_each_chunk(sword_t start, sword_t end, chunk_action action, void *arg)
+{
+    struct chunk_loop loop = { action, arg, start, end };
+#if MAX_CHUNK_THREADS > 1
+    pthread_t threads[MAX_CHUNK_THREADS];
+    long n_threads = chunk_thread_count();
+    if (n_threads > end - start) n_threads = end - start;
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    long i;
+    for (i = 1; i < n_threads; ++i)
+        if (pthread_create(&threads[i], 0, chunk_worker, &loop))
+            break; // do the rest with fewer threads
+    n_threads = i;
+    pthread_sigmask(SIG_SETMASK, &old, 0);
+    chunk_worker(&loop);
+    for (i = 1; i < n_threads; ++i)
+        pthread_join(threads[i], 0);
+#else
+    chunk_worker(&loop);
+#endif
+}
+
+#ifdef LAZY_CORE_PAGES
+/* A lazy space is left inaccessible after loading, and each chunk of it is
+ * filled in by the first access to it, from the memory fault handler.
+ * A chunk is filled into a fresh mapping, which is then moved over the
+ * chunk's pages with mremap(), so that other threads see either no page or
+ * the finished one. Unboxed pages are filled at load time nonetheless,
+ * because their contents may be passed to system calls, which fail rather
+ * than fault on an inaccessible page. And everything left is filled when the
+ * first GC starts, so that the collector never changes the protection of a
+ * page that isn't there yet. */
+static struct {
+    char *addr;
+    size_t len, chunk_bytes;
+    sword_t n_chunks;
+    int (*fill)(sword_t chunk, char *copy, int slot);
+    /* 0 = not filled, 1 = being filled, 2 = filled */
+    char *chunk_state;
+    /* Which of the fill's scratch slots are taken */
+    int n_slots;
+    char slot_busy[MAX_CHUNK_THREADS];
+    sword_t chunks_remaining;
+    int (*wanted)(char *start, size_t len);
+} lazy;
+
+static inline size_t lazy_chunk_size(sword_t chunk)
+{
+    size_t start = chunk * lazy.chunk_bytes;
+    return lazy.len - start < lazy.chunk_bytes ? lazy.len - start : lazy.chunk_bytes;
+}
+
+/* There are usually as many slots as for_each_chunk() threads, so only
+ * faults from several Lisp threads at once have to wait for one */
+static int claim_fill_slot(void)
+{
+    for (;;) {
+        int slot;
+        for (slot = 0; slot < lazy.n_slots; ++slot)
+            if (__sync_bool_compare_and_swap(&lazy.slot_busy[slot], 0, 1))
+                return slot;
+        sched_yield();
+    }
+}
+
+static void fill_lazy_chunk(sword_t chunk, void __attribute__((unused)) *arg)
+{
+    char *state = &lazy.chunk_state[chunk];
+    char *start = lazy.addr + chunk * lazy.chunk_bytes;
+    size_t bytes = lazy_chunk_size(chunk);
+    if (__sync_fetch_and_add(state, 0) == 2
+        || (lazy.wanted && !lazy.wanted(start, bytes)))
+        return;
+    if (__sync_bool_compare_and_swap(state, 0, 1)) {
+        char *copy = mmap(0, bytes, OS_VM_PROT_ALL, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (copy == MAP_FAILED)
+            lose("can't map %lu bytes to load core (errno = %i)",
+                 (unsigned long)bytes, errno);
+        int slot = claim_fill_slot();
+        int filled = lazy.fill(chunk, copy, slot);
+        __sync_lock_release(&lazy.slot_busy[slot]);
+        if (filled) {
+            gc_restore_core_protection(start, bytes, copy);
+            if (mremap(copy, bytes, bytes, MREMAP_MAYMOVE|MREMAP_FIXED, start) != start)
+                lose("can't move core chunk into place (errno = %i)", errno);
+        } else {
+            munmap(copy, bytes);
+            // Readers can go ahead; writers fault and wait until we're done
+            os_protect((os_vm_address_t)start, bytes, OS_VM_PROT_READ);
+            gc_restore_core_protection(start, bytes, start);
+        }
+        __sync_lock_test_and_set(state, 2);
+        __sync_fetch_and_sub(&lazy.chunks_remaining, 1);
+    } else {
+        while (__sync_fetch_and_add(state, 0) != 2)
+            sched_yield();
+    }
+}
+
+int lazy_core_space_p(void)
+{
+    return lazy.chunk_state != 0;
+}
+
+void fill_lazy_core(int (*wanted)(char *start, size_t len))
+{
+    if (!lazy.chunks_remaining)
+        return;
+    lazy.wanted = wanted;
+    for_each_chunk(0, lazy.n_chunks, fill_lazy_chunk, 0);
+    lazy.wanted = 0;
+}
+
+void protect_lazy_core(void)
+{
+    sword_t chunk;
+    for (chunk = 0; chunk < lazy.n_chunks; ++chunk)
+        if (!lazy.chunk_state[chunk])
+            os_protect((os_vm_address_t)lazy.addr + chunk * lazy.chunk_bytes,
+                       lazy_chunk_size(chunk), OS_VM_PROT_NONE);
+}
+
+int lazy_core_handle_fault(void *addr)
+{
+    char *where = addr;
+    if (!lazy.chunks_remaining || where < lazy.addr || where >= lazy.addr + lazy.len)
+        return 0;
+    sword_t chunk = (where - lazy.addr) / lazy.chunk_bytes;
+    if (__sync_fetch_and_add(&lazy.chunk_state[chunk], 0) == 2)
+        return 0; // an ordinary write fault, if anything
+    // Stopping for GC in the middle would leave the chunk unfinished
+    sigset_t oldset;
+    block_blockable_signals(&oldset);
+    fill_lazy_chunk(chunk, 0);
+    thread_sigmask(SIG_SETMASK, &oldset, 0);
+    return 1;
+}
+
+/* Serves faults on the lazy space until os_install_interrupt_handlers()
+ * replaces it, since the rest of the loader may already touch the heap */
+static void lazy_core_early_fault_handler(int signal, siginfo_t *info,
+                                          void __attribute__((unused)) *context)
+{
+    if (!lazy_core_handle_fault(info->si_addr))
+        sigaction(signal, &(struct sigaction){ .sa_handler = SIG_DFL }, 0);
+}
+
+void make_core_space_lazy(char *addr, size_t len, size_t chunk_bytes,
+                          int (*fill)(sword_t chunk, char *copy, int slot),
+                          int n_slots, int (*lazy_p)(sword_t chunk))
+{
+    gc_assert(!lazy_core_space_p());
+    gc_assert(!((uword_t)addr & (os_vm_page_size - 1)));
+    gc_assert(!(chunk_bytes & (os_vm_page_size - 1)));
+    lazy.addr = addr;
+    lazy.len = len;
+    lazy.chunk_bytes = chunk_bytes;
+    lazy.n_chunks = (len + chunk_bytes - 1) / chunk_bytes;
+    lazy.fill = fill;
+    gc_assert(n_slots > 0 && n_slots <= MAX_CHUNK_THREADS);
+    lazy.n_slots = n_slots;
+    lazy.chunk_state = calloc(lazy.n_chunks, 1);
+    if (!lazy.chunk_state)
+        lose("can't allocate lazy core state");
+    sword_t chunk;
+    for (chunk = 0; chunk < lazy.n_chunks; ++chunk)
+        if (lazy_p && !lazy_p(chunk))
+            lazy.chunk_state[chunk] = 2;
+        else
+            ++lazy.chunks_remaining;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_sigaction = lazy_core_early_fault_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGSEGV, &sa, 0);
+    protect_lazy_core();
+}
+#endif
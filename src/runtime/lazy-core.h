@@ -0,0 +1,52 @@
+/*
+ * This software is part of the SBCL system. See the README file for
+ * more information.
+ *
+ * This software is derived from the CMU CL system, which was
+ * written at Carnegie Mellon University and released into the
+ * public domain. The software is in the public domain and is
+ * provided with absolutely no warranty. See the COPYING and CREDITS
+ * files for more information.
+ */
+
+#ifndef _LAZY_CORE_H_
+#define _LAZY_CORE_H_
+
+#include "os.h"
+
+typedef void (*chunk_action)(sword_t chunk, void *arg);
+/* Call 'action' on each chunk from 'start' below 'end', using up to one
+ * thread per online processor */
+extern void for_each_chunk(sword_t start, sword_t end, chunk_action action, void *arg);
+/* How many threads for_each_chunk() uses at most */
+extern int chunk_thread_count(void);
+
+#if defined LISP_FEATURE_LINUX && defined LISP_FEATURE_GENCGC
+#define LAZY_CORE_PAGES
+/* Leave [addr,addr+len) of a space being loaded inaccessible, to be filled in
+ * a chunk at a time when first touched. 'fill' writes the contents of a
+ * chunk to 'copy' and returns 1, or returns 0 if the chunk's pages are
+ * correct as they are. Chunks for which 'lazy_p' returns 0 are left alone.
+ * 'fill' runs in the fault handler, so it must not call malloc(). Any scratch
+ * memory it needs should be set aside beforehand for each 'slot', which is
+ * below 'n_slots' (at most chunk_thread_count()) and not used by two fills
+ * at once. */
+extern void make_core_space_lazy(char *addr, size_t len, size_t chunk_bytes,
+                                 int (*fill)(sword_t chunk, char *copy, int slot),
+                                 int n_slots, int (*lazy_p)(sword_t chunk));
+extern int lazy_core_space_p(void);
+/* Fill the remaining chunks for which 'wanted' (if supplied) is true */
+extern void fill_lazy_core(int (*wanted)(char *start, size_t len));
+/* Make the pages of the chunks not yet filled inaccessible again */
+extern void protect_lazy_core(void);
+extern int lazy_core_handle_fault(void *addr);
+/* Give the pages at 'where' the protection of the pages of the core at 'start' */
+extern void gc_restore_core_protection(char *start, size_t len, char *where);
+#else
+#define lazy_core_space_p() 0
+#define fill_lazy_core(wanted)
+#define protect_lazy_core()
+#define lazy_core_handle_fault(addr) 0
+#endif
+
+#endif /* _LAZY_CORE_H_ */
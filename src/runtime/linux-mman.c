@@ -1,4 +1,6 @@
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
 
@@ -52,3 +54,24 @@ os_invalidate(os_vm_address_t addr, os_vm_size_t len)
         perror("munmap");
     }
 }
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1 // from <numaif.h>, which needs libnuma
+#endif
+
+int
+os_numa_prefer_node(os_vm_address_t addr, os_vm_size_t len, int node)
+{
+#ifdef SYS_mbind
+    unsigned long mask[16];
+    int bits = 8 * sizeof (unsigned long);
+    if (node < 0 || node >= bits * 16)
+        return -1;
+    memset(mask, 0, sizeof mask);
+    mask[node / bits] = 1UL << (node % bits);
+    // The kernel takes one less than 'maxnode' bits of the mask
+    return syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask, bits * 16 + 1, 0) ? -1 : 0;
+#else
+    return -1;
+#endif
+}
@@ -48,6 +48,7 @@
 #include "validate.h"
 #include "thread.h"
 #include "gc-internal.h"
+#include "tracelog.h"
 #include <fcntl.h>
 
 #ifdef LISP_FEATURE_X86
@@ -224,6 +225,7 @@ futex_wait(int *lock_word, int oldval, long sec, unsigned long usec)
     struct mutex* m = (void*)((char*)lock_word - offsetof(struct mutex,state));
     char *name = m->name != NIL ? (char*)VECTOR(m->name)->data : "(unnamed)";
 #endif
+  trace_begin("futex wait", (uword_t)lock_word);
   if (sec<0) {
       lisp_mutex_event1("start futex wait", name);
       t = sys_futex(lock_word, futex_wait_op(), oldval, 0);
@@ -235,6 +237,7 @@ futex_wait(int *lock_word, int oldval, long sec, unsigned long usec)
       t = sys_futex(lock_word, futex_wait_op(), oldval, &timeout);
   }
   lisp_mutex_event1("back from sys_futex", name);
+  trace_end("futex wait", (uword_t)lock_word);
   if (t==0)
       return 0;
   else if (errno==ETIMEDOUT)
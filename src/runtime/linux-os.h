@@ -44,3 +44,7 @@ typedef int os_vm_prot_t;
  * due to Linux signal handling pecularities. See thread "Signal
  * delivery order" from 2009-03-14 on kernel-devel@vger.kernel.org. */
 #define SIG_STOP_FOR_GC (SIGUSR2)
+
+/* Make NUMA node 'node' the preferred one for the pages of [addr,addr+len).
+ * Returns 0 on success */
+extern int os_numa_prefer_node(os_vm_address_t addr, os_vm_size_t len, int node);
@@ -55,6 +55,7 @@
 #include "interrupt.h"
 #include "arch.h"
 #include "gc.h"
+#include "gc-thread-pool.h"
 #include "validate.h"
 #include "core.h"
 #include "save.h"
@@ -553,6 +554,13 @@ sbcl_main(int argc, char *argv[], char *envp[])
                 if (argi >= argc)
                     lose("missing argument for --tls-limit");
                 dynamic_values_bytes = N_WORD_BYTES * atoi(argv[argi++]);
+            } else if (0 == strcmp(arg, "--gc-threads")) {
+                ++argi;
+                if (argi >= argc)
+                    lose("missing argument for --gc-threads");
+                gc_n_threads = atoi(argv[argi++]);
+                if (gc_n_threads < 1)
+                    lose("--gc-threads argument must be a positive integer");
             } else if (0 == strcmp(arg, "--debug-environment")) {
                 debug_environment_p = 1;
                 ++argi;
@@ -572,6 +580,36 @@ sbcl_main(int argc, char *argv[], char *envp[])
             } else if (0 == strcmp(arg, "--no-merge-core-pages")) {
                 ++argi;
                 merge_core_pages = 0;
+            } else if (0 == strcmp(arg, "--lazy-core-decompression")) {
+                ++argi;
+                lazy_core_decompression = 1;
+            } else if (0 == strcmp(arg, "--lazy-core-relocation")) {
+                ++argi;
+                lazy_core_relocation = 1;
+            } else if (0 == strcmp(arg, "--show-startup-times")) {
+                ++argi;
+                show_startup_times = 1;
+#ifdef LISP_FEATURE_GENCGC
+            } else if (0 == strcmp(arg, "--huge-pages")) {
+                ++argi;
+                gencgc_huge_pages = 1;
+            } else if (0 == strcmp(arg, "--gc-rss-target")) {
+                ++argi;
+                if (argi >= argc)
+                    lose("missing argument for --gc-rss-target");
+                gencgc_rss_target = parse_size_arg(argv[argi++], "--gc-rss-target");
+            } else if (0 == strcmp(arg, "--numa")) {
+                ++argi;
+                gencgc_numa = 1;
+            } else if (0 == strcmp(arg, "--gc-lazy-sweep")) {
+                ++argi;
+                gc_lazy_sweep = 1;
+#endif
+            } else if (0 == strcmp(arg, "--base-core")) {
+                ++argi;
+                if (argi >= argc)
+                    lose("missing filename for --base-core argument");
+                base_core_filename = copied_string(argv[argi++]);
             } else {
                 /* This option was unrecognized as a runtime option,
                  * so it must be a toplevel option or a user option,
@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/file.h>
+#include <unistd.h>
 
 #include "sbcl.h"
 #ifdef LISP_FEATURE_WIN32
@@ -42,10 +43,6 @@
 #include "immobile-space.h"
 #include "search.h"
 
-#ifdef LISP_FEATURE_SB_CORE_COMPRESSION
-# include <zlib.h>
-#endif
-
 #define GENERAL_WRITE_FAILURE_MSG "error writing to core file"
 
 /* write_memsize_options uses a simple serialization scheme that
@@ -77,9 +74,10 @@ write_lispobj(lispobj obj, FILE *file)
 }
 
 static void
-write_bytes_to_file(FILE * file, char *addr, size_t bytes, int compression)
+write_bytes_to_file(FILE * file, char *addr, size_t bytes,
+                    int compression, int compression_level)
 {
-    if (compression == COMPRESSION_LEVEL_NONE) {
+    if (compression == CORE_COMPRESSION_NONE) {
         while (bytes > 0) {
             sword_t count = fwrite(addr, 1, bytes, file);
             if (count > 0) {
@@ -91,52 +89,8 @@ write_bytes_to_file(FILE * file, char *addr, size_t bytes, int compression)
                 lose("core file is incomplete or corrupt");
             }
         }
-#ifdef LISP_FEATURE_SB_CORE_COMPRESSION
-    } else if ((compression >= -1) && (compression <= 9)) {
-# define ZLIB_BUFFER_SIZE (1u<<16)
-        z_stream stream;
-        unsigned char* buf = successful_malloc(ZLIB_BUFFER_SIZE);
-        unsigned char * written, * end;
-        long total_written = 0;
-        int ret;
-        stream.zalloc = NULL;
-        stream.zfree = NULL;
-        stream.opaque = NULL;
-        stream.avail_in = bytes;
-        stream.next_in  = (void*)addr;
-        ret = deflateInit(&stream, compression);
-        if (ret != Z_OK)
-            lose("deflateInit: %i", ret);
-        do {
-            stream.avail_out = ZLIB_BUFFER_SIZE;
-            stream.next_out = buf;
-            ret = deflate(&stream, Z_FINISH);
-            if (ret < 0) lose("zlib deflate error: %i... exiting", ret);
-            written = buf;
-            end     = buf+ZLIB_BUFFER_SIZE-stream.avail_out;
-            total_written += end - written;
-            while (written < end) {
-                long count = fwrite(written, 1, end-written, file);
-                if (count > 0) {
-                    written += count;
-                } else {
-                    perror(GENERAL_WRITE_FAILURE_MSG);
-                    lose("core file is incomplete or corrupt");
-                }
-            }
-        } while (stream.avail_out == 0);
-        deflateEnd(&stream);
-        free(buf);
-        printf("compressed %lu bytes into %lu at level %i\n",
-               bytes, total_written, compression);
-# undef ZLIB_BUFFER_SIZE
-#endif
     } else {
-#ifdef LISP_FEATURE_SB_CORE_COMPRESSION
-        lose("Unknown core compression level %i, exiting", compression);
-#else
-        lose("zlib-compressed core support not built in this runtime");
-#endif
+        compress_core_bytes(file, addr, bytes, compression, compression_level);
     }
 
     if (fflush(file) != 0) {
@@ -145,18 +99,9 @@ write_bytes_to_file(FILE * file, char *addr, size_t bytes, int compression)
     }
 };
 
-#if defined(LISP_FEATURE_WIN32) && defined(LISP_FEATURE_64_BIT)
-#define FTELL _ftelli64
-#define FSEEK _fseeki64
-typedef __int64 ftell_type;
-#else
-#define FTELL ftell
-#define FSEEK fseek
-typedef long ftell_type;
-#endif
-
 static long write_bytes(FILE *file, char *addr, size_t bytes,
-                        os_vm_offset_t file_offset, int compression)
+                        os_vm_offset_t file_offset,
+                        int compression, int compression_level)
 {
     ftell_type here, data;
 
@@ -173,22 +118,74 @@ static long write_bytes(FILE *file, char *addr, size_t bytes,
     FSEEK(file, 0, SEEK_END);
     data = ALIGN_UP(FTELL(file), os_vm_page_size);
     FSEEK(file, data, SEEK_SET);
-    write_bytes_to_file(file, addr, bytes, compression);
+    write_bytes_to_file(file, addr, bytes, compression, compression_level);
     FSEEK(file, here, SEEK_SET);
     return ((data - file_offset) / os_vm_page_size) - 1;
 }
 
+char *delta_base_core;
+static struct base_core delta_base;
+#define DELTA_COMPARE_PAGES 256
+
+/* Write a bitmap of the pages of [addr,addr+bytes) which differ from the
+ * same pages of space 'id' of the base core, followed by those pages, and
+ * return the data page as write_bytes() does. Pages past the end of the
+ * base core's space differ by definition */
+static long write_delta_bytes(FILE *file, int id, char *addr, size_t bytes,
+                              os_vm_offset_t file_offset, uword_t *n_changed)
+{
+    uword_t n_pages = bytes / os_vm_page_size, page, end;
+    uword_t n_base_pages = delta_base.spaces[id].page_count;
+    size_t bitmap_bytes = ALIGN_UP((n_pages + 7) / 8, os_vm_page_size);
+    unsigned char *bitmap = calloc(bitmap_bytes + 1, 1);
+    char *base_bytes = successful_malloc(DELTA_COMPARE_PAGES * os_vm_page_size);
+
+    *n_changed = 0;
+    for (page = 0; page < n_pages; ++page) {
+        char *base_page = base_bytes + (page % DELTA_COMPARE_PAGES) * os_vm_page_size;
+        if (page % DELTA_COMPARE_PAGES == 0 && page < n_base_pages) {
+            uword_t n = n_base_pages - page;
+            if (n > DELTA_COMPARE_PAGES) n = DELTA_COMPARE_PAGES;
+            os_vm_offset_t offset = delta_base.spaces[id].offset + page * os_vm_page_size;
+            if (lseek(delta_base.fd, offset, SEEK_SET) != offset
+                || read(delta_base.fd, base_bytes, n * os_vm_page_size)
+                   != (ssize_t)(n * os_vm_page_size))
+                lose("can't read base core %s", delta_base_core);
+        }
+        if (page >= n_base_pages
+            || memcmp(addr + page * os_vm_page_size, base_page, os_vm_page_size)) {
+            bitmap[page / 8] |= 1 << (page % 8);
+            ++*n_changed;
+        }
+    }
+    free(base_bytes);
+
+    // write_bytes() puts the runs end to end, since they are whole pages
+    long data = write_bytes(file, (char*)bitmap, bitmap_bytes, file_offset,
+                            CORE_COMPRESSION_NONE, 0);
+    for (page = 0 ; page < n_pages ; page = end + 1) {
+        for (end = page; end < n_pages && (bitmap[end / 8] & (1 << (end % 8))); ++end);
+        if (end > page)
+            write_bytes(file, addr + page * os_vm_page_size,
+                        (end - page) * os_vm_page_size, file_offset,
+                        CORE_COMPRESSION_NONE, 0);
+    }
+    free(bitmap);
+    return data;
+}
+
 static void
 output_space(FILE *file, int id, lispobj *addr, lispobj *end,
              os_vm_offset_t file_offset,
-             int core_compression_level)
+             int core_compression, int core_compression_level)
 {
     size_t words, bytes, data, compressed_flag;
     static char *names[] = {NULL, "dynamic", "static", "read-only",
                             "immobile", "immobile"};
 
     compressed_flag
-            = ((core_compression_level != COMPRESSION_LEVEL_NONE)
+            = delta_base_core ? DELTA_CORE_SPACE_ID_FLAG
+            : ((core_compression != CORE_COMPRESSION_NONE)
                ? DEFLATED_CORE_SPACE_ID_FLAG : 0);
 
     write_lispobj(id | compressed_flag, file);
@@ -210,17 +207,27 @@ output_space(FILE *file, int id, lispobj *addr, lispobj *end,
     if (id == DYNAMIC_CORE_SPACE_ID && bytes == 0) bytes = 2*N_WORD_BYTES;
 #endif
 
-    if (!lisp_startup_options.noinform)
-        printf("writing %lu bytes from the %s space at %p\n",
-               (long unsigned)bytes, names[id], addr);
-
-    /* FIXME: it sure would be nice to discover and document the behavior of this function
-     * with regard to aligning up the byte count as pertains to bytes spanned by a rounded
-     * up count that were not zeroized and would not have been written had we not rounded.
-     * That seems quite bogus to operate on bytes that the caller didn't promise were OK
-     * to be saved out (and didn't contain, say, a password and social security number) */
-    data = write_bytes(file, (char *)addr, ALIGN_UP(bytes, os_vm_page_size),
-                       file_offset, core_compression_level);
+    if (delta_base_core) {
+        uword_t n_changed;
+        data = write_delta_bytes(file, id, (char *)addr, ALIGN_UP(bytes, os_vm_page_size),
+                                 file_offset, &n_changed);
+        if (!lisp_startup_options.noinform)
+            printf("wrote %lu changed of %lu bytes from the %s space at %p\n",
+                   (long unsigned)(n_changed * os_vm_page_size),
+                   (long unsigned)bytes, names[id], addr);
+    } else {
+        if (!lisp_startup_options.noinform)
+            printf("writing %lu bytes from the %s space at %p\n",
+                   (long unsigned)bytes, names[id], addr);
+
+        /* FIXME: it sure would be nice to discover and document the behavior of this function
+         * with regard to aligning up the byte count as pertains to bytes spanned by a rounded
+         * up count that were not zeroized and would not have been written had we not rounded.
+         * That seems quite bogus to operate on bytes that the caller didn't promise were OK
+         * to be saved out (and didn't contain, say, a password and social security number) */
+        data = write_bytes(file, (char *)addr, ALIGN_UP(bytes, os_vm_page_size),
+                           file_offset, core_compression, core_compression_level);
+    }
 
     write_lispobj(data, file);
     write_lispobj((uword_t)addr, file);
@@ -268,7 +275,7 @@ boolean
 save_to_filehandle(FILE *file, char *filename, lispobj init_function,
                    boolean make_executable,
                    boolean save_runtime_options,
-                   int core_compression_level)
+                   int core_compression, int core_compression_level)
 {
     boolean verbose = !lisp_startup_options.noinform;
 
@@ -304,6 +311,24 @@ save_to_filehandle(FILE *file, char *filename, lispobj init_function,
     if (nwrote != (int)(sizeof (core_entry_elt_t) * string_words))
         perror(GENERAL_WRITE_FAILURE_MSG);
 
+    if (delta_base_core) {
+        /* Name the base core, and identify it by its size and the checksum
+         * of its header page so that the loader can check it's the same */
+        int namelen = strlen(delta_base_core);
+        int name_words = ALIGN_UP(namelen, sizeof (core_entry_elt_t))
+            / sizeof (core_entry_elt_t);
+        char *name = calloc(name_words + 1, sizeof (core_entry_elt_t));
+        memcpy(name, delta_base_core, namelen);
+        write_lispobj(BASE_CORE_CORE_ENTRY_TYPE_CODE, file);
+        write_lispobj(5 + name_words, file);
+        write_lispobj(delta_base.size, file);
+        write_lispobj(delta_base.checksum, file);
+        write_lispobj(namelen, file);
+        if (fwrite(name, sizeof (core_entry_elt_t), name_words, file) != (size_t)name_words)
+            perror(GENERAL_WRITE_FAILURE_MSG);
+        free(name);
+    }
+
     write_lispobj(DIRECTORY_CORE_ENTRY_TYPE_CODE, file);
     write_lispobj(/* (word count = N spaces described by 5 words each, plus the
           * entry type code, plus this count itself) */
@@ -313,34 +338,34 @@ save_to_filehandle(FILE *file, char *filename, lispobj init_function,
                  (lispobj *)READ_ONLY_SPACE_START,
                  read_only_space_free_pointer,
                  core_start_pos,
-                 core_compression_level);
+                 core_compression, core_compression_level);
     output_space(file,
                  STATIC_CORE_SPACE_ID,
                  (lispobj *)STATIC_SPACE_START,
                  static_space_free_pointer,
                  core_start_pos,
-                 core_compression_level);
+                 core_compression, core_compression_level);
 #ifdef LISP_FEATURE_DARWIN_JIT
     output_space(file,
                  STATIC_CODE_CORE_SPACE_ID,
                  (lispobj *)STATIC_CODE_SPACE_START,
                  static_code_space_free_pointer,
                  core_start_pos,
-                 core_compression_level);
+                 core_compression, core_compression_level);
 #endif
     output_space(file,
                  DYNAMIC_CORE_SPACE_ID,
                  current_dynamic_space,
                  (lispobj *)get_alloc_pointer(),
                  core_start_pos,
-                 core_compression_level);
+                 core_compression, core_compression_level);
 #ifdef LISP_FEATURE_IMMOBILE_SPACE
     output_space(file,
                  IMMOBILE_FIXEDOBJ_CORE_SPACE_ID,
                  (lispobj *)FIXEDOBJ_SPACE_START,
                  fixedobj_free_pointer,
                  core_start_pos,
-                 core_compression_level);
+                 core_compression, core_compression_level);
     // Leave this space for last! Things are easier when splitting a core into
     // code and non-code if we don't have to compensate for removal of pages.
     // i.e. if code resided between dynamic and fixedobj space, then dynamic
@@ -350,7 +375,7 @@ save_to_filehandle(FILE *file, char *filename, lispobj init_function,
                  (lispobj *)VARYOBJ_SPACE_START,
                  varyobj_free_pointer,
                  core_start_pos,
-                 core_compression_level);
+                 core_compression, core_compression_level);
 #endif
 
     write_lispobj(INITIAL_FUN_CORE_ENTRY_TYPE_CODE, file);
@@ -372,9 +397,39 @@ save_to_filehandle(FILE *file, char *filename, lispobj init_function,
         write_lispobj(next_free_page, file);
         write_lispobj(aligned_size, file);
         sword_t offset = write_bytes(file, data, aligned_size, core_start_pos,
-                                     COMPRESSION_LEVEL_NONE);
+                                     CORE_COMPRESSION_NONE, 0);
         write_lispobj(offset, file);
     }
+    /* Save what relocate_heap() would fix up if the core is loaded
+     * elsewhere, so that the loader need not walk the heap */
+    extern int lisp_code_in_elf();
+    if (!lisp_code_in_elf()) {
+        struct { int id; lispobj *start, *end; } spaces[] = {
+            { STATIC_CORE_SPACE_ID, (lispobj*)STATIC_SPACE_OBJECTS_START,
+              static_space_free_pointer },
+            { DYNAMIC_CORE_SPACE_ID, (lispobj*)DYNAMIC_SPACE_START,
+              (lispobj*)get_alloc_pointer() },
+#ifdef LISP_FEATURE_IMMOBILE_SPACE
+            { IMMOBILE_FIXEDOBJ_CORE_SPACE_ID, (lispobj*)FIXEDOBJ_SPACE_START,
+              fixedobj_free_pointer },
+            { IMMOBILE_VARYOBJ_CORE_SPACE_ID, (lispobj*)VARYOBJ_SPACE_START,
+              varyobj_free_pointer },
+#endif
+        };
+        int i, n_spaces = sizeof spaces / sizeof spaces[0];
+        write_lispobj(RELOCATION_TABLE_CORE_ENTRY_TYPE_CODE, file);
+        write_lispobj(3 + 3 * n_spaces, file);
+        write_lispobj(n_spaces, file);
+        for (i = 0; i < n_spaces; ++i) {
+            size_t nbytes;
+            uword_t *table = make_relocation_table(spaces[i].start, spaces[i].end, &nbytes);
+            write_lispobj(spaces[i].id, file);
+            write_lispobj(nbytes, file);
+            write_lispobj(write_bytes(file, (char*)table, nbytes, core_start_pos,
+                                      CORE_COMPRESSION_NONE, 0), file);
+            free(table);
+        }
+    }
 #endif
 
     write_lispobj(END_CORE_ENTRY_TYPE_CODE, file);
@@ -544,6 +599,17 @@ prepare_to_save(char *filename, boolean prepend_runtime, void **runtime_bytes,
             return 0;
     }
 
+    if (delta_base_core) {
+        char *msg = strlen(delta_base_core) > 1024 ? "name too long"
+            : open_base_core(delta_base_core, &delta_base);
+        if (msg) {
+            fprintf(stderr, "Can't save against base core %s: %s\n",
+                    delta_base_core, msg);
+            free(*runtime_bytes);
+            return NULL;
+        }
+    }
+
     file = open_core_for_saving(filename);
     if (file == NULL) {
         free(*runtime_bytes);
@@ -557,7 +623,7 @@ prepare_to_save(char *filename, boolean prepend_runtime, void **runtime_bytes,
 #ifdef LISP_FEATURE_CHENEYGC
 boolean
 save(char *filename, lispobj init_function, boolean prepend_runtime,
-     boolean save_runtime_options, boolean compressed, int compression_level,
+     boolean save_runtime_options, int compression, int compression_level,
      int application_type)
 {
     FILE *file;
@@ -579,6 +645,6 @@ save(char *filename, lispobj init_function, boolean prepend_runtime,
     os_unlink_runtime();
     return save_to_filehandle(file, filename, init_function, prepend_runtime,
                               save_runtime_options,
-                              compressed ? compressed : COMPRESSION_LEVEL_NONE);
+                              compression, compression_level);
 }
 #endif
@@ -13,8 +13,17 @@
 #define _SAVE_H_
 #include <limits.h>
 #include "core.h"
+#include "core-compression.h"
 
-#define COMPRESSION_LEVEL_NONE INT_MIN
+#if defined(LISP_FEATURE_WIN32) && defined(LISP_FEATURE_64_BIT)
+#define FTELL _ftelli64
+#define FSEEK _fseeki64
+typedef __int64 ftell_type;
+#else
+#define FTELL ftell
+#define FSEEK fseek
+typedef long ftell_type;
+#endif
 
 void unwind_binding_stack(void);
 
@@ -23,10 +32,10 @@ extern boolean save_runtime_to_filehandle(FILE *output, void *runtime_bytes,
                                           size_t runtime_size, int application_type);
 extern boolean save_to_filehandle(FILE *file, char *filename, lispobj initfun,
                                   boolean make_executable, boolean keep_runtime_options,
-                                  int core_compression_level);
+                                  int core_compression, int core_compression_level);
 extern boolean save(char *filename, lispobj initfun, boolean prepend_runtime,
                     boolean keep_runtime_options,
-                    boolean compressed_core, int core_compression_level,
+                    int core_compression, int core_compression_level,
                     int application_type);
 
 #endif
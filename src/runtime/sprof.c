@@ -399,8 +399,32 @@ static struct sprof_data* enlarge_buffer(struct sprof_data* current,
 #define RELEASE_LOCK(th) SPROF_LOCK(th) = 0
 #endif
 
+/* Change an excessively long trace to "hot_end ... elision_marker ... cold_end",
+ * and return its new length */
+static int condense_trace(struct trace* trace, int len)
+{
+    if (len > MAX_RECORDED_TRACE_LEN) {
+        int midpoint = MAX_RECORDED_TRACE_LEN/2;
+        int suffix = midpoint-1;
+        STORE_PC(*trace, midpoint, (uword_t)-1);
+        memmove(&trace->locs[midpoint+1], &trace->locs[len-suffix], N_WORD_BYTES*suffix);
+        len = MAX_RECORDED_TRACE_LEN;
+    }
+    return len;
+}
+
 int sb_sprof_trace_ct;
 int sb_sprof_trace_ct_max;
+/* Nonzero if Lisp drains the samples periodically, as by SB-SPROF:START-STREAMING */
+int sb_sprof_streaming;
+
+/* Called by SB-SPROF:WRITE-COLLAPSED-SAMPLES for each buffer it wrote out and
+ * freed, whether taken from a running thread or left by one which exited, so
+ * that 'n' more samples can be taken */
+void sb_sprof_release_samples(int n)
+{
+    __sync_fetch_and_sub(&sb_sprof_trace_ct, n);
+}
 
 /* this could get false msan positives because Lisp don't mark stack words as clean
    so anything may appear as unwritten from C depending on whether any C code
@@ -420,22 +444,17 @@ collect_backtrace(struct thread* th, int contextp, void* context_or_fp)
     else
         len = gather_trace_from_frame(th, context_or_fp, &trace, TRACE_BUFFER_LEN);
     if (len < 1) return len;
-    if (len > MAX_RECORDED_TRACE_LEN) {
-        // change excessively long trace to "hot_end ... elision_marker ... cold_end"
-        int midpoint = MAX_RECORDED_TRACE_LEN/2;
-        int suffix = midpoint-1;
-        STORE_PC(trace, midpoint, (uword_t)-1);
-        memmove(&trace.locs[midpoint+1], &trace.locs[len-suffix], N_WORD_BYTES*suffix);
-        len = MAX_RECORDED_TRACE_LEN;
-    }
+    len = condense_trace(&trace, len);
     // Hash before trying to insert so that potentially the conversion of unstable
     // PCs to stable PCs can be skipped, if there is a hash match.
     uword_t hash = compute_hash(trace.locs, len);
     store_trace_header(&trace, hash, len);
 
     // Try to acquire the lock
-    if (__sync_val_compare_and_swap(&SPROF_LOCK(th), 0, LOCKED_BY_SELF)!=0)
+    if (__sync_val_compare_and_swap(&SPROF_LOCK(th), 0, LOCKED_BY_SELF)!=0) {
+        __sync_fetch_and_sub(&sb_sprof_trace_ct, 1);
         return -2; // already locked
+    }
 
     struct sprof_data* data = (void*)th->sprof_data;
     if (!data) data = initialize_sprof_data(th);
@@ -451,13 +470,13 @@ collect_backtrace(struct thread* th, int contextp, void* context_or_fp)
             uint32_t capacity = data->capacity;
             if (data->free_pointer + n_elements > capacity) {
                 // If we're at maximum capacity, bail out
-                if (capacity == CAPACITY_MAX) return 0;
+                if (capacity == CAPACITY_MAX) goto dropped;
                 // Before enlarging the buffer, check whether anyone is trying
                 // to read it; if so, just bail out.
                 // This is not to avoid a race - that's taken care of by the
                 // cmpxchg - but it's preferable to drop the current sample
                 // versus make a bunch more system call while there is a waiter.
-                if (SPROF_LOCK(th) & LOCKED_BY_OTHER) return 0;
+                if (SPROF_LOCK(th) & LOCKED_BY_OTHER) goto dropped;
                 data = enlarge_buffer(data, 2*capacity);
                 th->sprof_data = (lispobj)data;
             }
@@ -466,6 +485,11 @@ collect_backtrace(struct thread* th, int contextp, void* context_or_fp)
     }
     ++*pcount;
     return 1;
+dropped:
+    // Samples not recorded don't count toward the limit, so that a consumer
+    // which drains the data while sampling continues can tell what it got.
+    __sync_fetch_and_sub(&sb_sprof_trace_ct, 1);
+    return 0;
 }
 
 static void diagnose_failure(struct thread* thread) {
@@ -473,8 +497,9 @@ static void diagnose_failure(struct thread* thread) {
     // but if multithreaded, each thread could allocate a buffer and grow it an
     // arbitrary number of times. The automatic disable tries to avoid an explosion
     // in memory consumption.
+    // If the data will be drained, just drop samples until then.
     struct sprof_data* data = (void*)thread->sprof_data;
-    if (data && data->capacity == CAPACITY_MAX) {
+    if (data && data->capacity == CAPACITY_MAX && !sb_sprof_streaming) {
         // disable the profiler in this thread
         thread->state_word.sprof_enable = 0;
 #ifdef LISP_FEATURE_SB_THREAD
@@ -538,6 +563,154 @@ void allocator_record_backtrace(void* frame_ptr, struct thread* thread)
 }
 #endif
 
+/* Sampling heap profiler.
+ * Each thread takes a backtrace once it has claimed another
+ * 'heap_profile_interval' bytes of heap from the allocator, and remembers
+ * the object it was allocating at that moment, weighted by those bytes.
+ * Every GC drops the samples whose object died, so the table describes the
+ * heap that was live as of the last GC, by allocating stack.
+ * 0 disables sampling. */
+uword_t heap_profile_interval;
+
+#ifdef LISP_FEATURE_GENCGC
+#include <sched.h>
+struct heap_sample {
+    lispobj obj;
+    uword_t weight; // bytes of allocation represented by this sample
+    int len;
+    uint64_t locs[MAX_RECORDED_TRACE_LEN]; // elements as in 'struct trace'
+};
+/* Samples are added by threads in pseudo-atomic sections, or by the
+ * snapshot with signals blocked, so the lock is never held by a thread
+ * stopped for GC, and heap_profile_cull() need not take it. */
+static struct {
+    struct heap_sample* samples;
+    uword_t count, capacity;
+    int lock;
+} heap_profile;
+
+static void heap_profile_lock(void)
+{
+    while (__sync_lock_test_and_set(&heap_profile.lock, 1))
+        sched_yield();
+}
+static void heap_profile_unlock(void)
+{
+    __sync_lock_release(&heap_profile.lock);
+}
+
+/* Called by lisp_alloc() after it claimed 'claimed' bytes of heap to allocate 'obj' */
+void NO_SANITIZE_MEMORY
+heap_profile_sample(struct thread* th, lispobj obj, uword_t claimed, void* frame_ptr)
+{
+    struct extra_thread_data *extra = thread_extra_data(th);
+    uword_t weight = extra->heap_profile_bytes + claimed;
+    if (weight < heap_profile_interval) {
+        extra->heap_profile_bytes = weight;
+        return;
+    }
+    extra->heap_profile_bytes = 0;
+    struct trace trace;
+    int len = gather_trace_from_frame(th, frame_ptr, &trace, TRACE_BUFFER_LEN);
+    if (len < 1) return;
+    len = condense_trace(&trace, len);
+    store_trace_header(&trace, 0, len);
+    // Code can move before the samples are looked at
+    stabilize(&trace);
+    heap_profile_lock();
+    if (heap_profile.count == heap_profile.capacity) {
+        uword_t new_capacity = heap_profile.capacity ? 2 * heap_profile.capacity : 1024;
+        struct heap_sample* new_samples =
+            (void*)os_allocate(new_capacity * sizeof (struct heap_sample));
+        if (!new_samples) { // just lose this sample
+            heap_profile_unlock();
+            return;
+        }
+        if (heap_profile.samples) {
+            memcpy(new_samples, heap_profile.samples,
+                   heap_profile.count * sizeof (struct heap_sample));
+            os_deallocate((void*)heap_profile.samples,
+                          heap_profile.capacity * sizeof (struct heap_sample));
+        }
+        heap_profile.samples = new_samples;
+        heap_profile.capacity = new_capacity;
+    }
+    struct heap_sample* sample = &heap_profile.samples[heap_profile.count++];
+    sample->obj = obj;
+    sample->weight = weight;
+    sample->len = len;
+    memcpy(sample->locs, trace.locs, len * ELEMENT_SIZE);
+    heap_profile_unlock();
+}
+
+/* Called by the collector with the world stopped, once it knows which objects
+ * survive. 'survivor' returns the object's new address, or 0 if it died.
+ * Nothing here may call malloc() and friends: a stopped thread could own their lock. */
+void heap_profile_cull(lispobj (*survivor)(lispobj))
+{
+    uword_t i, n = 0;
+    for (i = 0; i < heap_profile.count; ++i) {
+        lispobj obj = survivor(heap_profile.samples[i].obj);
+        if (obj) {
+            if (n != i) heap_profile.samples[n] = heap_profile.samples[i];
+            heap_profile.samples[n++].obj = obj;
+        }
+    }
+    heap_profile.count = n;
+}
+
+/* Return the live samples in the format of a thread's 'sprof_data', but
+ * without buckets and with each multiplicity being the bytes that the trace
+ * stands for; or 0 if there are none. The caller owns the memory, whose
+ * capacity is its free pointer. */
+uword_t heap_profile_snapshot(void)
+{
+    struct sprof_data* data = 0;
+    uword_t i, n_elements = INITIAL_FREE_POINTER;
+    sigset_t oldset;
+    block_blockable_signals(&oldset);
+    heap_profile_lock();
+    for (i = 0; i < heap_profile.count; ++i)
+        n_elements += TRACE_PREFIX_ELEMENTS + heap_profile.samples[i].len;
+    if (heap_profile.count && n_elements <= UINT32_MAX
+        && (data = (void*)os_allocate(n_elements * ELEMENT_SIZE)) != 0) {
+        data->buckets = 0;
+        data->free_pointer = data->capacity = n_elements;
+        uint32_t index = INITIAL_FREE_POINTER;
+        for (i = 0; i < heap_profile.count; ++i) {
+            struct heap_sample* sample = &heap_profile.samples[i];
+            struct trace* trace = sprof_data_trace(data, index);
+            trace->next = 0;
+            trace->multiplicity = sample->weight > UINT32_MAX ? UINT32_MAX : sample->weight;
+            store_trace_header(trace, 0, sample->len);
+            memcpy(trace->locs, sample->locs, sample->len * ELEMENT_SIZE);
+            index += TRACE_PREFIX_ELEMENTS + sample->len;
+        }
+    }
+    heap_profile_unlock();
+    thread_sigmask(SIG_SETMASK, &oldset, 0);
+    return (uword_t)data;
+}
+
+/* Forget all samples */
+void heap_profile_reset(void)
+{
+    sigset_t oldset;
+    block_blockable_signals(&oldset);
+    heap_profile_lock();
+    if (heap_profile.samples)
+        os_deallocate((void*)heap_profile.samples,
+                      heap_profile.capacity * sizeof (struct heap_sample));
+    heap_profile.samples = 0;
+    heap_profile.count = heap_profile.capacity = 0;
+    heap_profile_unlock();
+    thread_sigmask(SIG_SETMASK, &oldset, 0);
+}
+#else
+uword_t heap_profile_snapshot(void) { return 0; }
+void heap_profile_reset(void) {}
+#endif
+
 /// Ensuring mutual exclusivity with the SIGPROF handler,
 /// return the profiling data for 'thread', or 0 if none.
 uword_t acquire_sprof_data(struct thread* thread)
@@ -573,3 +746,96 @@ uword_t acquire_sprof_data(struct thread* thread)
     // This this thread owns that thread's data. ('This' and 'that' could be the same)
     return retval;
 }
+
+/* The process-wide ITIMER_PROF measures the CPU time of all threads together,
+ * and the kernel signals whichever thread it likes when it expires, so busy
+ * threads aren't sampled in proportion to their CPU time, and an idle one may
+ * take samples that should have been theirs. Where possible, each Lisp thread
+ * instead gets a timer on its own CPU clock which signals just that thread.
+ * Threads created while profiling get one too, in init_new_thread().
+ * 'sprof_timer_usec' and the timers are protected by all_threads_lock. */
+#if defined LISP_FEATURE_LINUX && defined LISP_FEATURE_SB_THREAD
+#include <pthread.h>
+#include <time.h>
+#ifndef SIGEV_THREAD_ID
+#define SIGEV_THREAD_ID 4
+#endif
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+static long sprof_timer_usec;
+
+void arm_sprof_thread_timer(struct thread* th)
+{
+    struct extra_thread_data *data = thread_extra_data(th);
+    if (!sprof_timer_usec || data->sprof_timer_armed) return;
+    clockid_t clock;
+    if (pthread_getcpuclockid(th->os_thread, &clock)) return;
+    struct sigevent sev;
+    memset(&sev, 0, sizeof sev);
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_notify_thread_id = th->os_kernel_tid;
+    struct itimerspec its;
+    its.it_interval.tv_sec = sprof_timer_usec / 1000000;
+    its.it_interval.tv_nsec = (sprof_timer_usec % 1000000) * 1000;
+    its.it_value = its.it_interval;
+    if (timer_create(clock, &sev, &data->sprof_timer))
+        return;
+    if (timer_settime(data->sprof_timer, 0, &its, 0))
+        timer_delete(data->sprof_timer);
+    else
+        data->sprof_timer_armed = 1;
+}
+
+void disarm_sprof_thread_timer(struct thread* th)
+{
+    struct extra_thread_data *data = thread_extra_data(th);
+    if (data->sprof_timer_armed) {
+        timer_delete(data->sprof_timer);
+        data->sprof_timer_armed = 0;
+    }
+}
+
+/* Called from Lisp to sample each thread every 'usec' microseconds of its CPU time.
+ * Return 1 if every thread has a timer, or else 0 having armed none */
+int sb_sprof_start_thread_timers(long usec)
+{
+    if (usec <= 0) return 0;
+    struct thread* th;
+    int all_armed = 1;
+    sigset_t oldset;
+    block_blockable_signals(&oldset);
+    thread_mutex_lock(&all_threads_lock);
+    sprof_timer_usec = usec;
+    for_each_thread(th) {
+        arm_sprof_thread_timer(th);
+        if (!thread_extra_data(th)->sprof_timer_armed) all_armed = 0;
+    }
+    if (!all_armed) {
+        sprof_timer_usec = 0;
+        for_each_thread(th) disarm_sprof_thread_timer(th);
+    }
+    thread_mutex_unlock(&all_threads_lock);
+    thread_sigmask(SIG_SETMASK, &oldset, 0);
+    return all_armed;
+}
+
+void sb_sprof_stop_thread_timers(void)
+{
+    struct thread* th;
+    sigset_t oldset;
+    block_blockable_signals(&oldset);
+    thread_mutex_lock(&all_threads_lock);
+    sprof_timer_usec = 0;
+    for_each_thread(th) disarm_sprof_thread_timer(th);
+    thread_mutex_unlock(&all_threads_lock);
+    thread_sigmask(SIG_SETMASK, &oldset, 0);
+}
+#else
+void arm_sprof_thread_timer(struct thread __attribute__((unused)) *th) {}
+void disarm_sprof_thread_timer(struct thread __attribute__((unused)) *th) {}
+int sb_sprof_start_thread_timers(long __attribute__((unused)) usec) { return 0; }
+void sb_sprof_stop_thread_timers(void) {}
+#endif
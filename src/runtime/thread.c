@@ -50,6 +50,8 @@
 #include "getallocptr.h"
 #include "interrupt.h"
 #include "lispregs.h"
+#include "gc-thread-pool.h"
+#include "tracelog.h"
 
 #ifdef LISP_FEATURE_SB_THREAD
 
@@ -121,6 +123,26 @@ unlink_thread(struct thread *th)
 
 #ifndef LISP_FEATURE_SB_SAFEPOINT
 
+#ifdef STOP_THE_WORLD_BARRIER
+/* The number of threads which gc_stop_the_world() has signaled and which are
+ * still running, plus one while it is signaling them. Whichever thread brings
+ * this to zero wakes the stopper. */
+static int stw_pending;
+/* Incremented by gc_start_the_world() to release every stopped thread */
+int stw_generation;
+
+/* Wait in the SIG_STOP_FOR_GC handler until the world is restarted, and return
+ * the new state. 'generation' is the value of stw_generation that the thread
+ * observed before it entered STATE_STOPPED. */
+int wait_for_world_start(struct thread *thread, int generation)
+{
+    int state;
+    while ((state = get_thread_state(thread)) == STATE_STOPPED)
+        futex_wait(&stw_generation, generation, -1, 0);
+    return state;
+}
+#endif
+
 void
 set_thread_state(struct thread *thread,
                  char state,
@@ -149,6 +171,13 @@ set_thread_state(struct thread *thread,
                 os_sem_post(&semaphores->state_not_stopped_sem, "set_thread_state (not stopped)");
         }
         thread->state_word.state = state;
+#ifdef STOP_THE_WORLD_BARRIER
+        if (semaphores->stop_requested) { // so this thread was RUNNING
+            semaphores->stop_requested = 0;
+            if (__sync_sub_and_fetch(&stw_pending, 1) == 0)
+                futex_wake(&stw_pending, 1);
+        }
+#endif
     }
     os_sem_post(&semaphores->state_sem, "set_thread_state");
     if (!signals_already_blocked)
@@ -267,15 +296,17 @@ static long stw_elapsed,
     stw_min_duration = LONG_MAX, stw_max_duration, stw_sum_duration,
     gc_min_duration = LONG_MAX, gc_max_duration, gc_sum_duration;
 int show_gc_stats, n_gcs_done;
+extern void gc_note_stw_time(uint64_t, int);
+extern void write_gc_event_summary(FILE*);
 static void summarize_gc_stats(void) {
-    // TODO: also collect things like number of root pages,bytes scanned
-    // and number of pages,bytes copied on average per GC cycle.
-    if (show_gc_stats && n_gcs_done)
+    if (show_gc_stats && n_gcs_done) {
         fprintf(stderr,
                 "\nGC: time-to-stw=%ld,%ld,%ld \u00B5s (min,avg,max) pause=%ld,%ld,%ld \u00B5s over %d GCs\n",
                 stw_min_duration/1000, stw_sum_duration/n_gcs_done/1000, stw_max_duration/1000,
                 gc_min_duration/1000, gc_sum_duration/n_gcs_done/1000, gc_max_duration/1000,
                 n_gcs_done);
+        write_gc_event_summary(stderr);
+    }
 }
 void reset_gc_stats() { // after sb-posix:fork
     stw_min_duration = LONG_MAX; stw_max_duration = stw_sum_duration = 0;
@@ -385,6 +416,8 @@ init_new_thread(struct thread *th,
     lock_ret = thread_mutex_lock(&all_threads_lock);
     gc_assert(lock_ret == 0);
     link_thread(th);
+    arm_sprof_thread_timer(th);
+    tracelog_attach_thread(th);
     thread_mutex_unlock(&all_threads_lock);
 
     /* Kludge: Changed the order of some steps between the safepoint/
@@ -411,6 +444,7 @@ unregister_thread(struct thread *th,
 
     block_blockable_signals(0);
     ensure_region_closed(&th->alloc_region, BOXED_PAGE_FLAG);
+    gc_flush_remset_buffer(th);
     pop_gcing_safety(&scribble->safety);
     lock_ret = thread_mutex_lock(&all_threads_lock);
     gc_assert(lock_ret == 0);
@@ -437,6 +471,7 @@ unregister_thread(struct thread *th,
      * There's no reason for that, so closing of regions should be done
      * sooner to eliminate an ordering constraint. */
     ensure_region_closed(&th->alloc_region, BOXED_PAGE_FLAG);
+    gc_flush_remset_buffer(th);
     unlink_thread(th);
     thread_mutex_unlock(&all_threads_lock);
     gc_assert(lock_ret == 0);
@@ -444,6 +479,10 @@ unregister_thread(struct thread *th,
 #endif
 
     arch_os_thread_cleanup(th);
+    // No one else can arm or disarm it once it's unlinked
+    disarm_sprof_thread_timer(th);
+    release_alloc_profile_buffer(th);
+    tracelog_detach_thread(th);
 
     struct extra_thread_data *semaphores = thread_extra_data(th);
 #ifdef LISP_FEATURE_UNIX
@@ -956,9 +995,8 @@ alloc_thread_struct(void* spaces, lispobj start_routine) {
     th->this = th;
     th->os_kernel_tid = 0;
     th->os_thread = 0;
-    // Once allocated, the allocation profiling buffer sticks around.
-    // If present and enabled, assign into the new thread.
-    th->profile_data = (uword_t*)(alloc_profiling ? alloc_profile_buffer : 0);
+    // Each thread counts allocations into its own buffer, if profiling
+    assign_alloc_profile_buffer(th);
 
 # ifdef LISP_FEATURE_WIN32
     thread_extra_data(th)->carried_base_pointer = 0;
@@ -977,6 +1015,9 @@ alloc_thread_struct(void* spaces, lispobj start_routine) {
 #endif
     extra_data->sprof_lock = 0;
     th->sprof_data = 0;
+#ifdef LISP_FEATURE_GENCGC
+    th->slow_path_allocs = th->alloc_region_goal = th->alloc_epoch_bytes = 0;
+#endif
 
     th->state_word.state = STATE_RUNNING;
     th->state_word.sprof_enable = 0;
@@ -1151,6 +1192,44 @@ void release_gc_lock() { pthread_mutex_unlock(&in_gc_lock); }
  * (so that dereferencing was valid), but if dereferencing was valid, then the thread
  * can't have died (i.e. if ESRCH could be returned, then that implies that
  * the memory shouldn't be there) */
+/* Send SIG_STOP_FOR_GC to 'th' if it is running */
+static void signal_thread_for_stop(struct thread *th)
+{
+    gc_assert(th->os_thread != 0);
+    struct extra_thread_data *semaphores = thread_extra_data(th);
+    os_sem_wait(&semaphores->state_sem, "notify stop");
+    int state = get_thread_state(th);
+    if (state == STATE_RUNNING) {
+#ifdef STOP_THE_WORLD_BARRIER
+        semaphores->stop_requested = 1;
+        __sync_fetch_and_add(&stw_pending, 1);
+#endif
+        int rc = pthread_kill(th->os_thread,SIG_STOP_FOR_GC);
+        /* This used to bogusly check for ESRCH.
+         * I changed the ESRCH case to just fall into lose() */
+        if (rc) lose("cannot suspend thread %p: %d, %s",
+             // KLUDGE: assume that os_thread can be cast as pointer.
+             // See comment in 'interr.h' about that.
+             (void*)th->os_thread, rc, strerror(rc));
+    }
+    os_sem_post(&semaphores->state_sem, "notified stop");
+}
+
+#ifdef STOP_THE_WORLD_BARRIER
+/* With at least this many threads to stop, GC helper threads (if there are
+ * any) share in sending the signals */
+#define PARALLEL_STOP_THRESHOLD 32
+
+static void signal_threads_for_stop(int worker, int n_workers, void* me)
+{
+    struct thread *th;
+    int i = 0;
+    for_each_thread(th)
+        if (th != me && i++ % n_workers == worker)
+            signal_thread_for_stop(th);
+}
+#endif
+
 void gc_stop_the_world()
 {
 #ifdef COLLECT_GC_STATS
@@ -1160,30 +1239,35 @@ void gc_stop_the_world()
     clock_gettime(CLOCK_MONOTONIC, &stw_begin_time);
 #endif
     struct thread *th, *me = get_sb_vm_thread();
-    int rc;
+    int rc, n_others = 0;
 
+    trace_begin("stop the world", 0);
     /* Keep threads from registering with GC while the world is stopped. */
     rc = thread_mutex_lock(&all_threads_lock);
     gc_assert(rc == 0);
 
+    for_each_thread(th) if (th != me) ++n_others;
+#ifdef STOP_THE_WORLD_BARRIER
+    /* Signal all other threads, then wait once for the last of them to stop,
+     * instead of waiting on each thread in turn. The stopper's own count in
+     * stw_pending keeps the barrier closed until all signals are sent. */
+    stw_pending = 1;
+    if (n_others < PARALLEL_STOP_THRESHOLD
+        || !gc_run_on_idle_thread_pool(signal_threads_for_stop, me))
+        signal_threads_for_stop(0, 1, me);
+    int pending = __sync_sub_and_fetch(&stw_pending, 1);
+    while (pending) {
+        futex_wait(&stw_pending, pending, -1, 0);
+        pending = __sync_fetch_and_add(&stw_pending, 0);
+    }
+    for_each_thread(th) {
+        gc_assert(th == me || get_thread_state(th) != STATE_RUNNING);
+    }
+#else
     /* stop all other threads by sending them SIG_STOP_FOR_GC */
     for_each_thread(th) {
-        if (th != me) {
-            gc_assert(th->os_thread != 0);
-            struct extra_thread_data *semaphores = thread_extra_data(th);
-            os_sem_wait(&semaphores->state_sem, "notify stop");
-            int state = get_thread_state(th);
-            if (state == STATE_RUNNING) {
-                rc = pthread_kill(th->os_thread,SIG_STOP_FOR_GC);
-                /* This used to bogusly check for ESRCH.
-                 * I changed the ESRCH case to just fall into lose() */
-                if (rc) lose("cannot suspend thread %p: %d, %s",
-                     // KLUDGE: assume that os_thread can be cast as pointer.
-                     // See comment in 'interr.h' about that.
-                     (void*)th->os_thread, rc, strerror(rc));
-            }
-            os_sem_post(&semaphores->state_sem, "notified stop");
-        }
+        if (th != me)
+            signal_thread_for_stop(th);
     }
     for_each_thread(th) {
         if (th != me) {
@@ -1191,12 +1275,17 @@ void gc_stop_the_world()
             gc_assert(state != STATE_RUNNING);
         }
     }
+#endif
     FSHOW_SIGNAL((stderr,"/gc_stop_the_world:end\n"));
+    trace_end("stop the world", n_others);
 #ifdef COLLECT_GC_STATS
     clock_gettime(CLOCK_MONOTONIC, &stw_end_time);
     stw_elapsed = (stw_end_time.tv_sec - stw_begin_time.tv_sec)*1000000000L
                 + (stw_end_time.tv_nsec - stw_begin_time.tv_nsec);
     gc_start_time = stw_end_time;
+    if (stw_elapsed >= 0) gc_note_stw_time(stw_elapsed, n_others);
+#else
+    (void)n_others;
 #endif
 }
 
@@ -1222,6 +1311,10 @@ void gc_start_the_world()
 #endif
     struct thread *th, *me = get_sb_vm_thread();
     int lock_ret;
+    sigset_t old;
+    trace_begin("start the world", 0);
+    // Saves two syscalls per thread in set_thread_state()
+    block_blockable_signals(&old);
     /* if a resumed thread creates a new thread before we're done with
      * this loop, the new thread will be suspended waiting to acquire
      * the all_threads lock */
@@ -1235,13 +1328,19 @@ void gc_start_the_world()
             if (state != STATE_DEAD) {
                 if(state != STATE_STOPPED)
                     lose("gc_start_the_world: bad thread state %x", state);
-                set_thread_state(th, STATE_RUNNING, 0);
+                set_thread_state(th, STATE_RUNNING, 1);
             }
         }
     }
+#ifdef STOP_THE_WORLD_BARRIER
+    __sync_fetch_and_add(&stw_generation, 1);
+    futex_wake(&stw_generation, INT_MAX);
+#endif
+    thread_sigmask(SIG_SETMASK, &old, 0);
 
     lock_ret = thread_mutex_unlock(&all_threads_lock);
     gc_assert(lock_ret == 0);
+    trace_end("start the world", 0);
 }
 
 #endif /* !LISP_FEATURE_SB_SAFEPOINT */
@@ -40,6 +40,19 @@ enum threadstate {STATE_RUNNING=1, STATE_STOPPED, STATE_DEAD};
 #ifdef LISP_FEATURE_SB_THREAD
 void set_thread_state(struct thread *thread, char state, boolean);
 int thread_wait_until_not(int state, struct thread *thread);
+#if defined LISP_FEATURE_SB_FUTEX && !defined LISP_FEATURE_SB_SAFEPOINT
+/* Threads stopped for GC all wait on one futex for the world to restart */
+#define STOP_THE_WORLD_BARRIER
+extern int stw_generation;
+int wait_for_world_start(struct thread *thread, int generation);
+/* Defined in the OS-specific file */
+#if defined __FreeBSD__ || defined __DragonFly__
+extern int futex_wait(int *lock_word, long oldval, long sec, unsigned long usec);
+#else
+extern int futex_wait(int *lock_word, int oldval, long sec, unsigned long usec);
+#endif
+extern int futex_wake(int *lock_word, int n);
+#endif
 #endif
 
 #if defined(LISP_FEATURE_SB_SAFEPOINT)
@@ -88,6 +101,9 @@ struct extra_thread_data
     // make these "only" 4 bytes each, instead of lispwords.
     uint32_t state_not_running_waitcount;
     uint32_t state_not_stopped_waitcount;
+    // Set by gc_stop_the_world() when it signals this thread, and cleared when
+    // the thread leaves STATE_RUNNING. Also protected by 'state_sem'.
+    char stop_requested;
 #endif
 #if defined LISP_FEATURE_SB_THREAD && defined LISP_FEATURE_UNIX
     // According to https://github.com/adrienverge/openfortivpn/issues/105
@@ -99,6 +115,22 @@ struct extra_thread_data
     os_sem_t sprof_sem;
 #endif
     int sprof_lock;
+#if defined LISP_FEATURE_LINUX && defined LISP_FEATURE_SB_THREAD
+    // Timer on this thread's CPU clock, for sb-sprof. Valid if 'sprof_timer_armed'
+    timer_t sprof_timer;
+    char sprof_timer_armed;
+#endif
+    // Where this thread records events while tracing. See tracelog.c
+    struct trace_ring *trace_ring;
+#ifdef LISP_FEATURE_GENCGC
+    // Sequential store buffer of pages unprotected by this thread,
+    // flushed into the GC's remembered set. See gc_log_unprotected_page()
+#define REMSET_SSB_SIZE 32
+    int remset_ssb_count;
+    sword_t remset_ssb[REMSET_SSB_SIZE];
+    // Bytes claimed since this thread's last heap profile sample
+    uword_t heap_profile_bytes;
+#endif
 #ifdef LISP_FEATURE_WIN32
     // these are different from the masks that interrupt_data holds
     sigset_t pending_signal_set;
@@ -357,6 +389,10 @@ inline static int lisp_thread_p(os_context_t __attribute__((unused)) *context) {
 }
 
 extern void record_backtrace_from_context(void*,struct thread*);
+/* Start or stop the profiling timer of a thread which is being linked into
+ * or has been unlinked from all_threads */
+extern void arm_sprof_thread_timer(struct thread*);
+extern void disarm_sprof_thread_timer(struct thread*);
 
 #if defined(LISP_FEATURE_MACH_EXCEPTION_HANDLER)
 extern kern_return_t mach_lisp_thread_init(struct thread *thread);
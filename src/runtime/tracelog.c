@@ -0,0 +1,281 @@
+/*
+ * Per-thread event tracing, written out in the Chrome trace format
+ */
+
+/*
+ * This software is part of the SBCL system. See the README file for
+ * more information.
+ *
+ * This software is derived from the CMU CL system, which was
+ * written at Carnegie Mellon University and released into the
+ * public domain. The software is in the public domain and is
+ * provided with absolutely no warranty. See the COPYING and CREDITS
+ * files for more information.
+ */
+
+/* Each Lisp thread records events into a ring buffer of its own, which
+ * keeps the most recent events. A thread's signal handlers record events
+ * too, and may interrupt it in the middle of recording one, so a slot is
+ * claimed by atomically incrementing the ring's index. A slot's sequence
+ * number is 0 while the slot is being written, and then one more than the
+ * index of the event in it. tracelog_write_json() copies an event only if
+ * the sequence number is the same before and after, so neither recording
+ * nor writing the log ever waits for the other.
+ *
+ * Timestamps are read from the time stamp counter where there is one, and
+ * converted to microseconds when the log is written, by comparing the
+ * counter's progress since tracelog_start() with the monotonic clock's.
+ *
+ * A ring outlives its thread, so that the events of threads which exited
+ * can be written, and is freed by the next tracelog_start(). */
+
+#include "sbcl.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef LISP_FEATURE_UNIX
+# include <sched.h>
+#endif
+#include "runtime.h"
+#include "os.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "genesis/vector.h"
+#include "lispstring.h"
+#include "tracelog.h"
+#ifdef LISP_FEATURE_SB_THREAD
+# include "genesis/thread-instance.h"
+#endif
+
+struct trace_event {
+    uword_t seq;
+    uint64_t time; // from tracelog_clock()
+    const char *name;
+    uword_t arg;
+    char phase;
+};
+
+struct trace_ring {
+    struct trace_ring *next_ring;
+    uword_t next;  // index of the next event to record
+    uword_t first; // index of the first event since tracelog_start()
+    uword_t mask;  // number of slots - 1
+    int tid;
+    char exited;
+    char name[64];
+    struct trace_event events[1];
+};
+
+int tracelog_enabled;
+/* Slots in each new ring. A power of 2 */
+static int ring_events;
+/* Pushed onto by tracelog_attach_thread(), and changed otherwise only by
+ * tracelog_start(). Both run with all_threads_lock held */
+static struct trace_ring *all_rings;
+/* Serializes freeing rings with writing them out. Never taken with
+ * all_threads_lock held nor by the collector, so it's a plain spinlock */
+static int rings_lock;
+static uint64_t base_ticks, base_ns;
+
+static inline uint64_t tracelog_clock(void)
+{
+#if defined LISP_FEATURE_X86 || defined LISP_FEATURE_X86_64
+    return __builtin_ia32_rdtsc();
+#elif defined LISP_FEATURE_UNIX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+static uint64_t monotonic_ns(void)
+{
+#ifdef LISP_FEATURE_UNIX
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+static void lock_rings(void)
+{
+    while (__sync_lock_test_and_set(&rings_lock, 1)) {
+#ifdef LISP_FEATURE_UNIX
+        sched_yield();
+#endif
+    }
+}
+static void unlock_rings(void)
+{
+    __sync_lock_release(&rings_lock);
+}
+
+void tracelog_record(char phase, const char *name, uword_t arg)
+{
+    struct thread *th = get_sb_vm_thread();
+    struct trace_ring *ring = th ? thread_extra_data(th)->trace_ring : 0;
+    if (!ring) return;
+    uword_t index = __sync_fetch_and_add(&ring->next, 1);
+    struct trace_event *event = &ring->events[index & ring->mask];
+    __atomic_store_n(&event->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    event->time = tracelog_clock();
+    event->name = name;
+    event->arg = arg;
+    event->phase = phase;
+    __atomic_store_n(&event->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+/* Copy the thread's name, as far as it's printable ASCII, for the log.
+ * The name can't move, since no GC runs while all_threads_lock is held */
+static void copy_thread_name(struct thread *th, char *buf, int size)
+{
+    int n = 0;
+#ifdef LISP_FEATURE_SB_THREAD
+    if (lowtag_of(th->lisp_thread) == INSTANCE_POINTER_LOWTAG) {
+        lispobj name = ((struct thread_instance*)native_pointer(th->lisp_thread))->name;
+        if (other_pointer_p(name) && string_widetag_p(widetag_of(native_pointer(name)))) {
+            struct vector *string = VECTOR(name);
+            int len = vector_len(string);
+            for ( ; n < len && n < size - 1; ++n) {
+                unsigned int c = schar(string, n);
+                buf[n] = (c >= ' ' && c < 0x7F && c != '"' && c != '\\') ? c : '?';
+            }
+        }
+    }
+#else
+    (void)th;
+    strncpy(buf, "main thread", size - 1);
+    n = strlen(buf);
+#endif
+    buf[n] = 0;
+}
+
+void tracelog_attach_thread(struct thread *th)
+{
+    struct extra_thread_data *extra = thread_extra_data(th);
+    if (!tracelog_enabled || extra->trace_ring) return;
+    struct trace_ring *ring =
+        calloc(1, sizeof (struct trace_ring) + (ring_events - 1) * sizeof (struct trace_event));
+    if (!ring) return; // this thread's events are dropped
+    ring->mask = ring_events - 1;
+    ring->tid = th->os_kernel_tid;
+    copy_thread_name(th, ring->name, sizeof ring->name);
+    ring->next_ring = all_rings;
+    // tracelog_write_json() may be reading the list
+    __atomic_store_n(&all_rings, ring, __ATOMIC_RELEASE);
+    extra->trace_ring = ring;
+}
+
+void tracelog_detach_thread(struct thread *th)
+{
+    struct extra_thread_data *extra = thread_extra_data(th);
+    struct trace_ring *ring = extra->trace_ring;
+    if (ring) {
+        extra->trace_ring = 0;
+        // Only now may tracelog_start() free it
+        __atomic_store_n(&ring->exited, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* Discard the events recorded so far, and record events from now on into
+ * rings of 'events_per_thread' slots, rounded up to a power of 2. Threads
+ * which already have a ring keep it. */
+int tracelog_start(int events_per_thread)
+{
+    int n = 2;
+    while (n < events_per_thread && n < (1<<24)) n <<= 1;
+    struct thread *th;
+    sigset_t oldset;
+    // Wait for any writer of the log with signals unblocked, to let GC stop us
+    lock_rings();
+    block_blockable_signals(&oldset);
+#ifdef LISP_FEATURE_SB_THREAD
+    thread_mutex_lock(&all_threads_lock);
+#endif
+    struct trace_ring **prev = &all_rings, *ring;
+    while ((ring = *prev) != 0) {
+        if (__atomic_load_n(&ring->exited, __ATOMIC_ACQUIRE)) {
+            *prev = ring->next_ring;
+            free(ring);
+        } else {
+            ring->first = __atomic_load_n(&ring->next, __ATOMIC_ACQUIRE);
+            prev = &ring->next_ring;
+        }
+    }
+    ring_events = n;
+    base_ticks = tracelog_clock();
+    base_ns = monotonic_ns();
+    tracelog_enabled = 1;
+    for_each_thread(th) tracelog_attach_thread(th);
+#ifdef LISP_FEATURE_SB_THREAD
+    thread_mutex_unlock(&all_threads_lock);
+#endif
+    thread_sigmask(SIG_SETMASK, &oldset, 0);
+    unlock_rings();
+    return n;
+}
+
+void tracelog_stop(void)
+{
+    tracelog_enabled = 0;
+}
+
+/* Write the events recorded since tracelog_start() to 'pathname' as a JSON
+ * object in the Chrome trace event format, which Perfetto and
+ * chrome://tracing load. Return 0, or -1 with errno set if the file could
+ * not be written. */
+int tracelog_write_json(char *pathname)
+{
+    FILE *f = fopen(pathname, "w");
+    if (!f) return -1;
+    lock_rings();
+    uint64_t ticks = tracelog_clock(), ns = monotonic_ns();
+    // On a machine without a usable clock, assume that ticks are nanoseconds
+    double ticks_per_us = (ns > base_ns && ticks > base_ticks)
+        ? (double)(ticks - base_ticks) * 1000 / (ns - base_ns) : 1000;
+    int pid = getpid();
+    const char *separator = "";
+    struct trace_ring *ring;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (ring = __atomic_load_n(&all_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next_ring) {
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s\"}}", separator, pid, ring->tid, ring->name);
+        separator = ",\n";
+        uword_t end = __atomic_load_n(&ring->next, __ATOMIC_ACQUIRE);
+        uword_t start = end > ring->mask + 1 ? end - (ring->mask + 1) : 0;
+        if (start < ring->first) start = ring->first;
+        uword_t i;
+        for (i = start; i < end; ++i) {
+            struct trace_event *slot = &ring->events[i & ring->mask], event;
+            if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != i + 1) continue;
+            event = *slot;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != i + 1)
+                continue; // overwritten while being copied
+            double ts = (int64_t)(event.time - base_ticks) / ticks_per_us;
+            if (event.phase == 'X')
+                fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                        "\"pid\":%d,\"tid\":%d}",
+                        event.name, ts - event.arg / 1000.0, event.arg / 1000.0,
+                        pid, ring->tid);
+            else
+                fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\",%s\"ts\":%.3f,"
+                        "\"pid\":%d,\"tid\":%d,\"args\":{\"value\":%"PRIu64"}}",
+                        event.name, event.phase, event.phase == 'i' ? "\"s\":\"t\"," : "",
+                        ts, pid, ring->tid, (uint64_t)event.arg);
+        }
+    }
+    unlock_rings();
+    fprintf(f, "\n]}\n");
+    int error = ferror(f);
+    if (fclose(f) || error) return -1;
+    return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * This software is part of the SBCL system. See the README file for
+ * more information.
+ *
+ * This software is derived from the CMU CL system, which was
+ * written at Carnegie Mellon University and released into the
+ * public domain. The software is in the public domain and is
+ * provided with absolutely no warranty. See the COPYING and CREDITS
+ * files for more information.
+ */
+
+#ifndef _TRACELOG_H_
+#define _TRACELOG_H_
+
+#include "runtime.h"
+
+struct thread;
+
+/* Nonzero while events are being recorded. Each Lisp thread records into a
+ * ring buffer of its own; events of other threads are dropped. 'name' must
+ * be a string constant, since it is only looked at when the log is written.
+ * 'phase' is as in the Chrome trace format: 'B'egin, 'E'nd, 'i'nstant,
+ * or 'X' for a complete event whose 'arg' is its duration in nanoseconds,
+ * recorded when it ends. */
+extern int tracelog_enabled;
+extern void tracelog_record(char phase, const char *name, uword_t arg);
+
+static inline void trace_begin(const char *name, uword_t arg) {
+    if (tracelog_enabled) tracelog_record('B', name, arg);
+}
+static inline void trace_end(const char *name, uword_t arg) {
+    if (tracelog_enabled) tracelog_record('E', name, arg);
+}
+static inline void trace_instant(const char *name, uword_t arg) {
+    if (tracelog_enabled) tracelog_record('i', name, arg);
+}
+static inline void trace_complete(const char *name, uword_t duration_ns) {
+    if (tracelog_enabled) tracelog_record('X', name, duration_ns);
+}
+
+/* Give 'th' a ring buffer if recording, and take it away when 'th' exits.
+ * The caller of tracelog_attach_thread() holds all_threads_lock. */
+extern void tracelog_attach_thread(struct thread *th);
+extern void tracelog_detach_thread(struct thread *th);
+
+/* Called from Lisp */
+extern int tracelog_start(int events_per_thread);
+extern void tracelog_stop(void);
+extern int tracelog_write_json(char *pathname);
+
+#endif /* _TRACELOG_H_ */
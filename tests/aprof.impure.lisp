@@ -135,3 +135,25 @@ sb-vm::
                                                  :output-file fasl
                                                  :print nil :verbose nil))
                         :stream (make-broadcast-stream))))
+
+;;; Each thread counts into its own buffer. Counts of threads that have
+;;; exited are still included.
+(defun make-fruitbaskets (n)
+  (declare (inline make-fruitbasket)
+           (optimize sb-c::instrument-consing))
+  (loop repeat n collect (make-fruitbasket)))
+(compile 'make-fruitbaskets)
+(with-test (:name :aprof-threads
+            :skipped-on :darwin
+            :fails-on (not :immobile-space))
+  (let ((nbytes
+         (sb-aprof:aprof-run
+          (lambda ()
+            (mapc #'sb-thread:join-thread
+                  (loop repeat 4
+                        collect (sb-thread:make-thread #'make-fruitbaskets
+                                                       :arguments 1000))))
+          :stream nil)))
+    (assert (= nbytes
+               (* 4 1000 (+ (sb-ext:primitive-object-size (make-fruitbasket))
+                            (* 2 sb-vm:n-word-bytes)))))))
@@ -0,0 +1,159 @@
+#!/bin/sh
+
+# testing garbage collection with helper threads
+
+# This software is part of the SBCL system. See the README file for
+# more information.
+#
+# While most of SBCL is derived from the CMU CL system, the test
+# files (like this one) were written from scratch after the fork
+# from CMU CL.
+#
+# This software is in the public domain and is provided with
+# absolutely no warranty. See the COPYING and CREDITS files for
+# more information.
+
+. ./subr.sh
+
+run_sbcl_with_args --gc-threads 4 --noinform --no-sysinit --no-userinit \
+    --disable-debugger <<EOF
+  (defvar *tree* nil)
+  (defvar *table* (make-hash-table :weakness :key))
+  (defun churn (n)
+    (dotimes (i n)
+      (push (make-array (1+ (random 50)) :initial-element (list i)) *tree*)
+      (when (zerop (mod i 3)) (pop *tree*))
+      (setf (gethash (cons i i) *table*) i)))
+  (defun check-tree ()
+    (assert (= (length *tree*) (* 66666 (floor (length *tree*) 66666))))
+    (dolist (v *tree*)
+      (assert (typep (aref v 0) '(cons fixnum null)))))
+  (let ((kept (list 4 5 6))
+        (kept-wp nil))
+    (setq kept-wp (make-weak-pointer kept))
+    (dotimes (i 5)
+      (churn 100000)
+      (gc))
+    (check-tree)
+    (gc :full t)
+    (churn 100000)
+    #+gencgc (gc :gen 7)
+    (check-tree)
+    (gc :full t)
+    (check-tree)
+    (assert (eq (weak-pointer-value kept-wp) kept))
+    (assert (< (hash-table-count *table*) 100000)))
+  ;; Enough threads for the helpers to share in stopping the world
+  #+sb-thread
+  (let* ((sem (sb-thread:make-semaphore))
+         (threads (loop repeat 50
+                        collect (sb-thread:make-thread #'sb-thread:wait-on-semaphore
+                                                       :arguments (list sem)))))
+    (dotimes (i 5)
+      (churn 100000)
+      (gc))
+    (sb-thread:signal-semaphore sem 50)
+    (mapc #'sb-thread:join-thread threads))
+  (sb-ext:quit :unix-status $EXIT_LISP_WIN)
+EOF
+check_status_maybe_lose "GC with helper threads" $?
+
+# After a lazy (GC :GEN 7), garbage is swept by allocation, by a helper thread
+# if there is one, before a heap walk, or at the start of the next GC.
+for threads in 1 4; do
+run_sbcl_with_args --gc-threads $threads --gc-lazy-sweep --noinform \
+    --no-sysinit --no-userinit --disable-debugger <<EOF
+  #-gencgc (sb-ext:quit :unix-status $EXIT_LISP_WIN)
+  (defvar *tree* nil)
+  (defun churn (n)
+    (dotimes (i n)
+      (push (make-array (1+ (random 50)) :initial-element (list i)) *tree*)
+      (when (zerop (mod i 3)) (pop *tree*))))
+  (defun check-tree ()
+    (dolist (v *tree*)
+      (assert (typep (aref v 0) '(cons fixnum null)))))
+  (dotimes (i 3)
+    (churn 100000)
+    (gc :gen 7)
+    (churn 100000)
+    (check-tree))
+  (gc :gen 7)
+  (assert (sb-vm:list-allocated-objects :dynamic :type sb-vm:simple-vector-widetag
+                                                 :count 10))
+  (gc :gen 7)
+  (gc :full t)
+  (check-tree)
+  (sb-ext:quit :unix-status $EXIT_LISP_WIN)
+EOF
+check_status_maybe_lose "lazy sweep with $threads GC threads" $?
+done
+
+# Huge pages are protected as a whole, so stores into old objects which share
+# a huge page with unprotected cards must still be seen by the next GC
+run_sbcl_with_args --huge-pages --noinform --no-sysinit --no-userinit \
+    --disable-debugger <<EOF
+  (defvar *old* (coerce (loop for i below 200000 collect (make-array 10)) 'vector))
+  (gc :full t)
+  (dotimes (round 3)
+    (dotimes (i (length *old*))
+      (when (zerop (mod i (+ round 2)))
+        (setf (aref (aref *old* i) 0) (list round i))))
+    (gc)
+    (dotimes (i (length *old*))
+      (let ((x (aref (aref *old* i) 0)))
+        (assert (or (null x) (typep x '(cons fixnum (cons fixnum null)))))))
+    (gc :full t))
+  (sb-ext:quit :unix-status $EXIT_LISP_WIN)
+EOF
+check_status_maybe_lose "GC with huge pages" $?
+
+# Free pages are released by a helper thread while the mutator allocates
+for target in 0 64; do
+run_sbcl_with_args --gc-threads 2 --gc-rss-target $target --noinform \
+    --no-sysinit --no-userinit --disable-debugger <<EOF
+  (defvar *keep* nil)
+  (dotimes (round 20)
+    (let ((garbage (loop repeat 2000 collect (make-array 1000))))
+      (setq *keep* (list (length garbage) (make-array 100 :initial-element round))))
+    (gc :full t)
+    ;; Memory is handed out zeroed whether or not it was released
+    (let ((fresh (loop repeat 1000 collect (make-array 1000))))
+      (assert (every (lambda (v) (every (lambda (x) (eql x 0)) v)) fresh)))
+    (assert (= (aref (second *keep*) 99) round)))
+  (sb-ext:quit :unix-status $EXIT_LISP_WIN)
+EOF
+check_status_maybe_lose "background release with RSS target $target" $?
+done
+
+# With two (pretend) NUMA nodes, a thread's new objects go in its node's half
+SBCL_FAKE_NUMA_NODES=2 run_sbcl_with_args --numa --noinform --no-sysinit \
+    --no-userinit --disable-debugger <<EOF
+  #-(and sb-thread linux) (sb-ext:quit :unix-status $EXIT_LISP_WIN)
+  (let ((middle (+ sb-vm:dynamic-space-start
+                   (* (floor (floor (sb-ext:dynamic-space-size) sb-vm:gencgc-card-bytes) 2)
+                      sb-vm:gencgc-card-bytes))))
+    (dotimes (i 8)
+      (destructuring-bind (node address)
+          (sb-thread:join-thread
+           (sb-thread:make-thread
+            (lambda ()
+              (let ((v (make-array 100)))
+                (list (mod (sb-thread::thread-os-tid sb-thread:*current-thread*) 2)
+                      (sb-kernel:get-lisp-obj-address v))))))
+        (assert (eq (>= address middle) (= node 1))))))
+  (defvar *tree* nil)
+  (mapc #'sb-thread:join-thread
+        (loop repeat 4
+              collect (sb-thread:make-thread
+                       (lambda ()
+                         (dotimes (i 100000)
+                           (let ((v (make-array 10 :initial-element i)))
+                             (sb-ext:atomic-push v *tree*)))))))
+  (gc :full t)
+  (assert (= (length *tree*) 400000))
+  (assert (every (lambda (v) (eql (aref v 0) (aref v 9))) *tree*))
+  (sb-ext:quit :unix-status $EXIT_LISP_WIN)
+EOF
+check_status_maybe_lose "NUMA with fake topology" $?
+
+exit $EXIT_TEST_WIN
@@ -225,6 +225,128 @@
     (assert (not (gc-logfile)))
     (delete-file p)))
 
+(with-test (:name :gc-logfile-json :skipped-on (not :gencgc))
+  (assert (eq (gc-logfile-format) :text))
+  (let ((p (scratch-file-name "log")))
+    (setf (gc-logfile) p (gc-logfile-format) :json)
+    (unwind-protect (progn (gc) (gc :full t))
+      (setf (gc-logfile) nil (gc-logfile-format) :text))
+    (with-open-file (stream p)
+      (let ((lines (loop for line = (read-line stream nil) while line collect line)))
+        (assert (>= (length lines) 2))
+        (dolist (line lines)
+          (assert (char= (char line 0) #\{))
+          (assert (search "\"bytes_copied\":" line))
+          (assert (search "\"generations\":[{" line)))))
+    (delete-file p)))
+
+(with-test (:name :gc-events :skipped-on (not :gencgc))
+  (gc)
+  (let* ((before (gc-events))
+         (last (aref before (1- (length before)))))
+    (assert (<= (length before) 128))
+    (gc :full t)
+    (let* ((after (gc-events))
+           (new (aref after (1- (length after)))))
+      (assert (= (gc-event-serial new) (1+ (gc-event-serial last))))
+      (assert (= (gc-event-generation new) sb-vm:+highest-normal-generation+))
+      (assert (>= (gc-event-pause new)
+                  (+ (gc-event-pin-time new) (gc-event-roots-time new)
+                     (gc-event-newspace-time new) (gc-event-weak-time new)
+                     (gc-event-free-time new))))
+      (assert (plusp (gc-event-bytes-copied new))))))
+
+(with-test (:name :gc-events-threads-stopped
+            :skipped-on (not (and :gencgc :sb-thread :linux :64-bit)))
+  (let* ((sem (sb-thread:make-semaphore))
+         (threads (loop repeat 40
+                        collect (sb-thread:make-thread #'sb-thread:wait-on-semaphore
+                                                       :arguments (list sem)))))
+    (unwind-protect
+         (progn
+           (gc)
+           (let* ((events (gc-events))
+                  (event (aref events (1- (length events)))))
+             (assert (>= (gc-event-threads-stopped event) 40))
+             (assert (plusp (gc-event-time-to-stop event)))))
+      (sb-thread:signal-semaphore sem 40)
+      (mapc #'sb-thread:join-thread threads))))
+
+(defvar *survivors* nil)
+(with-test (:name :gc-max-pause :skipped-on (not (and :gencgc :unix)))
+  (flet ((nursery ()
+           (gc)
+           (- (extern-alien "auto_gc_trigger" os-vm-size-t)
+              (extern-alien "bytes_allocated" os-vm-size-t))))
+    (assert (null (gc-max-pause)))
+    (let ((default (nursery)))
+      (setf (gc-max-pause) 1/1000000)
+      (unwind-protect
+           (progn
+             (assert (= (gc-max-pause) 1d-6))
+             ;; Give the model some copying to measure
+             (dotimes (i 5)
+               (setq *survivors* (make-list 100000))
+               (gc))
+             (setq *survivors* nil)
+             ;; An unattainable goal gives the smallest nursery
+             (assert (< (nursery) default))
+             (assert (= (bytes-consed-between-gcs) default)))
+        (setf (gc-max-pause) nil))
+      (assert (= (nursery) default)))))
+
+(with-test (:name :thread-allocation-statistics :skipped-on (not :gencgc))
+  (let ((slow-path-allocs (sb-thread:thread-allocation-statistics
+                           sb-thread:*current-thread*)))
+    (dotimes (i 4)
+      (setq *survivors* (make-list 1000000))
+      (gc))
+    (setq *survivors* nil)
+    (multiple-value-bind (count region-goal)
+        (sb-thread:thread-allocation-statistics sb-thread:*current-thread*)
+      (assert (> count slow-path-allocs))
+      ;; A thread which allocates this much should use regions of more than
+      ;; one page
+      (assert (> region-goal sb-vm:gencgc-card-bytes))))
+  #+sb-thread
+  (let ((thread (sb-thread:make-thread (lambda ()))))
+    (sb-thread:join-thread thread)
+    (assert (null (sb-thread:thread-allocation-statistics thread)))))
+
+(with-test (:name :gc-mark-region :skipped-on (not :gencgc))
+  (flet ((full-gc-bytes-copied ()
+           (gc :full t)
+           (let ((events (gc-events)))
+             (gc-event-bytes-copied (aref events (1- (length events)))))))
+    (setq *survivors* (make-list 1000000 :initial-element 'x))
+    (gc :full t)
+    (let ((copied (full-gc-bytes-copied)))
+      (setf (extern-alien "gencgc_mark_region" int) 1)
+      (unwind-protect
+           ;; The list is densely packed in the oldest generation, so stays put
+           (assert (< (* 2 (full-gc-bytes-copied)) copied))
+        (setf (extern-alien "gencgc_mark_region" int) 0)))
+    (assert (= (count 'x *survivors*) 1000000))
+    (setq *survivors* nil)))
+
+(with-test (:name :gc-remset :skipped-on (not :gencgc))
+  (setf (extern-alien "gencgc_remset" int) 1)
+  (unwind-protect
+       (let ((old (make-array 1000)))
+         ;; Put OLD in the oldest generation. The remembered set is built
+         ;; at the end of this GC.
+         (gc :full t)
+         (dotimes (i 5)
+           ;; Only the remembered set knows that OLD points to these
+           (dotimes (j 1000)
+             (setf (aref old j) (list i j)))
+           (gc)
+           (gc :gen 1)
+           (dotimes (j 1000)
+             (assert (equal (aref old j) (list i j))))))
+    (setf (extern-alien "gencgc_remset" int) 0)
+    (gc)))
+
 #+nil ; immobile-code
 (with-test (:name (sb-kernel::order-by-in-degree :uninterned-function-names))
   ;; This creates two functions whose names are uninterned symbols and
@@ -10,6 +10,11 @@ export SBCL_FAKE_MMAP_INSTRUCTION_FILE=`pwd`/fakemap
   --eval '(gc :full t)' \
   --eval '(exit)'
 
+./test-sbcl --core ../../output/sbcl.core --lazy-core-relocation \
+  --eval '(setf (extern-alien "verify_gens" char) 0)' \
+  --eval '(gc :full t)' \
+  --eval '(exit)'
+
 # TODO:
 # 1. this needs to be run as part of the regression suite
 # 2. and split into one test per shell file for parallelization
@@ -36,4 +36,32 @@ chmod u+x "$tmpcore"
 ./"$tmpcore" --no-userinit --no-sysinit
 check_status_maybe_lose "SAVE-LISP-AND-DIE :EXECUTABLE-COMPRESS" $? 0 "(executable compressed saved core ran)"
 
+rm "$tmpcore"
+run_sbcl <<EOF
+  (save-lisp-and-die "$tmpcore" :toplevel (lambda () 42)
+                     :compression (cond ((member :sb-zstd *features*) '(:zstd 3))
+                                        ((member :sb-core-compression *features*) 9)))
+EOF
+run_sbcl_with_core "$tmpcore" --noinform --no-userinit --no-sysinit
+check_status_maybe_lose "SAVE-LISP-AND-DIE :COMPRESSION codec" $? 0 "(codec compressed saved core ran)"
+
+run_sbcl_with_core "$tmpcore" --lazy-core-decompression --noinform \
+    --no-userinit --no-sysinit
+check_status_maybe_lose "--lazy-core-decompression" $? 0 "(lazily decompressed core ran)"
+
+rm "$tmpcore"
+run_sbcl <<EOF
+  (save-lisp-and-die "$tmpcore" :compression (and (member :sb-core-compression *features*) t))
+EOF
+run_sbcl_with_core "$tmpcore" --lazy-core-decompression --noinform \
+    --no-userinit --no-sysinit --disable-debugger <<EOF
+  (defun describe-car () (with-output-to-string (s) (describe 'car s)))
+  (let ((before (describe-car)))
+    (gc)
+    (assert (string= before (describe-car))))
+  (gc :full t)
+  (exit :code $EXIT_LISP_WIN)
+EOF
+check_status_maybe_lose "--lazy-core-decompression with GC" $? $EXIT_LISP_WIN "(ok)"
+
 exit $EXIT_TEST_WIN
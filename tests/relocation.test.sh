@@ -34,6 +34,40 @@ do
               --eval '(gc :full t)' --quit
 done
 
+# With --lazy-core-relocation, the objects which need more than their words
+# fixed up are relocated after their pages have been made inaccessible, which
+# faults them in. Save a core that lists enough code objects and address-based
+# hash tables to take many chunks of that list.
+create_test_subdirectory
+tmpcore=$TEST_DIRECTORY/$TEST_FILESTEM.core
+run_sbcl <<EOF
+  (defvar *funs* (coerce (loop for i below 3000 collect (compile nil (list 'lambda () i)))
+                         'vector))
+  (defvar *tables* (loop for i below 1000
+                         collect (let ((table (make-hash-table :test 'eq)))
+                                   (setf (gethash table table) i)
+                                   table)))
+  (save-lisp-and-die "$tmpcore")
+EOF
+i=1
+while [ $i -le 6 ]
+do
+  echo Lazy trial $i
+  i=`expr $i + 1`
+  $test_sbcl --lose-on-corruption --disable-ldb --noinform --core $tmpcore \
+              --lazy-core-relocation --no-sysinit --no-userinit --noprint \
+              --disable-debugger \
+              --eval '(dotimes (i 3000) (assert (= (funcall (aref *funs* i)) i)))' \
+              --eval '(loop for table in *tables* for i from 0
+                            do (assert (eql (gethash table table) i)))' \
+              --eval '(gc :full t)' --quit
+done
+
+# Loading reports the time spent in each phase when asked to
+$test_sbcl --lose-on-corruption --disable-ldb --show-startup-times \
+           --core ../output/sbcl.core --no-sysinit --no-userinit --noprint \
+           --disable-debugger --quit 2>&1 >/dev/null | grep "^core loaded by"
+
 rm -f $test_sbcl
 
 exit $EXIT_TEST_WIN
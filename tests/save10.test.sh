@@ -0,0 +1,56 @@
+#!/bin/sh
+
+# tests of SAVE-LISP-AND-DIE :BASE-CORE
+
+# This software is part of the SBCL system. See the README file for
+# more information.
+#
+# While most of SBCL is derived from the CMU CL system, the test
+# files (like this one) were written from scratch after the fork
+# from CMU CL.
+#
+# This software is in the public domain and is provided with
+# absolutely no warranty. See the COPYING and CREDITS files for
+# more information.
+
+. ./subr.sh
+
+use_test_subdirectory
+
+basecore=$TEST_FILESTEM-base.core
+tmpcore=$TEST_FILESTEM.core
+
+run_sbcl <<EOF
+  (defvar *base* (make-list 1000 :initial-element 'base))
+  (save-lisp-and-die "$basecore")
+EOF
+run_sbcl_with_core "$basecore" --noinform --no-userinit --no-sysinit \
+    --disable-debugger <<EOF
+  (defvar *delta* (make-array 100000 :initial-element 42))
+  (setf (car *base*) 'changed)
+  (defun answer () (svref *delta* 99999))
+  (save-lisp-and-die "$tmpcore" #+gencgc :base-core #+gencgc "$basecore")
+EOF
+run_sbcl_with_core "$tmpcore" --noinform --no-userinit --no-sysinit \
+    --disable-debugger <<EOF
+  #+gencgc
+  (flet ((size (file) (with-open-file (s file) (file-length s))))
+    (assert (< (size "$tmpcore") (/ (size "$basecore") 2))))
+  (assert (eq (car *base*) 'changed))
+  (assert (eq (car (last *base*)) 'base))
+  (gc :full t)
+  (assert (= (answer) 42))
+  (exit :code $EXIT_LISP_WIN)
+EOF
+check_status_maybe_lose "SAVE-LISP-AND-DIE :BASE-CORE" $? $EXIT_LISP_WIN "(delta core ran)"
+
+mv "$basecore" "$basecore.moved"
+run_sbcl_with_core "$tmpcore" --base-core "$basecore.moved" --noinform \
+    --no-userinit --no-sysinit --disable-debugger <<EOF
+  (assert (= (answer) 42))
+  (exit :code $EXIT_LISP_WIN)
+EOF
+check_status_maybe_lose "--base-core" $? $EXIT_LISP_WIN "(moved base core found)"
+
+rm "$tmpcore" "$basecore.moved"
+exit $EXIT_TEST_WIN
@@ -0,0 +1,67 @@
+#!/bin/sh
+
+# tests of SB-EXT:WRITE-ACCESS-PROFILE and SAVE-LISP-AND-DIE :ACCESS-PROFILE
+
+# This software is part of the SBCL system. See the README file for
+# more information.
+#
+# While most of SBCL is derived from the CMU CL system, the test
+# files (like this one) were written from scratch after the fork
+# from CMU CL.
+#
+# This software is in the public domain and is provided with
+# absolutely no warranty. See the COPYING and CREDITS files for
+# more information.
+
+. ./subr.sh
+
+use_test_subdirectory
+
+basecore=$TEST_FILESTEM-base.core
+tmpcore=$TEST_FILESTEM.core
+profile=$TEST_FILESTEM.profile
+
+# The strings are moved to read-only pages by the second save, so the copies
+# which were loaded from the base core, and touched, must not be kept.
+run_sbcl <<EOF
+  (defvar *table* (let ((h (make-hash-table)))
+                    (dotimes (i 1000 h)
+                      (let ((name (format nil "~R" i)))
+                        (sb-int:logically-readonlyize name)
+                        (setf (gethash i h) name)))))
+  (defun lookup (i) (gethash i *table*))
+  (save-lisp-and-die "$basecore")
+EOF
+run_sbcl_with_core "$basecore" --noinform --no-userinit --no-sysinit \
+    --disable-debugger <<EOF
+  #-(and gencgc linux) (exit :code $EXIT_LISP_WIN)
+  (assert (string= (lookup 42) "forty-two"))
+  (write-access-profile "$profile")
+  (assert (probe-file "$profile"))
+  (save-lisp-and-die "$tmpcore" :access-profile "$profile" :read-only-constants t)
+EOF
+status=$?
+if [ -f "$tmpcore" ]; then
+    run_sbcl_with_core "$tmpcore" --noinform --no-userinit --no-sysinit \
+        --disable-debugger <<EOF
+  (let ((name (format nil "~R" 42)) (n 0))
+    (sb-vm:map-allocated-objects
+     (lambda (obj type size)
+       (declare (ignore type size))
+       (when (and (stringp obj) (not (eq obj name)) (string= obj name))
+         (incf n)))
+     :dynamic)
+    (assert (= n 1)))
+  (assert (string= (lookup 42) "forty-two"))
+  (gc :full t)
+  (assert (string= (lookup 999) "nine hundred ninety-nine"))
+  (exit :code $EXIT_LISP_WIN)
+EOF
+    check_status_maybe_lose "SAVE-LISP-AND-DIE :ACCESS-PROFILE" $? $EXIT_LISP_WIN "(profiled core ran)"
+    rm "$tmpcore" "$profile"
+else
+    check_status_maybe_lose "WRITE-ACCESS-PROFILE" $status $EXIT_LISP_WIN "(not supported)"
+fi
+
+rm "$basecore"
+exit $EXIT_TEST_WIN
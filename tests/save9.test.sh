@@ -0,0 +1,40 @@
+#!/bin/sh
+
+# tests of SAVE-LISP-AND-DIE :READ-ONLY-CONSTANTS
+
+# This software is part of the SBCL system. See the README file for
+# more information.
+#
+# While most of SBCL is derived from the CMU CL system, the test
+# files (like this one) were written from scratch after the fork
+# from CMU CL.
+#
+# This software is in the public domain and is provided with
+# absolutely no warranty. See the COPYING and CREDITS files for
+# more information.
+
+. ./subr.sh
+
+use_test_subdirectory
+
+tmpcore=$TEST_FILESTEM.core
+
+run_sbcl <<EOF
+  (defvar *name* (copy-seq "a string nobody modifies"))
+  (sb-int:logically-readonlyize *name*)
+  (save-lisp-and-die "$tmpcore" #+gencgc :read-only-constants #+gencgc t)
+EOF
+run_sbcl_with_core "$tmpcore" --noinform --no-userinit --no-sysinit \
+    --disable-debugger <<EOF
+  #-gencgc (exit :code $EXIT_LISP_WIN)
+  (assert (string= *name* "a string nobody modifies"))
+  (assert (typep (nth-value 1 (ignore-errors (setf (char *name* 0) #\b)))
+                 'sb-sys:memory-fault-error))
+  (gc :full t)
+  (assert (string= *name* "a string nobody modifies"))
+  (exit :code $EXIT_LISP_WIN)
+EOF
+check_status_maybe_lose "SAVE-LISP-AND-DIE :READ-ONLY-CONSTANTS" $? $EXIT_LISP_WIN "(saved core ran)"
+
+rm "$tmpcore"
+exit $EXIT_TEST_WIN
@@ -10,6 +10,8 @@
            #:initial-fun-core-entry-type-code
            #:page-table-core-entry-type-code
            #:linkage-table-core-entry-type-code
+           #:relocation-table-core-entry-type-code
+           #:base-core-core-entry-type-code
            #:end-core-entry-type-code
            #:max-core-space-id
            ;;
@@ -19,7 +21,8 @@
            #:dynamic-core-space-id
            #:immobile-fixedobj-core-space-id
            #:immobile-varyobj-core-space-id
-           #:deflated-core-space-id-flag))
+           #:deflated-core-space-id-flag
+           #:delta-core-space-id-flag))
 
 (in-package "SB-COREFILE")
 
@@ -46,6 +49,8 @@
 (defconstant initial-fun-core-entry-type-code 3863)
 (defconstant page-table-core-entry-type-code 3880)
 (defconstant linkage-table-core-entry-type-code 3881)
+(defconstant relocation-table-core-entry-type-code 3882)
+(defconstant base-core-core-entry-type-code 3883)
 (defconstant end-core-entry-type-code 3840)
 
 (defconstant dynamic-core-space-id 1)
@@ -55,3 +60,4 @@
 (defconstant immobile-varyobj-core-space-id 5)
 (defconstant static-code-core-space-id 4)
 (defconstant deflated-core-space-id-flag 8)
+(defconstant delta-core-space-id-flag 16)